@@ -0,0 +1,142 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <memory.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define ARENA_ALIGN             16
+#define ARENA_DEFAULT_BLOCKSIZE (64 * 1024)
+
+#define ARENA_ALIGNUP(n) \
+    (((n) + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1))
+
+typedef struct arena_block {
+    struct arena_block* prev;
+    size_t cap;
+    size_t used;
+} arena_block;
+
+// header size rounded up so that the data area keeps ARENA_ALIGN alignment
+#define ARENA_BLOCK_HDRSIZE ARENA_ALIGNUP(sizeof(arena_block))
+#define ARENA_BLOCK_DATA(b) ((char*)(b) + ARENA_BLOCK_HDRSIZE)
+
+typedef struct arena {
+    arena_block* cur;
+    size_t blocksize;
+    size_t total;  // sum of the capacity of all blocks
+} arena;
+
+static inline arena_block* i_arena_newblock(arena* a, size_t mincap) {
+    size_t cap = a->blocksize;
+    if (cap < mincap) {
+        cap = ARENA_ALIGNUP(mincap);
+    }
+    arena_block* b = (arena_block*)malloc(ARENA_BLOCK_HDRSIZE + cap);
+    if (!b) {
+        return NULL;
+    }
+    b->prev = a->cur;
+    b->cap = cap;
+    b->used = 0;
+    a->cur = b;
+    a->total += cap;
+    return b;
+}
+
+// blocksize 0 means ARENA_DEFAULT_BLOCKSIZE.
+static inline arena* arena_new(size_t blocksize) {
+    arena* a = (arena*)malloc(sizeof(arena));
+    if (!a) {
+        return NULL;
+    }
+    a->cur = NULL;
+    a->total = 0;
+    a->blocksize =
+        ARENA_ALIGNUP(blocksize ? blocksize : ARENA_DEFAULT_BLOCKSIZE);
+    if (!i_arena_newblock(a, 0)) {
+        free(a);
+        return NULL;
+    }
+    return a;
+}
+
+// returns NULL if fail to allocate a new block.
+static inline void* arena_alloc(arena* a, size_t size) {
+    size = ARENA_ALIGNUP(size ? size : 1);
+    arena_block* b = a->cur;
+    if (!b || b->cap - b->used < size) {
+        b = i_arena_newblock(a, size);
+        if (!b) {
+            return NULL;
+        }
+    }
+    void* p = ARENA_BLOCK_DATA(b) + b->used;
+    b->used += size;
+    return p;
+}
+
+// grows `p` in place if it is the last allocation of the current block,
+// otherwise allocates a new area and copies `oldsize` bytes over.
+static inline void* arena_realloc(arena* a, void* p, size_t oldsize,
+                                  size_t newsize) {
+    if (!p) {
+        return arena_alloc(a, newsize);
+    }
+    arena_block* b = a->cur;
+    if (!b) {
+        return NULL;
+    }
+    size_t oldal = ARENA_ALIGNUP(oldsize ? oldsize : 1);
+    size_t newal = ARENA_ALIGNUP(newsize ? newsize : 1);
+    if ((char*)p + oldal == ARENA_BLOCK_DATA(b) + b->used &&
+        b->used - oldal + newal <= b->cap) {
+        b->used = b->used - oldal + newal;
+        return p;
+    }
+    if (newsize <= oldsize) {
+        return p;
+    }
+    void* np = arena_alloc(a, newsize);
+    if (!np) {
+        return NULL;
+    }
+    memcpy(np, p, oldsize);
+    return np;
+}
+
+// releases everything allocated so far. If the arena had to grow, its blocks
+// are merged into a single one of the total size, so that the next round of
+// allocations of a similar volume fits without growing again.
+static inline void arena_reset(arena* a) {
+    if (a->cur && !a->cur->prev) {
+        a->cur->used = 0;
+        return;
+    }
+    size_t total = a->total;
+    arena_block* b = a->cur;
+    while (b) {
+        arena_block* prev = b->prev;
+        free(b);
+        b = prev;
+    }
+    a->cur = NULL;
+    a->total = 0;
+    if (!i_arena_newblock(a, total)) {
+        // keep the arena usable with the default block size
+        i_arena_newblock(a, 0);
+    }
+}
+
+static inline void arena_free(arena* a) {
+    if (!a) return;
+    arena_block* b = a->cur;
+    while (b) {
+        arena_block* prev = b->prev;
+        free(b);
+        b = prev;
+    }
+    free(a);
+}
+
+#endif  // ARENA_H
@@ -1,107 +1,1079 @@
+// asks for the POSIX declarations used below, such as fdopen, which strict
+// modes like -std=c11 hide otherwise
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "jj.h"
 
-void jj_oput(jj_jsonobj* obj, jj_jsonobj* val) {
+#include "pow5.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+#define LJJ_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(LJJ_HAVE_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define LJJ_HAVE_AVX2 1
+#include <immintrin.h>
+#define LJJ_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#if !defined(_WIN32)
+#define LJJ_HAVE_PTHREAD 1
+#define LJJ_HAVE_MMAP    1
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/random.h>)
+#define LJJ_HAVE_GETRANDOM 1
+#include <sys/random.h>
+#endif
+#endif
+#include <time.h>
+
+UJJ_THREAD_LOCAL arena* ojj_cur_arena = NULL;
+
+uint64_t ojj_hash_seed = 0;
+
+// fills `buf` from the random source of the system. Returns false if there is
+// none to read from.
+static bool ojj_random(void* buf, size_t len) {
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || \
+    defined(__NetBSD__)
+    arc4random_buf(buf, len);
+    return true;
+#else
+#ifdef LJJ_HAVE_GETRANDOM
+    if (getrandom(buf, len, 0) == (ssize_t)len) {
+        return true;
+    }
+#endif
+    FILE* f = fopen("/dev/urandom", "rb");
+    if (!f) {
+        return false;
+    }
+    bool ok = fread(buf, 1, len, f) == len;
+    fclose(f);
+    return ok;
+#endif
+}
+
+// draws the seed of `ojj_hash` from the random source of the system, and
+// sets it unless another thread did first, so that every thread ends up
+// with the same seed.
+uint64_t ojj_hash_seed_init(void) {
+#ifdef JJ_HASH_SEED
+    uint64_t x = JJ_HASH_SEED;
+#else
+    uint64_t x = 0;
+    if (!ojj_random(&x, sizeof(x))) {
+        // no random source: where the process was loaded and the time,
+        // which are far easier to guess
+        x = (uint64_t)(uintptr_t)&ojj_hash_seed ^ (uint64_t)time(NULL) << 20;
+        x += 0x9e3779b97f4a7c15;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+        x ^= x >> 31;
+    }
+#endif
+    if (!x) x = 1;  // 0 stands for not set
+#if defined(__GNUC__) || defined(__clang__)
+    uint64_t expected = 0;
+    if (!__atomic_compare_exchange_n(&ojj_hash_seed, &expected, x, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return expected;  // the seed another thread set
+    }
+#else
+    // MSVC makes volatile accesses atomic, and there are no threads of ours
+    // to race with on Windows
+    *(volatile uint64_t*)&ojj_hash_seed = x;
+#endif
+    return x;
+}
+
+const uint8_t ujj_charclass[256] = {
+    // control chars
+    [0x00] = UJJ_CC_ESC, [0x01] = UJJ_CC_ESC, [0x02] = UJJ_CC_ESC,
+    [0x03] = UJJ_CC_ESC, [0x04] = UJJ_CC_ESC, [0x05] = UJJ_CC_ESC,
+    [0x06] = UJJ_CC_ESC, [0x07] = UJJ_CC_ESC, [0x08] = UJJ_CC_ESC,
+    [0x0B] = UJJ_CC_ESC, [0x0C] = UJJ_CC_ESC, [0x0E] = UJJ_CC_ESC,
+    [0x0F] = UJJ_CC_ESC, [0x10] = UJJ_CC_ESC, [0x11] = UJJ_CC_ESC,
+    [0x12] = UJJ_CC_ESC, [0x13] = UJJ_CC_ESC, [0x14] = UJJ_CC_ESC,
+    [0x15] = UJJ_CC_ESC, [0x16] = UJJ_CC_ESC, [0x17] = UJJ_CC_ESC,
+    [0x18] = UJJ_CC_ESC, [0x19] = UJJ_CC_ESC, [0x1A] = UJJ_CC_ESC,
+    [0x1B] = UJJ_CC_ESC, [0x1C] = UJJ_CC_ESC, [0x1D] = UJJ_CC_ESC,
+    [0x1E] = UJJ_CC_ESC, [0x1F] = UJJ_CC_ESC,
+    // whitespace
+    ['\t'] = UJJ_CC_WS | UJJ_CC_TERM | UJJ_CC_ESC,
+    ['\n'] = UJJ_CC_WS | UJJ_CC_TERM | UJJ_CC_ESC,
+    ['\r'] = UJJ_CC_WS | UJJ_CC_TERM | UJJ_CC_ESC,
+    [' '] = UJJ_CC_WS | UJJ_CC_TERM,
+    // structural
+    ['{'] = UJJ_CC_STRUCT,
+    ['['] = UJJ_CC_STRUCT,
+    [':'] = UJJ_CC_STRUCT,
+    ['}'] = UJJ_CC_STRUCT | UJJ_CC_TERM,
+    [']'] = UJJ_CC_STRUCT | UJJ_CC_TERM,
+    [','] = UJJ_CC_STRUCT | UJJ_CC_TERM,
+    // escaped
+    ['"'] = UJJ_CC_ESC,
+    ['\\'] = UJJ_CC_ESC,
+    // digits
+    ['0'] = UJJ_CC_DIGIT, ['1'] = UJJ_CC_DIGIT, ['2'] = UJJ_CC_DIGIT,
+    ['3'] = UJJ_CC_DIGIT, ['4'] = UJJ_CC_DIGIT, ['5'] = UJJ_CC_DIGIT,
+    ['6'] = UJJ_CC_DIGIT, ['7'] = UJJ_CC_DIGIT, ['8'] = UJJ_CC_DIGIT,
+    ['9'] = UJJ_CC_DIGIT,
+};
+
+// the position of the member of a small object named `name`, of `len` bytes.
+static size_t ojj_objfind_flat(const jj_jsonobjdata* obj, const char* name,
+                               size_t len) {
+    for (size_t i = 0; i < obj->length; i++) {
+        const char* n = obj->names[i];
+        if (n == name) {
+            return i;  // the same interned key
+        }
+        if (OJJ_KEY(n)->len == len && n[0] == name[0] &&
+            memcmp(n, name, len) == 0) {
+            return i;
+        }
+    }
+    return OJJ_OBJ_NOTFOUND;
+}
+
+static ojj_objslot* ojj_objfind_index(const jj_jsonobjdata* obj,
+                                      const char* name, size_t len,
+                                      uint64_t hash) {
+    ojj_objslot probe = {hash, len, name, 0};
+    return (ojj_objslot*)hashmap_get(obj->index, &probe);
+}
+
+// indexes the members of `obj`, which is about to outgrow OJJ_OBJ_FLATMAX or
+// is made room for `cap` members.
+static int ojj_objindex(jj_jsonobjdata* obj, size_t cap) {
+    hashmap* index = ojj_new_objindex(cap);
+    if (!index) {
+        return -1;
+    }
+    for (size_t i = 0; i < obj->length; i++) {
+        ojj_key* k = OJJ_KEY(obj->names[i]);
+        ojj_objslot slot = {k->hash, k->len, k->str, i};
+        hashmap_set(index, &slot);
+        if (hashmap_oom(index)) {
+            hashmap_free(index);
+            return -1;
+        }
+    }
+    obj->index = index;
+    return 0;
+}
+
+// grows the members of `obj` and their names to `cap`.
+static int ojj_objresize(jj_jsonobjdata* obj, size_t cap) {
+    jj_jsonobj* members =
+        ojj_realloc(obj->members, obj->cap * sizeof(jj_jsonobj),
+                    cap * sizeof(jj_jsonobj));
+    if (!members) {
+        return -1;
+    }
+    obj->members = members;
+    char** names =
+        ojj_realloc(obj->names, obj->cap * sizeof(char*), cap * sizeof(char*));
+    if (!names) {
+        return -1;  // `members` is larger than needed, which is harmless
+    }
+    obj->names = names;
+    obj->cap = cap;
+    return 0;
+}
+
+int ojj_objreserve(jj_jsonobjdata* obj, size_t n) {
+    if (n > obj->cap && ojj_objresize(obj, n) != 0) {
+        return -1;
+    }
+    if (n > OJJ_OBJ_FLATMAX && !obj->index) {
+        return ojj_objindex(obj, n << 1);
+    }
+    return 0;
+}
+
+jj_jsonobj* ojj_objput(jj_jsonobjdata* obj, char* name,
+                       const jj_jsonobj* val) {
+    ojj_key* k = OJJ_KEY(name);
+    size_t pos;
+    if (obj->index) {
+        ojj_objslot* slot = ojj_objfind_index(obj, k->str, k->len, k->hash);
+        pos = slot ? slot->pos : OJJ_OBJ_NOTFOUND;
+        if (slot) slot->name = k->str;  // the old key is released below
+    } else {
+        pos = ojj_objfind_flat(obj, k->str, k->len);
+    }
+    if (pos != OJJ_OBJ_NOTFOUND) {
+        // a later duplicated key replaces the value of the earlier one, but
+        // keeps its place
+        jj_jsonobj old = obj->members[pos];
+        ojj_key_release(obj->names[pos]);
+        obj->members[pos] = *val;
+        obj->names[pos] = name;
+        ojj_free_innerval(&old);
+        return obj->members + pos;
+    }
+    if (obj->length == obj->cap &&
+        ojj_objresize(obj, obj->cap ? obj->cap << 1 : 4) != 0) {
+        return NULL;
+    }
+    if (!obj->index && obj->length == OJJ_OBJ_FLATMAX &&
+        ojj_objindex(obj, obj->length << 1) != 0) {
+        return NULL;
+    }
+    if (obj->index) {
+        ojj_objslot slot = {k->hash, k->len, k->str, obj->length};
+        hashmap_set(obj->index, &slot);
+        if (hashmap_oom(obj->index)) {
+            return NULL;
+        }
+    }
+    obj->names[obj->length] = name;
+    obj->members[obj->length] = *val;
+    return obj->members + obj->length++;
+}
+
+jj_jsonobj* ojj_oputval(jj_jsonobj* obj, const char* name,
+                        const jj_jsonobj* val) {
     if (!jj_is_json_type(obj, JJ_VALTYPE_OBJ)) {
+        return NULL;
+    }
+    size_t len = strlen(name);
+    char* key = ojj_key_new(name, len, ojj_hash(name, len));
+    jj_jsonobj* member = key ? ojj_objput(obj->data.objval, key, val) : NULL;
+    if (!member) {
+        ojj_key_release(key);
+    }
+    return member;
+}
+
+void jj_oput(jj_jsonobj* obj, const char* name, jj_jsonobj* val) {
+    if (!val) {
         return;
     }
-    hashmap_set(obj->data.objval, val);
-    free(val);  // since hashmap makes a shallow copy
+    if (!ojj_oputval(obj, name, val)) {
+        ojj_free_innerval(val);
+    }
+    ojj_free(val);  // since the object makes a shallow copy
 }
 
 jj_jsonobj* jj_oget(jj_jsonobj* obj, const char* name) {
     if (!jj_is_json_type(obj, JJ_VALTYPE_OBJ)) {
         return NULL;
     }
-    jj_jsonobj* g =
-        hashmap_get(obj->data.objval, &(jj_jsonobj){.name = (char*)name});
-    return g;
+    jj_jsonobjdata* o = obj->data.objval;
+    size_t len = strlen(name);
+    if (o->index) {
+        ojj_objslot* slot =
+            ojj_objfind_index(o, name, len, ojj_hash(name, len));
+        return slot ? o->members + slot->pos : NULL;
+    }
+    size_t pos = ojj_objfind_flat(o, name, len);
+    return pos != OJJ_OBJ_NOTFOUND ? o->members + pos : NULL;
+}
+
+// frees the string of `obj`, and returns true if it is a container whose
+// members are left to free.
+static inline bool ojj_free_leaf(jj_jsonobj* obj) {
+    if (obj->type == JJ_VALTYPE_STR) {
+        ojj_free(obj->data.strval);
+        return false;
+    }
+    return obj->type == JJ_VALTYPE_OBJ || obj->type == JJ_VALTYPE_ARR;
+}
+
+#define OJJ_FREE_STACKSIZE 32
+
+// keeps `child` on the stack of containers left to free.
+// containers that did not fit the stack of `ojj_free_innerval`, chained
+// through their `cap`, which freeing does not need: the data of the first
+// one, with its low bit set if it is an object, which links to the next.
+typedef uintptr_t ojj_free_spill;
+
+static void ojj_free_spillpush(ojj_free_spill* spill, jj_jsonobj* child) {
+    if (child->type == JJ_VALTYPE_OBJ) {
+        child->data.objval->cap = (size_t)*spill;
+        *spill = (uintptr_t)child->data.objval | 1;
+    } else {
+        child->data.arrval->cap = (size_t)*spill;
+        *spill = (uintptr_t)child->data.arrval;
+    }
+}
+
+static jj_jsonobj ojj_free_spillpop(ojj_free_spill* spill) {
+    jj_jsonobj c;
+    if (*spill & 1) {
+        c.type = JJ_VALTYPE_OBJ;
+        c.data.objval = (jj_jsonobjdata*)(*spill & ~(uintptr_t)1);
+        *spill = (uintptr_t)c.data.objval->cap;
+    } else {
+        c.type = JJ_VALTYPE_ARR;
+        c.data.arrval = (jj_jsonarrdata*)*spill;
+        *spill = (uintptr_t)c.data.arrval->cap;
+    }
+    return c;
+}
+
+static void ojj_free_push(jj_jsonobj** stack, size_t* n, size_t* cap,
+                          jj_jsonobj* local, ojj_free_spill* spill,
+                          jj_jsonobj* child) {
+    if (*n == *cap) {
+        size_t newcap = *cap << 1;
+        jj_jsonobj* s = malloc(sizeof(jj_jsonobj) * newcap);
+        if (!s) {
+            // still freed without recursion, nor any memory
+            ojj_free_spillpush(spill, child);
+            return;
+        }
+        memcpy(s, *stack, sizeof(jj_jsonobj) * *n);
+        if (*stack != local) free(*stack);
+        *stack = s;
+        *cap = newcap;
+    }
+    (*stack)[(*n)++] = *child;
 }
 
 void ojj_free_innerval(jj_jsonobj* obj) {
-    if (!obj) return;
-    if (obj->name) free(obj->name);
-    switch (obj->type) {
-        case JJ_VALTYPE_STR:
-            free(obj->data.strval);
-            break;
-        case JJ_VALTYPE_OBJ:
-            ojj_objfree(obj->data.objval);
-            break;
-        case JJ_VALTYPE_ARR:
-            ojj_arrfree(obj->data.arrval);
-            break;
-        default:
-            break;
+    if (!obj || !ojj_free_leaf(obj)) return;
+    // containers whose members are left to free, copied out of their parent
+    // which is freed first
+    jj_jsonobj local[OJJ_FREE_STACKSIZE];
+    jj_jsonobj* stack = local;
+    size_t n = 0, cap = OJJ_FREE_STACKSIZE;
+    ojj_free_spill spill = 0;
+    stack[n++] = *obj;
+    while (n > 0 || spill) {
+        jj_jsonobj c = n > 0 ? stack[--n] : ojj_free_spillpop(&spill);
+        jj_jsonobj* child;
+        if (c.type == JJ_VALTYPE_OBJ) {
+            jj_jsonobjdata* obj = c.data.objval;
+            for (size_t i = 0; i < obj->length; i++) {
+                ojj_key_release(obj->names[i]);
+                child = obj->members + i;
+                if (ojj_free_leaf(child)) {
+                    ojj_free_push(&stack, &n, &cap, local, &spill, child);
+                }
+            }
+            if (obj->index) hashmap_free(obj->index);
+            ojj_free(obj->members);
+            ojj_free(obj->names);
+            ojj_free(obj);
+            continue;
+        }
+        jj_jsonarrdata* arr = c.data.arrval;
+        for (size_t i = 0; i < arr->length; i++) {
+            child = arr->arr + i;
+            if (ojj_free_leaf(child)) {
+                ojj_free_push(&stack, &n, &cap, local, &spill, child);
+            }
+        }
+        ojj_free(arr->arr);
+        ojj_free(arr);
     }
+    if (stack != local) free(stack);
 }
 
 void jj_free(jj_jsonobj* root) {  // NOLINT
     ojj_free_innerval(root);
-    free(root);
+    ojj_free(root);
 }
 
-void ojj_objfree(hashmap* hm) {
-    if (!hm) return;
-    // size_t iter = 0;
-    // void* item;
-    // while (hashmap_iter(hm, &iter, &item)) {
-    //     jj_jsonobj* obj = item;
-    //     ojj_free_innerval(obj);
-    // }
-    hashmap_free(hm);
+void ojj_objfree(jj_jsonobjdata* objdata) {
+    if (!objdata) return;
+    jj_jsonobj obj = {.type = JJ_VALTYPE_OBJ, .data.objval = objdata};
+    ojj_free_innerval(&obj);
 }
 
 void ojj_arrfree(jj_jsonarrdata* arr) {
-    for (uint32_t i = 0; i < arr->length; i++) {
-        ojj_free_innerval(arr->arr + i);
+    jj_jsonobj obj = {.type = JJ_VALTYPE_ARR, .data.arrval = arr};
+    ojj_free_innerval(&obj);
+}
+
+// ************************ structural index ************************
+
+// bitmasks of one 64-byte block, bit i standing for byte i.
+typedef struct ljj_blockmasks {
+    uint64_t quote;  // '"'
+    uint64_t bs;     // '\\'
+    uint64_t op;     // one of "{}[]:,"
+    uint64_t ws;     // one of " \t\r\n"
+} ljj_blockmasks;
+
+typedef void (*ljj_classify_func)(const uint8_t* block, ljj_blockmasks* m);
+
+static inline int ujj_ctz64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(x);
+#else
+    int n = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        n++;
     }
-    free(arr->arr);
-    free(arr);
+    return n;
+#endif
 }
 
-static inline bool ljj_lex_str_escape_readunic(ljj_lexstate* state) {
-    char unic[5];
-    char cur;
+// the reference the SIMD kernels must agree with, only picked where there are
+// none.
+UJJ_MAYBE_UNUSED static void ljj_classify_scalar(const uint8_t* block,
+                                                 ljj_blockmasks* m) {
+    uint64_t quote = 0, bs = 0, op = 0, ws = 0;
+    for (int i = 0; i < 64; i++) {
+        uint64_t bit = (uint64_t)1 << i;
+        uint8_t cls = ujj_charclass[block[i]];
+        quote |= block[i] == '"' ? bit : 0;
+        bs |= block[i] == '\\' ? bit : 0;
+        op |= cls & UJJ_CC_STRUCT ? bit : 0;
+        ws |= cls & UJJ_CC_WS ? bit : 0;
+    }
+    m->quote = quote;
+    m->bs = bs;
+    m->op = op;
+    m->ws = ws;
+}
+
+#ifdef LJJ_HAVE_SSE2
+static void ljj_classify_sse2(const uint8_t* block, ljj_blockmasks* m) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bs = _mm_set1_epi8('\\');
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i lbrace = _mm_set1_epi8('{');  // also '[' once lowered
+    const __m128i rbrace = _mm_set1_epi8('}');  // also ']' once lowered
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i sp = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    uint64_t q = 0, b = 0, o = 0, w = 0;
     for (int i = 0; i < 4; i++) {
-        ljj_lexstate_nextchar(state);
-        if (ljj_lexstate_isatend(state)) return false;
-        cur = LJJ_LEXSTATE_CURCHAR(state);
-        unic[i] = cur;
+        __m128i v = _mm_loadu_si128((const __m128i*)(block + i * 16));
+        __m128i lv = _mm_or_si128(v, lower);
+        __m128i op = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(lv, lbrace),
+                         _mm_cmpeq_epi8(lv, rbrace)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+        __m128i ws = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+        int shift = i * 16;
+        q |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote))
+             << shift;
+        b |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, bs))
+             << shift;
+        o |= (uint64_t)(uint16_t)_mm_movemask_epi8(op) << shift;
+        w |= (uint64_t)(uint16_t)_mm_movemask_epi8(ws) << shift;
+    }
+    m->quote = q;
+    m->bs = b;
+    m->op = o;
+    m->ws = w;
+}
+#endif
+
+#ifdef LJJ_HAVE_AVX2
+LJJ_TARGET_AVX2
+static void ljj_classify_avx2(const uint8_t* block, ljj_blockmasks* m) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i bs = _mm256_set1_epi8('\\');
+    const __m256i lower = _mm256_set1_epi8(0x20);
+    const __m256i lbrace = _mm256_set1_epi8('{');
+    const __m256i rbrace = _mm256_set1_epi8('}');
+    const __m256i colon = _mm256_set1_epi8(':');
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i sp = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    uint64_t q = 0, b = 0, o = 0, w = 0;
+    for (int i = 0; i < 2; i++) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(block + i * 32));
+        __m256i lv = _mm256_or_si256(v, lower);
+        __m256i op = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(lv, lbrace),
+                            _mm256_cmpeq_epi8(lv, rbrace)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, colon),
+                            _mm256_cmpeq_epi8(v, comma)));
+        __m256i ws = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, sp),
+                            _mm256_cmpeq_epi8(v, tab)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, cr),
+                            _mm256_cmpeq_epi8(v, lf)));
+        int shift = i * 32;
+        q |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                 _mm256_cmpeq_epi8(v, quote))
+             << shift;
+        b |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, bs))
+             << shift;
+        o |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << shift;
+        w |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ws) << shift;
+    }
+    m->quote = q;
+    m->bs = b;
+    m->op = o;
+    m->ws = w;
+}
+#endif
+
+// returns the length of the leading run of `s` that can be copied as is into
+// a string: up to the first '"', '\\' or control char, or `len` if none.
+typedef size_t (*ljj_scanstr_func)(const char* s, size_t len);
+
+static size_t ljj_scanstr_scalar(const char* s, size_t len) {
+    size_t i = 0;
+    while (i < len && !UJJ_CHAR_IS(s[i], UJJ_CC_ESC)) {
+        i++;
+    }
+    return i;
+}
+
+#ifdef LJJ_HAVE_SSE2
+static size_t ljj_scanstr_sse2(const char* s, size_t len) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bs = _mm_set1_epi8('\\');
+    const __m128i ctrlmax = _mm_set1_epi8(0x1F);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bs)),
+            _mm_cmpeq_epi8(_mm_min_epu8(v, ctrlmax), v));  // v <= 0x1F
+        int mask = _mm_movemask_epi8(special);
+        if (mask) {
+            return i + ujj_ctz64((uint64_t)mask);
+        }
+    }
+    return i + ljj_scanstr_scalar(s + i, len - i);
+}
+#endif
+
+#ifdef LJJ_HAVE_AVX2
+LJJ_TARGET_AVX2
+static size_t ljj_scanstr_avx2(const char* s, size_t len) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i bs = _mm256_set1_epi8('\\');
+    const __m256i ctrlmax = _mm256_set1_epi8(0x1F);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i special = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                            _mm256_cmpeq_epi8(v, bs)),
+            _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctrlmax), v));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(special);
+        if (mask) {
+            return i + ujj_ctz64(mask);
+        }
+    }
+    return i + ljj_scanstr_scalar(s + i, len - i);
+}
+#endif
+
+// returns true if `s` is valid UTF-8: overlong forms, surrogates and code
+// points over U+10FFFF are not.
+typedef bool (*ljj_utf8_func)(const uint8_t* s, size_t len);
+
+// returns the length of the leading run of `s` that is valid UTF-8, so `len`
+// if all of it is.
+static size_t ujj_utf8_valid_prefix(const uint8_t* s, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        if (i + 8 <= len) {
+            // skips 8 ASCII chars at a time
+            uint64_t w;
+            memcpy(&w, s + i, 8);
+            if (!(w & 0x8080808080808080ULL)) {
+                i += 8;
+                continue;
+            }
+        }
+        uint8_t c = s[i];
+        if (c < 0x80) {
+            i++;
+            continue;
+        }
+        size_t n;
+        uint8_t lo = 0x80, hi = 0xBF;  // range of the second byte
+        if (c >= 0xC2 && c <= 0xDF) {
+            n = 2;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            n = 3;
+            if (c == 0xE0) lo = 0xA0;  // overlong
+            if (c == 0xED) hi = 0x9F;  // surrogate
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            n = 4;
+            if (c == 0xF0) lo = 0x90;  // overlong
+            if (c == 0xF4) hi = 0x8F;  // over U+10FFFF
+        } else {
+            return i;
+        }
+        if (len - i < n || s[i + 1] < lo || s[i + 1] > hi) {
+            return i;
+        }
+        for (size_t k = 2; k < n; k++) {
+            if ((s[i + k] & 0xC0) != 0x80) {
+                return i;
+            }
+        }
+        i += n;
+    }
+    return len;
+}
+
+static bool ljj_utf8_scalar(const uint8_t* s, size_t len) {
+    return ujj_utf8_valid_prefix(s, len) == len;
+}
+
+#ifdef LJJ_HAVE_AVX2
+// The lookup algorithm of Keiser and Lemire: the high and low nibbles of
+// each byte and the high nibble of the next one index 3 tables whose AND
+// flags any invalid pair, and the 3rd and 4th bytes of long sequences are
+// checked from the bytes 2 and 3 before.
+#define LJJ_U8_TOO_SHORT  (1 << 0)  // a lead not followed by a continuation
+#define LJJ_U8_TOO_LONG   (1 << 1)  // ASCII followed by a continuation
+#define LJJ_U8_OVERLONG_3 (1 << 2)  // 11100000 100_____
+#define LJJ_U8_TOO_LARGE  (1 << 3)  // over U+10FFFF
+#define LJJ_U8_SURROGATE  (1 << 4)  // 11101101 101_____
+#define LJJ_U8_OVERLONG_2 (1 << 5)  // 1100000_ 10______
+#define LJJ_U8_TOO_LARGE_1000 (1 << 6)  // 11110101+ 1000____
+#define LJJ_U8_OVERLONG_4     (1 << 6)  // 11110000 1000____
+#define LJJ_U8_TWO_CONTS      (1 << 7)  // 2 continuations in a row
+#define LJJ_U8_CARRY \
+    (LJJ_U8_TOO_SHORT | LJJ_U8_TOO_LONG | LJJ_U8_TWO_CONTS)
+
+// the 16 bytes of `t` in both lanes
+#define LJJ_U8_TABLE(...) \
+    _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+// the bytes of `v` shifted by `n` towards the end, the first ones taken from
+// the end of `prev`.
+#define LJJ_U8_PREV(v, prev, n)                                           \
+    _mm256_alignr_epi8((v), _mm256_permute2x128_si256((prev), (v), 0x21), \
+                       16 - (n))
+
+LJJ_TARGET_AVX2
+static inline __m256i ljj_utf8_errors_avx2(__m256i v, __m256i prev) {
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i t1 = LJJ_U8_TABLE(
+        // 0_______: ASCII before
+        LJJ_U8_TOO_LONG, LJJ_U8_TOO_LONG, LJJ_U8_TOO_LONG, LJJ_U8_TOO_LONG,
+        LJJ_U8_TOO_LONG, LJJ_U8_TOO_LONG, LJJ_U8_TOO_LONG, LJJ_U8_TOO_LONG,
+        // 10______: a continuation before
+        LJJ_U8_TWO_CONTS, LJJ_U8_TWO_CONTS, LJJ_U8_TWO_CONTS,
+        LJJ_U8_TWO_CONTS,
+        // 1100____, 1101____: a 2 byte lead before
+        LJJ_U8_TOO_SHORT | LJJ_U8_OVERLONG_2, LJJ_U8_TOO_SHORT,
+        // 1110____: a 3 byte lead before
+        LJJ_U8_TOO_SHORT | LJJ_U8_OVERLONG_3 | LJJ_U8_SURROGATE,
+        // 1111____: a 4 byte lead before
+        LJJ_U8_TOO_SHORT | LJJ_U8_TOO_LARGE | LJJ_U8_TOO_LARGE_1000 |
+            LJJ_U8_OVERLONG_4);
+    const __m256i t2 = LJJ_U8_TABLE(
+        // ____0000
+        LJJ_U8_CARRY | LJJ_U8_OVERLONG_3 | LJJ_U8_OVERLONG_2 |
+            LJJ_U8_OVERLONG_4,
+        // ____0001
+        LJJ_U8_CARRY | LJJ_U8_OVERLONG_2,
+        // ____001_
+        LJJ_U8_CARRY, LJJ_U8_CARRY,
+        // ____0100
+        LJJ_U8_CARRY | LJJ_U8_TOO_LARGE,
+        // ____0101 to ____1100
+        LJJ_U8_CARRY | LJJ_U8_TOO_LARGE | LJJ_U8_TOO_LARGE_1000,
+        LJJ_U8_CARRY | LJJ_U8_TOO_LARGE | LJJ_U8_TOO_LARGE_1000,
+        LJJ_U8_CARRY | LJJ_U8_TOO_LARGE | LJJ_U8_TOO_LARGE_1000,
+        LJJ_U8_CARRY | LJJ_U8_TOO_LARGE | LJJ_U8_TOO_LARGE_1000,
+        LJJ_U8_CARRY | LJJ_U8_TOO_LARGE | LJJ_U8_TOO_LARGE_1000,
+        LJJ_U8_CARRY | LJJ_U8_TOO_LARGE | LJJ_U8_TOO_LARGE_1000,
+        LJJ_U8_CARRY | LJJ_U8_TOO_LARGE | LJJ_U8_TOO_LARGE_1000,
+        LJJ_U8_CARRY | LJJ_U8_TOO_LARGE | LJJ_U8_TOO_LARGE_1000,
+        // ____1101
+        LJJ_U8_CARRY | LJJ_U8_TOO_LARGE | LJJ_U8_TOO_LARGE_1000 |
+            LJJ_U8_SURROGATE,
+        // ____111_
+        LJJ_U8_CARRY | LJJ_U8_TOO_LARGE | LJJ_U8_TOO_LARGE_1000,
+        LJJ_U8_CARRY | LJJ_U8_TOO_LARGE | LJJ_U8_TOO_LARGE_1000);
+    const __m256i t3 = LJJ_U8_TABLE(
+        // 0_______: ASCII
+        LJJ_U8_TOO_SHORT, LJJ_U8_TOO_SHORT, LJJ_U8_TOO_SHORT,
+        LJJ_U8_TOO_SHORT, LJJ_U8_TOO_SHORT, LJJ_U8_TOO_SHORT,
+        LJJ_U8_TOO_SHORT, LJJ_U8_TOO_SHORT,
+        // 1000____
+        LJJ_U8_TOO_LONG | LJJ_U8_OVERLONG_2 | LJJ_U8_TWO_CONTS |
+            LJJ_U8_OVERLONG_3 | LJJ_U8_TOO_LARGE_1000 | LJJ_U8_OVERLONG_4,
+        // 1001____
+        LJJ_U8_TOO_LONG | LJJ_U8_OVERLONG_2 | LJJ_U8_TWO_CONTS |
+            LJJ_U8_OVERLONG_3 | LJJ_U8_TOO_LARGE,
+        // 101_____
+        LJJ_U8_TOO_LONG | LJJ_U8_OVERLONG_2 | LJJ_U8_TWO_CONTS |
+            LJJ_U8_SURROGATE | LJJ_U8_TOO_LARGE,
+        LJJ_U8_TOO_LONG | LJJ_U8_OVERLONG_2 | LJJ_U8_TWO_CONTS |
+            LJJ_U8_SURROGATE | LJJ_U8_TOO_LARGE,
+        // 11______: a lead
+        LJJ_U8_TOO_SHORT, LJJ_U8_TOO_SHORT, LJJ_U8_TOO_SHORT,
+        LJJ_U8_TOO_SHORT);
+    __m256i prev1 = LJJ_U8_PREV(v, prev, 1);
+    __m256i hi1 = _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble);
+    __m256i lo1 = _mm256_and_si256(prev1, nibble);
+    __m256i hi2 = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+    __m256i special = _mm256_and_si256(
+        _mm256_and_si256(_mm256_shuffle_epi8(t1, hi1),
+                         _mm256_shuffle_epi8(t2, lo1)),
+        _mm256_shuffle_epi8(t3, hi2));
+    // the 3rd byte of a 3 or 4 byte sequence, or the 4th of a 4 byte one,
+    // must be a continuation after a continuation
+    __m256i third = _mm256_subs_epu8(LJJ_U8_PREV(v, prev, 2),
+                                     _mm256_set1_epi8((char)(0xE0 - 0x80)));
+    __m256i fourth = _mm256_subs_epu8(LJJ_U8_PREV(v, prev, 3),
+                                      _mm256_set1_epi8((char)(0xF0 - 0x80)));
+    __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth),
+                                      _mm256_set1_epi8((char)0x80));
+    return _mm256_xor_si256(must23, special);
+}
+
+// non-zero where the last 3 bytes of `v` start a sequence longer than what
+// is left.
+LJJ_TARGET_AVX2
+static inline __m256i ljj_utf8_incomplete_avx2(__m256i v) {
+    const __m256i max = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, (char)(0xF0 - 1),
+        (char)(0xE0 - 1), (char)(0xC0 - 1));
+    return _mm256_subs_epu8(v, max);
+}
+
+LJJ_TARGET_AVX2
+static bool ljj_utf8_avx2(const uint8_t* s, size_t len) {
+    __m256i prev = _mm256_setzero_si256();
+    __m256i incomplete = _mm256_setzero_si256();
+    __m256i err = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(s + i + 32));
+        if (!_mm256_movemask_epi8(_mm256_or_si256(a, b))) {
+            // all ASCII, so fine unless a sequence was left open before
+            err = _mm256_or_si256(err, incomplete);
+            incomplete = _mm256_setzero_si256();
+            prev = b;
+            continue;
+        }
+        err = _mm256_or_si256(err, ljj_utf8_errors_avx2(a, prev));
+        err = _mm256_or_si256(err, ljj_utf8_errors_avx2(b, a));
+        incomplete = ljj_utf8_incomplete_avx2(b);
+        prev = b;
+    }
+    if (i < len) {
+        // padded with ASCII, which also ends a sequence left open
+        uint8_t tail[64];
+        memset(tail, ' ', 64);
+        memcpy(tail, s + i, len - i);
+        __m256i a = _mm256_loadu_si256((const __m256i*)tail);
+        __m256i b = _mm256_loadu_si256((const __m256i*)(tail + 32));
+        err = _mm256_or_si256(err, ljj_utf8_errors_avx2(a, prev));
+        err = _mm256_or_si256(err, ljj_utf8_errors_avx2(b, a));
+        incomplete = _mm256_setzero_si256();
+    }
+    err = _mm256_or_si256(err, incomplete);
+    return _mm256_testz_si256(err, err);
+}
+#endif
+
+// kernels are picked once, by `ljj_simd_init`, which every entry point calls
+// before reading them.
+static ljj_classify_func ljj_classify = NULL;
+static ljj_scanstr_func ljj_scanstr = ljj_scanstr_scalar;
+static ljj_utf8_func ljj_utf8 = ljj_utf8_scalar;
+
+static void ljj_simd_pick(void) {
+#ifdef LJJ_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        ljj_scanstr = ljj_scanstr_avx2;
+        ljj_utf8 = ljj_utf8_avx2;
+        ljj_classify = ljj_classify_avx2;
+        return;
+    }
+#endif
+#ifdef LJJ_HAVE_SSE2
+    ljj_scanstr = ljj_scanstr_sse2;
+    ljj_classify = ljj_classify_sse2;
+#else
+    ljj_classify = ljj_classify_scalar;
+#endif
+}
+
+#ifdef LJJ_HAVE_PTHREAD
+static pthread_once_t ljj_simd_once = PTHREAD_ONCE_INIT;
+#endif
+
+static void ljj_simd_init(void) {
+#ifdef LJJ_HAVE_PTHREAD
+    pthread_once(&ljj_simd_once, ljj_simd_pick);
+#else
+    // no threads are started without pthreads
+    if (!ljj_classify) {
+        ljj_simd_pick();
+    }
+#endif
+}
+
+static inline uint64_t ujj_prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+// carried from one block to the next.
+typedef struct ljj_indexer {
+    uint64_t prev_escaped;    // 1 if the first byte of the block is escaped
+    uint64_t prev_in_string;  // all ones if the block starts inside a string
+    uint64_t prev_scalar;     // 1 if the last byte was part of a scalar
+} ljj_indexer;
+
+// bits of the chars escaped by an odd run of backslashes.
+static inline uint64_t ljj_find_escaped(ljj_indexer* ix, uint64_t bs) {
+    const uint64_t even_bits = 0x5555555555555555ULL;
+    bs &= ~ix->prev_escaped;
+    uint64_t follows_escape = bs << 1 | ix->prev_escaped;
+    uint64_t odd_starts = bs & ~even_bits & ~follows_escape;
+    uint64_t seq_on_even = odd_starts + bs;
+    ix->prev_escaped = seq_on_even < odd_starts;  // carry out
+    uint64_t invert_mask = seq_on_even << 1;
+    return (even_bits ^ invert_mask) & follows_escape;
+}
+
+// bits of every structural char, opening quote and first char of a scalar
+// that is not inside a string.
+static inline uint64_t ljj_block_structurals(ljj_indexer* ix,
+                                             const ljj_blockmasks* m) {
+    uint64_t quote = m->quote & ~ljj_find_escaped(ix, m->bs);
+    uint64_t in_string = ujj_prefix_xor(quote) ^ ix->prev_in_string;
+    ix->prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+    // inside a string, closing quote included, opening quote excluded
+    uint64_t string_tail = in_string ^ quote;
+
+    uint64_t scalar = ~(m->op | m->ws);
+    uint64_t nonquote_scalar = scalar & ~quote;
+    uint64_t follows_scalar = nonquote_scalar << 1 | ix->prev_scalar;
+    ix->prev_scalar = nonquote_scalar >> 63;
+    uint64_t scalar_start = scalar & ~follows_scalar;
+    return (m->op | scalar_start) & ~string_tail;
+}
+
+static inline size_t ljj_flatten_bits(uint32_t* out, size_t n, uint32_t base,
+                                      uint64_t bits) {
+    while (bits) {
+        out[n++] = base + (uint32_t)ujj_ctz64(bits);
+        bits &= bits - 1;
+    }
+    return n;
+}
+
+// rejects the input of `state` if it must be valid UTF-8 and is not, with
+// the current token at the first invalid byte. This reads the whole input
+// once more, ahead of the structural index.
+static bool ljj_lexstate_checkutf8(ljj_lexstate* state) {
+    ljj_simd_init();
+    const uint8_t* s = (const uint8_t*)state->original;
+    if (!state->check_utf8 || ljj_utf8(s, state->length)) {
+        return true;
+    }
+    state->errcode = JJ_ERR_UTF8;
+    state->tokstart = ujj_utf8_valid_prefix(s, state->length);
+    state->curtoken = LJJ_TOKEN_INVALID;
+    return false;
+}
+
+void ljj_lexstate_buildindex(ljj_lexstate* state) {
+    ljj_simd_init();
+    size_t len = state->length;
+    state->index = NULL;
+    state->sizes_len = 0;
+    state->sizes_pos = 0;
+    if (len > UINT32_MAX) {  // offsets are 32-bit to keep the index small
+        return;
+    }
+    // every byte can at most start one token
+    if (state->index_cap < len + 1) {
+        free(state->indexbuf);
+        state->indexbuf = malloc(sizeof(uint32_t) * (len + 1));
+        state->index_cap = state->indexbuf ? len + 1 : 0;
+        if (!state->indexbuf) {
+            return;
+        }
+    }
+    uint32_t* index = state->indexbuf;
+    const uint8_t* buf = (const uint8_t*)state->original;
+    ljj_indexer ix = {0, 0, 0};
+    ljj_blockmasks m;
+    size_t n = 0;
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        ljj_classify(buf + i, &m);
+        n = ljj_flatten_bits(index, n, (uint32_t)i,
+                             ljj_block_structurals(&ix, &m));
+    }
+    if (i < len) {
+        uint8_t tail[64];
+        memset(tail, ' ', 64);
+        memcpy(tail, buf + i, len - i);
+        ljj_classify(tail, &m);
+        n = ljj_flatten_bits(index, n, (uint32_t)i,
+                             ljj_block_structurals(&ix, &m));
     }
-    unic[4] = '\0';
-    char* pend;
-    int cp = strtol(unic, &pend, 16);
-    if (errno == ERANGE || pend != unic + 4) {
+    state->index = index;
+    state->index_len = n;
+    state->index_pos = 0;
+}
+
+// doubles the `*cap` counts of `*buf`, from 64.
+static bool ljj_growcounts(uint32_t** buf, size_t* cap) {
+    size_t newcap = *cap ? *cap << 1 : 64;
+    uint32_t* b = realloc(*buf, sizeof(uint32_t) * newcap);
+    if (!b) {
         return false;
     }
-    return ujj_unicode_to_utf8(state->strbuf, cp);
+    *buf = b;
+    *cap = newcap;
+    return true;
+}
+
+// A container counts 0 values if it closes right away, else one more than
+// its ','. A trailing ',' counts one too many, which only leaves room for a
+// value more.
+void ljj_lexstate_buildsizes(ljj_lexstate* state) {
+    state->sizes_len = 0;
+    state->sizes_pos = 0;
+    if (!state->index) {
+        return;
+    }
+    const char* s = state->original;
+    const uint32_t* index = state->index;
+    size_t end = state->index_len;
+    uint32_t* open = NULL;  // counts of the containers open at `e`
+    size_t depth = 0, opencap = 0, n = 0;
+    for (size_t e = state->index_pos; e < end; e++) {
+        char c = s[index[e]];
+        if (c == ',') {
+            if (depth) state->sizes[open[depth - 1]]++;
+            continue;
+        }
+        if (c == '}' || c == ']') {
+            if (depth) depth--;
+            continue;
+        }
+        if (c != '{' && c != '[') {
+            continue;
+        }
+        if ((n == state->sizes_cap &&
+             !ljj_growcounts(&state->sizes, &state->sizes_cap)) ||
+            (depth == opencap && !ljj_growcounts(&open, &opencap))) {
+            free(open);
+            return;  // parsed without sizes
+        }
+        char next = e + 1 < end ? s[index[e + 1]] : 0;
+        state->sizes[n] = next != '}' && next != ']';
+        open[depth++] = (uint32_t)n++;
+    }
+    free(open);
+    state->sizes_len = n;
+}
+
+// value of each hex digit, -1 for any other char.
+static const int8_t ujj_hexval[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  //
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  //
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  //
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  -1, -1, -1, -1, -1, -1,  //
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,  //
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  //
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,  //
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  //
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  //
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  //
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  //
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  //
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  //
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  //
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  //
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,  //
+};
+
+// value of the 4 hex digits at `p`, or a negative number if any is invalid.
+static inline int ujj_hex4(const char* p) {
+    const uint8_t* u = (const uint8_t*)p;
+    int a = ujj_hexval[u[0]], b = ujj_hexval[u[1]];
+    int c = ujj_hexval[u[2]], d = ujj_hexval[u[3]];
+    if ((a | b | c | d) < 0) {
+        return -1;
+    }
+    return a << 12 | b << 8 | c << 4 | d;
+}
+
+// reads the code point of "\uXXXX" with the current char at 'u', combining
+// a "\uD8XX\uDCXX" surrogate pair. Leaves the current char at the last digit.
+static inline bool ljj_lex_str_escape_readunic(ljj_lexstate* state) {
+    const char* p = state->original + state->cur_idx;
+    size_t left = state->length - state->cur_idx;
+    if (left < 5) return false;
+    int cp = ujj_hex4(p + 1);
+    if (cp < 0) return false;
+    size_t consumed = 4;
+    if (cp >= 0xD800 && cp < 0xDC00) {  // high surrogate, needs a low one
+        if (left < 11 || p[5] != '\\' || p[6] != 'u') return false;
+        int lo = ujj_hex4(p + 7);
+        if (lo < 0xDC00 || lo >= 0xE000) return false;
+        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+        consumed += 6;
+    }
+    char u8[4];
+    int n = ujj_unicode_to_utf8(u8, cp);  // rejects a lone low surrogate
+    for (int i = 0; i < n; i++) {
+        ljj_lexstate_append_str(state, u8[i]);
+    }
+    state->cur_idx += consumed;
+    return n > 0;
 }
 
 bool ljj_lex_str_escape(ljj_lexstate* state) {
     switch (LJJ_LEXSTATE_CURCHAR(state)) {
         case '"':
-            ljj_lexstate_append_strbuf(state, '"');
+            ljj_lexstate_append_str(state, '"');
             break;
         case '\\':
-            ljj_lexstate_append_strbuf(state, '\\');
+            ljj_lexstate_append_str(state, '\\');
             break;
         case '/':
-            ljj_lexstate_append_strbuf(state, '/');
+            ljj_lexstate_append_str(state, '/');
             break;
         case 'b':
-            ljj_lexstate_append_strbuf(state, '\b');
+            ljj_lexstate_append_str(state, '\b');
             break;
         case 'f':
-            ljj_lexstate_append_strbuf(state, '\f');
+            ljj_lexstate_append_str(state, '\f');
             break;
         case 'n':
-            ljj_lexstate_append_strbuf(state, '\n');
+            ljj_lexstate_append_str(state, '\n');
             break;
         case 'r':
-            ljj_lexstate_append_strbuf(state, '\r');
+            ljj_lexstate_append_str(state, '\r');
             break;
         case 't':
-            ljj_lexstate_append_strbuf(state, '\t');
+            ljj_lexstate_append_str(state, '\t');
             break;
         case 'u':
             return ljj_lex_str_escape_readunic(state);
@@ -114,31 +1086,36 @@ bool ljj_lex_str_escape(ljj_lexstate* state) {
 void ljj_lex_read_str(ljj_lexstate* state) {
     ljj_lexstate_clear_strbuf(state);
     ljj_lexstate_nextchar(state);  // consume '"'
-    state->instr = true;
+    state->strstart = state->strend = state->cur_idx;
     char cur;
     while (true) {
+        // copy the run of plain chars in one go
+        const char* run = state->original + state->cur_idx;
+        size_t runlen = ljj_scanstr(run, state->length - state->cur_idx);
+        ljj_lexstate_append_strn(state, run, runlen);
+        state->cur_idx += runlen;
         if (ljj_lexstate_isatend(state)) {
             goto ERROR;
         }
         cur = LJJ_LEXSTATE_CURCHAR(state);
         ljj_lexstate_nextchar(state);
-        if (ujj_is_char_oneof(cur, "\r\n")) {
-            ljj_lexstate_append_strbuf(state, cur);
-            goto ERROR;
-        }
         if (cur == '"') {
             break;
         }
         if (cur == '\\') {
-            if (ljj_lex_str_escape(state)) {
+            if (!ljj_lexstate_isatend(state) && ljj_lex_str_escape(state)) {
                 ljj_lexstate_nextchar(state);  // consume the char
                 continue;
             }
             goto ERROR;
         }
+        // control chars must be escaped
         ljj_lexstate_append_strbuf(state, cur);
+        goto ERROR;
+    }
+    if (state->insitu) {
+        state->insitu[state->strend] = '\0';  // at most the closing quote
     }
-    state->instr = false;
     state->curtoken = LJJ_TOKEN_STR;
     return;
 ERROR:
@@ -146,67 +1123,306 @@ ERROR:
     return;
 }
 
-void ljj_lex_read_val(ljj_lexstate* state) {
-    ljj_lexstate_clear_strbuf(state);
-    char cur;
-    while (true) {
-        if (ljj_lexstate_isatend(state)) {
-            break;
-        }
-        cur = LJJ_LEXSTATE_CURCHAR(state);
-        if (ujj_is_char_oneof(cur, " \t\r\n}],")) {
-            break;
+// ***************************** numbers *****************************
+
+static inline int ujj_clz64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll(x);
+#else
+    int n = 0;
+    while (!(x & ((uint64_t)1 << 63))) {
+        x <<= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+// full 64x64 -> 128 bit product.
+static inline void ujj_mul128(uint64_t a, uint64_t b, uint64_t* hi,
+                              uint64_t* lo) {
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 r = (unsigned __int128)a * b;
+    *hi = (uint64_t)(r >> 64);
+    *lo = (uint64_t)r;
+#else
+    uint64_t alo = (uint32_t)a, ahi = a >> 32;
+    uint64_t blo = (uint32_t)b, bhi = b >> 32;
+    uint64_t ll = alo * blo, lh = alo * bhi, hl = ahi * blo, hh = ahi * bhi;
+    uint64_t mid = (ll >> 32) + (uint32_t)lh + (uint32_t)hl;
+    *lo = (mid << 32) | (uint32_t)ll;
+    *hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+#endif
+}
+
+// Eisel-Lemire: w * 10^q correctly rounded to a double, for w != 0. Returns
+// false in the rare cases it cannot decide, where the caller falls back.
+static bool ujj_eisel_lemire(uint64_t w, int64_t q, bool neg, double* out) {
+    uint64_t bits;
+    if (w == 0 || q < UJJ_POW5_MINQ) {
+        bits = 0;
+    } else if (q > UJJ_POW5_MAXQ) {
+        bits = (uint64_t)0x7FF << 52;
+    } else {
+        int lz = ujj_clz64(w);
+        w <<= lz;
+        const uint64_t* pow5 = ujj_pow5_128 + 2 * (q - UJJ_POW5_MINQ);
+        uint64_t hi, lo;
+        ujj_mul128(w, pow5[0], &hi, &lo);
+        // 52 explicit mantissa bits + 3 bits to round; refine with the low
+        // half of 5^q only if those bits are all ones.
+        const uint64_t precision_mask = UINT64_MAX >> 55;
+        if ((hi & precision_mask) == precision_mask) {
+            uint64_t hi2, lo2;
+            ujj_mul128(w, pow5[1], &hi2, &lo2);
+            lo += hi2;
+            if (hi2 > lo) {
+                hi++;
+            }
+            if (lo + 1 == 0 && (hi & precision_mask) == precision_mask) {
+                return false;
+            }
         }
-        if ((cur < '0' || cur > 'z') && cur != '+' && cur != '-' &&
-            cur != '.') {
-            state->curtoken = LJJ_TOKEN_INVALID;
-            return;
+        int upperbit = (int)(hi >> 63);
+        int shift = upperbit + 64 - 52 - 3;
+        uint64_t mantissa = hi >> shift;
+        // floor(q * log2(10)) + 63, minus the -1023 exponent bias.
+        int64_t power2 =
+            ((((152170 + 65536) * q) >> 16) + 63) + upperbit - lz + 1023;
+        if (power2 <= 0) {  // subnormal
+            if (-power2 + 1 >= 64) {
+                bits = 0;
+            } else {
+                mantissa >>= -power2 + 1;
+                mantissa += mantissa & 1;
+                mantissa >>= 1;
+                power2 = mantissa < ((uint64_t)1 << 52) ? 0 : 1;
+                bits = (mantissa & (((uint64_t)1 << 52) - 1)) |
+                       ((uint64_t)power2 << 52);
+            }
+        } else {
+            // exactly halfway between two doubles: round to even
+            if (lo <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 &&
+                (mantissa << shift) == hi) {
+                mantissa &= ~(uint64_t)1;
+            }
+            mantissa += mantissa & 1;
+            mantissa >>= 1;
+            if (mantissa >= ((uint64_t)2 << 52)) {
+                mantissa = (uint64_t)1 << 52;
+                power2++;
+            }
+            mantissa &= ~((uint64_t)1 << 52);
+            if (power2 >= 0x7FF) {
+                power2 = 0x7FF;
+                mantissa = 0;
+            }
+            bits = mantissa | ((uint64_t)power2 << 52);
         }
-        ljj_lexstate_append_strbuf(state, cur);
-        ljj_lexstate_nextchar(state);
-    }
-    if (ljj_lexstate_buflen(state) == 0) {
-        state->curtoken = LJJ_TOKEN_INVALID;
-        return;
     }
-    if (ljj_lexstate_getc(state, 0) == '+') {
-        state->curtoken = LJJ_TOKEN_INVALID;
-        return;
+    if (neg) {
+        bits |= (uint64_t)1 << 63;
     }
-    if (ljj_lexstate_bufequals(state, "null", 4)) {
-        state->curtoken = LJJ_TOKEN_NULL;
-        return;
+    memcpy(out, &bits, sizeof(double));
+    return true;
+}
+
+// powers of ten exactly representable by jj_jsontype_float: up to 10^22 for
+// a double, 10^27 for an x87 long double.
+static const jj_jsontype_float ujj_exact_pow10[] = {
+    1e0L,  1e1L,  1e2L,  1e3L,  1e4L,  1e5L,  1e6L,  1e7L,  1e8L,  1e9L,
+    1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L, 1e16L, 1e17L, 1e18L, 1e19L,
+    1e20L, 1e21L, 1e22L, 1e23L, 1e24L, 1e25L, 1e26L, 1e27L,
+};
+
+#define UJJ_FLOAT_IS_LONG (sizeof(jj_jsontype_float) > sizeof(double))
+#define UJJ_EXACT_POW10_MAX (UJJ_FLOAT_IS_LONG ? 27 : 22)
+#define UJJ_EXACT_MANT_MAX  (UJJ_FLOAT_IS_LONG ? UINT64_MAX : (uint64_t)1 << 53)
+
+// Parses the number at the current char in one pass, without copying it:
+// validates the json grammar, and converts it to an int if it is integral
+// and fits, or to a float otherwise.
+static void ljj_lex_read_num(ljj_lexstate* state) {
+    const char* start = state->original + state->cur_idx;
+    const char* end = state->original + state->length;
+    const char* p = start;
+    bool neg = *p == '-';
+    if (neg) p++;
+    const char* digits = p;
+    uint64_t w = 0;
+    while (p < end && UJJ_CHAR_IS(*p, UJJ_CC_DIGIT)) {
+        w = w * 10 + (uint64_t)(*p - '0');  // may wrap, checked below
+        p++;
     }
-    if (ljj_lexstate_bufequals(state, "true", 4)) {
-        state->curtoken = LJJ_TOKEN_TRUE;
-        return;
+    size_t intdigits = p - digits;
+    if (intdigits == 0 || (*digits == '0' && intdigits > 1)) {
+        goto INVALID;
     }
-    if (ljj_lexstate_bufequals(state, "false", 5)) {
-        state->curtoken = LJJ_TOKEN_FALSE;
-        return;
+    int64_t exp10 = 0;
+    const char* fracdigits = p;
+    bool isint = true;
+    if (p < end && *p == '.') {
+        isint = false;
+        p++;
+        fracdigits = p;
+        while (p < end && UJJ_CHAR_IS(*p, UJJ_CC_DIGIT)) {
+            w = w * 10 + (uint64_t)(*p - '0');
+            p++;
+        }
+        if (p == fracdigits) {
+            goto INVALID;
+        }
+        exp10 = -(int64_t)(p - fracdigits);
     }
-    char* b = charvec_tostr(state->strbuf);
-    if (ujj_str_isjsonint(b, ljj_lexstate_buflen(state))) {
-        state->curtoken = LJJ_TOKEN_INT;
-        free(b);
-        return;
+    size_t ndigits = intdigits + (isint ? 0 : (size_t)(p - fracdigits));
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        isint = false;
+        p++;
+        bool eneg = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            eneg = *p == '-';
+            p++;
+        }
+        const char* edigits = p;
+        int64_t e = 0;
+        while (p < end && UJJ_CHAR_IS(*p, UJJ_CC_DIGIT)) {
+            if (e < 0x10000000) {
+                e = e * 10 + (*p - '0');
+            }
+            p++;
+        }
+        if (p == edigits) {
+            goto INVALID;
+        }
+        exp10 += eneg ? -e : e;
     }
-    free(b);
-    if (ujj_str_isvalidjsonfloat(ljj_lexstate_buf(state),
-                                 ljj_lexstate_buflen(state))) {
-        state->curtoken = LJJ_TOKEN_FLOAT;
-        return;
+    if (p < end && !UJJ_CHAR_IS(*p, UJJ_CC_TERM)) {
+        goto INVALID;
     }
-    state->curtoken = LJJ_TOKEN_INVALID;
+    state->cur_idx += p - start;
+
+    // integers with at most 19 digits can't wrap; -0 stays a float to keep
+    // its sign.
+    if (isint && ndigits <= 19 && !(neg && w == 0)) {
+        if (w <= (uint64_t)INT64_MAX) {
+            state->intval = neg ? -(jj_jsontype_int)w : (jj_jsontype_int)w;
+            state->curtoken = LJJ_TOKEN_INT;
+            return;
+        }
+        if (neg && w == (uint64_t)INT64_MAX + 1) {
+            state->intval = INT64_MIN;
+            state->curtoken = LJJ_TOKEN_INT;
+            return;
+        }
+    }
+    state->curtoken = LJJ_TOKEN_FLOAT;
+    if (ndigits <= 19) {
+        // exact operands give a correctly rounded product or quotient
+        if (w <= UJJ_EXACT_MANT_MAX && exp10 >= -(int64_t)UJJ_EXACT_POW10_MAX &&
+            exp10 <= (int64_t)UJJ_EXACT_POW10_MAX) {
+            jj_jsontype_float f = (jj_jsontype_float)w;
+            f = exp10 < 0 ? f / ujj_exact_pow10[-exp10]
+                          : f * ujj_exact_pow10[exp10];
+            state->floatval = neg ? -f : f;
+            return;
+        }
+        // only for doubles: there is no such table-based path for long
+        // double, which always goes through strtold past this point
+        double d;
+        if (sizeof(jj_jsontype_float) == sizeof(double) &&
+            ujj_eisel_lemire(w, exp10, neg, &d)) {
+            state->floatval = d;
+            return;
+        }
+    }
+    // too many digits or an ambiguous case: let libc do the exact conversion
+    ljj_lexstate_clear_strbuf(state);
+    charvec_appendn(state->strbuf, (char*)start, p - start);
+    ljj_lexstate_append_strbuf(state, '\0');
+    state->floatval = UJJ_FLOAT_IS_LONG ? strtold(ljj_lexstate_buf(state), NULL)
+                                        : strtod(ljj_lexstate_buf(state), NULL);
+    ljj_lexstate_clear_strbuf(state);
+    return;
+INVALID:
+    state->curtoken = LJJ_TOKEN_INVALID;
+}
+
+// keeps the text of an invalid value in the buffer for error messages.
+static void ljj_lex_invalid_val(ljj_lexstate* state) {
+    ljj_lexstate_clear_strbuf(state);
+    while (!ljj_lexstate_isatend(state)) {
+        char cur = LJJ_LEXSTATE_CURCHAR(state);
+        if (UJJ_CHAR_IS(cur, UJJ_CC_TERM) || cur < '+' || cur > 'z') {
+            break;
+        }
+        ljj_lexstate_append_strbuf(state, cur);
+        ljj_lexstate_nextchar(state);
+    }
+    state->curtoken = LJJ_TOKEN_INVALID;
+}
+
+static inline bool ljj_lex_read_literal(ljj_lexstate* state, const char* lit,
+                                        size_t len) {
+    size_t left = state->length - state->cur_idx;
+    const char* p = state->original + state->cur_idx;
+    if (left < len || memcmp(p, lit, len) != 0 ||
+        (left > len && !UJJ_CHAR_IS(p[len], UJJ_CC_TERM))) {
+        return false;
+    }
+    state->cur_idx += len;
+    return true;
+}
+
+void ljj_lex_read_val(ljj_lexstate* state) {
+    char cur = LJJ_LEXSTATE_CURCHAR(state);
+    switch (cur) {
+        case 'n':
+            if (ljj_lex_read_literal(state, "null", 4)) {
+                state->curtoken = LJJ_TOKEN_NULL;
+                return;
+            }
+            break;
+        case 't':
+            if (ljj_lex_read_literal(state, "true", 4)) {
+                state->curtoken = LJJ_TOKEN_TRUE;
+                return;
+            }
+            break;
+        case 'f':
+            if (ljj_lex_read_literal(state, "false", 5)) {
+                state->curtoken = LJJ_TOKEN_FALSE;
+                return;
+            }
+            break;
+        default:
+            if (cur == '-' || UJJ_CHAR_IS(cur, UJJ_CC_DIGIT)) {
+                ljj_lex_read_num(state);
+                if (state->curtoken != LJJ_TOKEN_INVALID) {
+                    return;
+                }
+            }
+            break;
+    }
+    ljj_lex_invalid_val(state);
 }
 
 void ljj_lex_next(ljj_lexstate* state) {
-    ljj_lex_skip_whitespace(state);
-    if (state->curtoken == LJJ_TOKEN_EOF) {
-        return;
+    if (state->index) {
+        if (state->index_pos >= state->index_len) {
+            state->cur_idx = state->tokstart = state->length;
+            state->curtoken = LJJ_TOKEN_EOF;
+            return;
+        }
+        state->cur_idx = state->index[state->index_pos++];
+    } else {
+        ljj_lex_skip_whitespace(state);
+        if (state->curtoken == LJJ_TOKEN_EOF) {
+            return;
+        }
     }
+    state->tokstart = state->cur_idx;
     char cur = LJJ_LEXSTATE_CURCHAR(state);
-    if (ujj_is_char_oneof(cur, "{}:,[]")) {
+    if (UJJ_CHAR_IS(cur, UJJ_CC_STRUCT)) {
         state->curtoken = (uint8_t)cur;
         ljj_lexstate_nextchar(state);
         return;
@@ -219,420 +1435,3419 @@ void ljj_lex_next(ljj_lexstate* state) {
 }
 
 jj_jsontype_str ljj_lexstate_getstr(ljj_lexstate* state) {
-    // return ujj_clonestr(ljj_lexstate_buf(state), ljj_lexstate_buflen(state));
-    return charvec_tostr(state->strbuf);
+    if (state->insitu) {
+        return state->insitu + state->strstart;
+    }
+    return ojj_clonestr(ljj_lexstate_buf(state), ljj_lexstate_buflen(state));
 }
 
-bool ljj_lexstate_getint(ljj_lexstate* state, jj_jsontype_int* result) {
-    char* buf = ljj_lexstate_getstr(state);
-    if (!buf) return false;
-    char* pend;
-    jj_jsontype_int res = strtoll(buf, &pend, 10);
-    if (errno == ERANGE || pend != buf + ljj_lexstate_buflen(state)) {
-        free(buf);
+static bool ljj_keytab_grow(ljj_keytab* t) {
+    size_t cap = t->cap ? t->cap << 1 : 64;
+    ojj_key** slots = calloc(cap, sizeof(ojj_key*));
+    size_t* used = malloc(sizeof(size_t) * (cap / 2));
+    if (!slots || !used) {
+        free(slots);
+        free(used);
         return false;
     }
-    free(buf);
-    *result = res;
+    for (size_t i = 0; i < t->count; i++) {
+        ojj_key* k = t->slots[t->used[i]];
+        size_t j = k->hash & (cap - 1);
+        while (slots[j]) j = (j + 1) & (cap - 1);
+        slots[j] = k;
+        used[i] = j;
+    }
+    free(t->slots);
+    free(t->used);
+    t->slots = slots;
+    t->used = used;
+    t->cap = cap;
     return true;
 }
 
-bool ljj_lexstate_getfloat(ljj_lexstate* state, jj_jsontype_float* result) {
-    char* buf = ljj_lexstate_getstr(state);
-    char* pend;
-    jj_jsontype_float res = strtold(buf, &pend);
-    if (pend != buf + ljj_lexstate_buflen(state)) {
-        free(buf);
-        return false;
+// releases the keys of `t`, keeping its slots for the next document.
+void ljj_keytab_clear(ljj_keytab* t) {
+    for (size_t i = 0; i < t->count; i++) {
+        ojj_key_release(t->slots[t->used[i]]->str);
+        t->slots[t->used[i]] = NULL;
+    }
+    t->count = 0;
+}
+
+char* ljj_lexstate_getkey(ljj_lexstate* state) {
+    ljj_keytab* t = &state->keys;
+    const char* s = state->insitu ? state->insitu + state->strstart
+                                  : ljj_lexstate_buf(state);
+    size_t len = state->insitu ? state->strend - state->strstart
+                               : ljj_lexstate_buflen(state);
+    uint64_t hash = ojj_hash(s, len);
+    size_t mask = t->cap - 1;
+    size_t i = hash & mask;
+    for (ojj_key* k; t->cap && (k = t->slots[i]) != NULL;
+         i = (i + 1) & mask) {
+        if (k->hash == hash && k->len == len && memcmp(k->str, s, len) == 0) {
+            k->refs++;
+            return k->str;
+        }
+    }
+    if (t->count >= t->cap / 2) {
+        // a full table still shares the keys it has, and new ones are not
+        // shared
+        if (t->count >= LJJ_KEYTAB_MAXKEYS || !ljj_keytab_grow(t)) {
+            return ojj_key_new(s, len, hash);
+        }
+        mask = t->cap - 1;
+        i = hash & mask;
+        while (t->slots[i]) i = (i + 1) & mask;
     }
-    *result = res;
-    free(buf);
+    char* name = ojj_key_new(s, len, hash);
+    if (!name) {
+        return NULL;
+    }
+    OJJ_KEY(name)->refs++;  // one for the table
+    t->slots[i] = OJJ_KEY(name);
+    t->used[t->count++] = i;
+    return name;
+}
+
+bool ljj_lexstate_getint(ljj_lexstate* state, jj_jsontype_int* result) {
+    if (state->curtoken != LJJ_TOKEN_INT) return false;
+    *result = state->intval;
+    return true;
+}
+
+bool ljj_lexstate_getfloat(ljj_lexstate* state, jj_jsontype_float* result) {
+    if (state->curtoken != LJJ_TOKEN_FLOAT) return false;
+    *result = state->floatval;
     return true;
 }
 
-// If `name` is NULL, then returns a new node. If `name` is not NULL, then
-// add this object to the property `name` in `root`, and return `root`.
-jj_jsonobj* ljj_lexstate_parsenode(ljj_lexstate* state,  // NOLINT
-                                   jj_jsonobj* root, const char* name) {
-    jj_jsonobj* new = NULL;
+// reads the scalar of the current token into `node`. Returns false if it is
+// not a valid one or if failed to allocate.
+static bool ljj_lexstate_parsescalar(ljj_lexstate* state, jj_jsonobj* node) {
     switch (state->curtoken) {
         case LJJ_TOKEN_NULL:
-            new = jj_new_jsonnull(name);
-            break;
+            node->type = JJ_VALTYPE_NULL;
+            return true;
         case LJJ_TOKEN_TRUE:
-            new = jj_new_jsonbool(name, JJ_JSON_TRUE);
-            break;
         case LJJ_TOKEN_FALSE:
-            new = jj_new_jsonbool(name, JJ_JSON_FALSE);
-            break;
-        case LJJ_TOKEN_INT: {
-            jj_jsontype_int res;
-            if (!ljj_lexstate_getint(state, &res)) {
-                state->curtoken = LJJ_TOKEN_INVALID;
-                return NULL;
-            }
-            new = jj_new_jsonint(name, res);
-            break;
-        }
-        case LJJ_TOKEN_FLOAT: {
-            jj_jsontype_float res;
-            if (!ljj_lexstate_getfloat(state, &res)) {
-                state->curtoken = LJJ_TOKEN_INVALID;
-                return NULL;
+            node->type = JJ_VALTYPE_BOOL;
+            node->data.boolval = state->curtoken == LJJ_TOKEN_TRUE
+                                     ? JJ_JSON_TRUE
+                                     : JJ_JSON_FALSE;
+            return true;
+        case LJJ_TOKEN_INT:
+            node->type = JJ_VALTYPE_INT;
+            return ljj_lexstate_getint(state, &node->data.intval);
+        case LJJ_TOKEN_FLOAT:
+            node->type = JJ_VALTYPE_FLOAT;
+            return ljj_lexstate_getfloat(state, &node->data.floatval);
+        case LJJ_TOKEN_STR:
+            node->type = JJ_VALTYPE_STR;
+            node->data.strval = ljj_lexstate_getstr(state);
+            if (!node->data.strval) {
+                state->errcode = JJ_ERR_NOMEM;
+                return false;
             }
-            new = jj_new_jsonfloat(name, res);
-            break;
-        }
-        case LJJ_TOKEN_STR: {
-            jj_jsontype_str s = ljj_lexstate_getstr(state);
-            new = jj_new_jsonstrref(name, s);
-            break;
-        }
-        case '{': {
-            new = ljj_lexstate_parseobj(state, name);
-            break;
-        }
-        case '[': {
-            new = ljj_lexstate_parsearr(state, name);
-            break;
-        }
-        default: {
-            break;
-        }
+            return true;
+        default:
+            return false;
     }
-    if (LJJ_LEXSTATE_ISINVALID(state)) {
+}
+
+// a node of its own for the value `val`, as the root of a document, or NULL
+// if failed to allocate, in which case `val` is freed.
+static jj_jsonobj* ljj_newroot(const jj_jsonobj* val) {
+    jj_jsonobj* root = ojj_malloc(sizeof(jj_jsonobj));
+    if (!root) {
+        jj_jsonobj tmp = *val;
+        ojj_free_innerval(&tmp);
         return NULL;
     }
-    if (!new) {
-        state->curtoken |= LJJ_TOKEN_INVALID;
-        return NULL;
+    *root = *val;
+    return root;
+}
+
+// takes the container already parsed for the current token into `node`, if
+// any.
+static inline bool ljj_lexstate_takesplice(ljj_lexstate* state,
+                                           jj_jsonobj* node) {
+    if (!state->splice || !state->index ||
+        state->index_pos != state->splice_open + 1) {
+        return false;
     }
-    if (!name) {
-        return new;
+    *node = *state->splice;
+    ojj_free(state->splice);
+    state->splice = NULL;
+    state->index_pos = state->splice_close + 1;
+    return true;
+}
+
+// the count of values found by `ljj_lexstate_buildsizes` for the container
+// being opened, or 0 if not known.
+static inline size_t ljj_lexstate_nextsize(ljj_lexstate* state) {
+    if (state->sizes_pos >= state->sizes_len) {
+        return 0;
     }
-    jj_oput(root, new);
-    return root;
+    return state->sizes[state->sizes_pos++];
 }
 
-jj_jsonobj* ljj_lexstate_parseobj(ljj_lexstate* state,  // NOLINT
-                                  const char* name) {
-    jj_jsonobj* root = jj_new_jsonobj(name);
-    char* propname = NULL;
-    while (true) {
-        free(propname);
-        ljj_lex_next(state);
-        if (state->curtoken == '}') {
-            break;
-        }
-        if (state->curtoken != LJJ_TOKEN_STR) {
-            state->curtoken = LJJ_TOKEN_INVALID;
-            free(root);
-            return NULL;
-        }
-        propname = ljj_lexstate_getstr(state);
-        if (!propname) {
-            free(root);
-            return NULL;
-        }
-        ljj_lex_next(state);
-        if (state->curtoken != ':') {
-            break;
-        }
-        ljj_lex_next(state);
-        ljj_lexstate_parsenode(state, root, propname);
-        if (LJJ_LEXSTATE_ISINVALID(state)) {
-            break;
-        }
-        ljj_lex_next(state);
-        if (state->curtoken != ',') {
-            break;
+// Makes room in the container `node` for its next value, toward the `hint`
+// values counted by the pre-scan. It grows at most LJJ_HINT_STEP values, or
+// twice those it holds, at a time, so that a count from malformed input such
+// as `[,,,` reserves little more than the values actually parsed.
+static int ljj_reservenext(jj_valtype type, union jj_jsondata data,
+                           size_t hint) {
+    bool isarr = type == JJ_VALTYPE_ARR;
+    size_t len = isarr ? data.arrval->length : data.objval->length;
+    size_t cap = isarr ? data.arrval->cap : data.objval->cap;
+    if (len < cap || hint <= cap) {
+        return 0;
+    }
+    size_t n = cap < LJJ_HINT_STEP ? LJJ_HINT_STEP : cap << 1;
+    if (n > hint) n = hint;
+    return isarr ? ojj_arrresize(data.arrval, n)
+                 : ojj_objreserve(data.objval, n);
+}
+
+// opens a new container for the current token, inside the `depth` ones
+// already open.
+static bool ljj_lexstate_open(ljj_lexstate* state, size_t depth) {
+    if (depth >= state->max_depth) {
+        state->errcode = JJ_ERR_DEPTH;
+        return false;
+    }
+    if (depth == state->stackcap) {
+        size_t cap = state->stackcap ? state->stackcap << 1 : 16;
+        ljj_parser_frame* stack =
+            realloc(state->stack, sizeof(ljj_parser_frame) * cap);
+        if (!stack) {
+            state->errcode = JJ_ERR_NOMEM;
+            return false;
         }
+        state->stack = stack;
+        state->stackcap = cap;
     }
-    free(propname);
-    if (state->curtoken != '}') {
-        free(root);
-        if (!LJJ_LEXSTATE_ISINVALID(state))
-            state->curtoken |= LJJ_TOKEN_INVALID;
-        return NULL;
+    size_t hint = ljj_lexstate_nextsize(state);
+    jj_jsonobj node = ojj_newcontainer(
+        state->curtoken == '{' ? JJ_VALTYPE_OBJ : JJ_VALTYPE_ARR,
+        hint < LJJ_HINT_STEP ? hint : LJJ_HINT_STEP);
+    if (!node.data.objval) {
+        state->errcode = JJ_ERR_NOMEM;
+        return false;
     }
-    return root;
+    state->stack[depth] = (ljj_parser_frame){node, NULL, hint};
+    return true;
 }
 
-jj_jsonobj* ljj_lexstate_parsearr(ljj_lexstate* state,  // NOLINT
-                                  const char* name) {
-    jj_jsonobj* root = jj_new_jsonarr(name);
-    while (true) {
-        ljj_lex_next(state);
-        if (state->curtoken == ']') {
-            break;
-        }
-        jj_jsonobj* obj = ljj_lexstate_parsenode(state, NULL, NULL);
-        if (!obj) {
-            jj_free(root);
-            return NULL;
+// copies `node` into the container of `top`, named with the key of `top` if
+// it is an object. Takes ownership of the value of `node`, even if failed.
+static bool ljj_frame_attach(ljj_parser_frame* top, jj_jsonobj* node) {
+    bool ok;
+    if (ljj_reservenext(top->node.type, top->node.data, top->hint) != 0) {
+        ok = false;
+    } else if (top->node.type == JJ_VALTYPE_ARR) {
+        ok = ojj_arrpush(top->node.data.arrval, node) != NULL;
+    } else {
+        ok = ojj_objput(top->node.data.objval, top->key, node) != NULL;
+        if (ok) top->key = NULL;  // else released with the frame
+    }
+    if (!ok) {
+        ojj_free_innerval(node);
+    }
+    return ok;
+}
+
+// Parses the value starting at the current token into `out`, rather than
+// into a node of its own. Returns false if failed, with the token marked
+// invalid. Containers are parsed with `state->stack` of the ones being filled
+// rather than by recursion, so that the depth of a document costs no call
+// stack.
+static bool ljj_lexstate_parseval(ljj_lexstate* state, jj_jsonobj* out) {
+    size_t depth = 0;
+    // a complete value, to copy into its container rather than to allocate
+    // a node for
+    jj_jsonobj node;
+    bool complete = false;
+    bool ok = true;
+    while (ok) {
+        if (complete) {
+            if (depth == 0) {
+                *out = node;
+                return true;
+            }
+            ljj_parser_frame* top = state->stack + depth - 1;
+            char close = top->node.type == JJ_VALTYPE_OBJ ? '}' : ']';
+            ok = ljj_frame_attach(top, &node);
+            complete = false;
+            if (!ok) {
+                state->errcode = JJ_ERR_NOMEM;
+                break;
+            }
+            ljj_lex_next(state);
+            if (state->curtoken != ',') {
+                ok = state->curtoken == close;
+                if (ok) {
+                    node = state->stack[--depth].node;
+                    complete = true;
+                }
+                continue;
+            }
+        } else {
+            // the current token starts a value
+            complete = depth < state->max_depth &&
+                       ljj_lexstate_takesplice(state, &node);
+            if (!complete &&
+                (state->curtoken == '{' || state->curtoken == '[')) {
+                ok = ljj_lexstate_open(state, depth);
+                depth += ok;
+            } else if (!complete) {
+                ok = complete = ljj_lexstate_parsescalar(state, &node);
+            }
+            if (complete || !ok) {
+                continue;
+            }
         }
-        ojj_arrappend(root->data.arrval, obj);
-        ljj_lex_skip_whitespace(state);
+        // after the open of a container or a ',': a member, an element or
+        // the close, as a trailing ',' is allowed
+        ljj_parser_frame* top = state->stack + depth - 1;
+        bool isobj = top->node.type == JJ_VALTYPE_OBJ;
         ljj_lex_next(state);
-        if (state->curtoken != ',') {
-            break;
+        if (state->curtoken == (isobj ? '}' : ']')) {
+            node = state->stack[--depth].node;
+            complete = true;
+            continue;
+        }
+        if (isobj) {
+            if (state->curtoken != LJJ_TOKEN_STR) {
+                break;
+            }
+            top->key = ljj_lexstate_getkey(state);
+            if (!top->key) {
+                state->errcode = JJ_ERR_NOMEM;
+                break;
+            }
+            ljj_lex_next(state);
+            if (state->curtoken != ':') {
+                break;
+            }
+            ljj_lex_next(state);
         }
     }
-    if (state->curtoken != ']') {
-        jj_free(root);
-        if (!LJJ_LEXSTATE_ISINVALID(state))
-            state->curtoken |= LJJ_TOKEN_INVALID;
+    while (depth > 0) {
+        ljj_parser_frame* f = state->stack + --depth;
+        ojj_key_release(f->key);
+        ojj_free_innerval(&f->node);
+    }
+    if (!LJJ_LEXSTATE_ISINVALID(state)) {
+        state->curtoken |= LJJ_TOKEN_INVALID;
+    }
+    return false;
+}
+
+jj_jsonobj* ljj_lexstate_parsenode(ljj_lexstate* state) {
+    jj_jsonobj val;
+    if (!ljj_lexstate_parseval(state, &val)) {
         return NULL;
     }
+    jj_jsonobj* root = ljj_newroot(&val);
+    if (!root) {
+        state->errcode = JJ_ERR_NOMEM;
+        state->curtoken |= LJJ_TOKEN_INVALID;
+    }
     return root;
 }
 
-jj_jsonobj* jj_parse(const char* json_str, uint32_t length) {
-    ljj_lexstate* state = ljj_new_lexstate(json_str, length);
-    ljj_lex_next(state);
-    jj_jsonobj* root = ljj_lexstate_parsenode(state, NULL, NULL);
+// the JJ_ERR_* why parsing the document into `root` failed, or JJ_ERR_NONE
+// if it did not and nothing follows it.
+static int ljj_lexstate_endcode(ljj_lexstate* state, jj_jsonobj* root) {
+    if (state->errcode != JJ_ERR_NONE) {
+        return state->errcode;
+    }
     if (LJJ_LEXSTATE_ISINVALID(state)) {
-        if (root) jj_free(root);
-        LJJ_LEXSTATE_ERR(state);
+        return JJ_ERR_SYNTAX;
+    }
+    if (!root) {
+        return JJ_ERR_NOMEM;
     }
     ljj_lex_next(state);
-    if (state->curtoken != LJJ_TOKEN_EOF) {
-        if (root) jj_free(root);
-        LJJ_LEXSTATE_ERR(state);
+    return state->curtoken != LJJ_TOKEN_EOF ? JJ_ERR_TRAILING : JJ_ERR_NONE;
+}
+
+// parses the whole input of `state` as one json value.
+static jj_jsonobj* ljj_lexstate_parsedoc(ljj_lexstate* state) {
+    if (!ljj_lexstate_checkutf8(state)) {
+        ljj_lexstate_err(state, JJ_ERR_UTF8);
+        return NULL;
     }
-    if (!root) {
-        LJJ_LEXSTATE_ERR(state);
+    ljj_lexstate_buildindex(state);
+    ljj_lexstate_buildsizes(state);
+    ljj_lex_next(state);
+    jj_jsonobj* root = ljj_lexstate_parsenode(state);
+    int code = ljj_lexstate_endcode(state, root);
+    // drops the table's references while the arena, if any, is still set
+    ljj_keytab_clear(&state->keys);
+    if (code != JJ_ERR_NONE) {
+        if (root) jj_free(root);
+        ljj_lexstate_err(state, code);
+        return NULL;
     }
+    return root;
+}
+
+// same as `ljj_lexstate_parsedoc`, and frees `state`.
+static jj_jsonobj* ljj_lexstate_parseroot(ljj_lexstate* state) {
+    jj_jsonobj* root = ljj_lexstate_parsedoc(state);
     ljj_free_lexstate(state);
     return root;
 }
 
-static inline void sjj_tostr_appendesc(charvec* strbuf, char c) {
-    switch (c) {
-        case '"':
-            charvec_appendn(strbuf, "\\\"", 2);
-            break;
-        case '\\':
-            charvec_appendn(strbuf, "\\\\", 2);
-            break;
-        case '\b':
-            charvec_appendn(strbuf, "\\b", 2);
-            break;
-        case '\f':
-            charvec_appendn(strbuf, "\\f", 2);
-            break;
-        case '\n':
-            charvec_appendn(strbuf, "\\n", 2);
-            break;
-        case '\r':
-            charvec_appendn(strbuf, "\\r", 2);
-            break;
-        case '\t':
-            charvec_appendn(strbuf, "\\t", 2);
-            break;
-        default:
-            charvec_append(strbuf, c);
-            break;
+jj_jsonobj* jj_parse(const char* json_str, size_t length) {
+    return jj_parse_err(json_str, length, NULL);
+}
+
+jj_jsonobj* jj_parse_err(const char* json_str, size_t length, jj_error* err) {
+    if (err) {
+        *err = (jj_error){0};
     }
+    ljj_lexstate* state = ljj_new_lexstate(json_str, length);
+    if (!state) {
+        if (err) err->code = JJ_ERR_NOMEM;
+        return NULL;
+    }
+    state->err = err;
+    return ljj_lexstate_parseroot(state);
 }
 
-static inline bool sjj_tostr_escunic(charvec* strbuf, char* data) {
-    int cp = 0;
-    uint8_t readlen;
-    while ((cp = ujj_utf8_to_unicode(data, &readlen)) != 0) {
-        if (cp < 0) {
-            return false;
-        }
-        if (readlen == 1) {
-            sjj_tostr_appendesc(strbuf, *data);
-        } else if (readlen >= 4) {
-            charvec_appendn(strbuf, data, readlen);
-        } else {
-            char tmp[5];
-            charvec_appendn(strbuf, "\\u", 2);
-            sprintf(tmp, "%04x", cp);
-            charvec_appendn(strbuf, tmp, 4);
-        }
-        data += readlen;
+const char* jj_strerror(int code) {
+    switch (code) {
+        case JJ_ERR_NONE:
+            return "no error";
+        case JJ_ERR_SYNTAX:
+            return "invalid or unexpected token";
+        case JJ_ERR_EOF:
+            return "unexpected end of input";
+        case JJ_ERR_TRAILING:
+            return "unexpected content after the document";
+        case JJ_ERR_NOMEM:
+            return "out of memory";
+        case JJ_ERR_DEPTH:
+            return "containers nested too deeply";
+        case JJ_ERR_UTF8:
+            return "invalid UTF-8";
+        case JJ_ERR_TYPE:
+            return "value of the wrong type for its field";
+        default:
+            return "unknown error";
     }
-    return true;
 }
 
-void sjj_tostr_putindent(charvec* strbuf, int depth, jj_tostr_config* config) {
-    if (config->formatted) {
-        for (int i = 0; i < depth; i++) {
-            for (int j = 0; j < config->indent; j++) {
-                charvec_append(strbuf, ' ');
-            }
+// reads all of `f` into a buffer, for files that cannot be mapped.
+static jj_jsonobj* ljj_parse_stream(FILE* f) {
+    charvec* buf = charvec_new(64 * 1024);
+    if (!buf) {
+        return NULL;
+    }
+    char chunk[64 * 1024];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        if (charvec_appendn(buf, chunk, n) != 0) {
+            charvec_free(buf);
+            return NULL;
         }
     }
+    jj_jsonobj* root = ferror(f) ? NULL : jj_parse(buf->buf, buf->len);
+    charvec_free(buf);
+    return root;
 }
 
-void sjj_tostr_str(charvec* strbuf, char* data, int depth,
-                   jj_tostr_config* config) {
-    charvec_append(strbuf, '"');
+jj_jsonobj* jj_parse_file(const char* path) {
+#ifdef LJJ_HAVE_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+    if (!S_ISREG(st.st_mode) || st.st_size == 0) {  // e.g. a pipe
+        FILE* f = fdopen(fd, "rb");
+        if (!f) {
+            close(fd);
+            return NULL;
+        }
+        jj_jsonobj* root = ljj_parse_stream(f);
+        fclose(f);
+        return root;
+    }
+    size_t len = (size_t)st.st_size;
+    void* p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(p, len, MADV_SEQUENTIAL);  // read ahead, drop behind
+#endif
+    // strings are copied out of the input, so no node points into the map
+    jj_jsonobj* root = jj_parse(p, len);
+    munmap(p, len);
+    return root;
+#else
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    jj_jsonobj* root = ljj_parse_stream(f);
+    fclose(f);
+    return root;
+#endif
+}
+
+jj_doc* jj_new_doc(size_t blocksize) {
+    jj_doc* doc = malloc(sizeof(jj_doc));
+    if (!doc) {
+        return NULL;
+    }
+    doc->arena = arena_new(blocksize);
+    if (!doc->arena) {
+        free(doc);
+        return NULL;
+    }
+    doc->root = NULL;
+    doc->err = (jj_error){0};
+    return doc;
+}
+
+jj_jsonobj* jj_parse_arena(jj_doc* doc, const char* json_str,
+                           size_t length) {
+    jj_doc_reset(doc);
+    arena* prev = ojj_cur_arena;
+    ojj_cur_arena = doc->arena;
+    doc->root = jj_parse_err(json_str, length, &doc->err);
+    ojj_cur_arena = prev;
+    return doc->root;
+}
+
+jj_jsonobj* jj_parse_insitu(jj_doc* doc, char* json_str, size_t length) {
+    jj_doc_reset(doc);
+    ljj_lexstate* state = ljj_new_lexstate(json_str, length);
+    if (!state) {
+        doc->err.code = JJ_ERR_NOMEM;
+        return NULL;
+    }
+    state->insitu = json_str;
+    state->err = &doc->err;
+    arena* prev = ojj_cur_arena;
+    ojj_cur_arena = doc->arena;
+    doc->root = ljj_lexstate_parseroot(state);
+    ojj_cur_arena = prev;
+    return doc->root;
+}
+
+void jj_doc_reset(jj_doc* doc) {
+    arena_reset(doc->arena);
+    doc->root = NULL;
+    doc->err = (jj_error){0};
+}
+
+void jj_doc_free(jj_doc* doc) {
+    if (!doc) return;
+    arena_free(doc->arena);
+    free(doc);
+}
+
+// ***************************** push parser *****************************
+
+// what a token means to the grammar, see `ljj_grammar_step`
+#define LJJ_STEP_ERR   0  // not expected here
+#define LJJ_STEP_PUNCT 1  // ':' or ','
+#define LJJ_STEP_KEY   2  // the key of a member
+#define LJJ_STEP_VALUE 3  // a scalar, or the start of a container
+#define LJJ_STEP_CLOSE 4  // the end of the innermost container
+
+// Moves the grammar state `*expect` (one of LJJ_EXPECT_*) over a valid token.
+// `depth` is the number of open containers, and `inarr` if the innermost one
+// is an array. Keeping only this state lets a parse stop after any token.
+static int ljj_grammar_step(uint8_t* expect, ljj_token_type tok, bool inarr,
+                            size_t depth) {
+    switch (*expect) {
+        case LJJ_EXPECT_FIRSTVAL:
+            if (tok == ']') {
+                break;
+            }
+            // fallthrough
+        case LJJ_EXPECT_VALUE:
+            if (tok == '{') {
+                *expect = LJJ_EXPECT_FIRSTKEY;
+            } else if (tok == '[') {
+                *expect = LJJ_EXPECT_FIRSTVAL;
+            } else if (tok > 0xFF) {
+                *expect = depth ? LJJ_EXPECT_NEXT : LJJ_EXPECT_END;
+            } else {
+                return LJJ_STEP_ERR;
+            }
+            return LJJ_STEP_VALUE;
+        case LJJ_EXPECT_FIRSTKEY:
+            if (tok == '}') {
+                break;
+            }
+            if (tok != LJJ_TOKEN_STR) {
+                return LJJ_STEP_ERR;
+            }
+            *expect = LJJ_EXPECT_COLON;
+            return LJJ_STEP_KEY;
+        case LJJ_EXPECT_COLON:
+            if (tok != ':') {
+                return LJJ_STEP_ERR;
+            }
+            *expect = LJJ_EXPECT_VALUE;
+            return LJJ_STEP_PUNCT;
+        case LJJ_EXPECT_NEXT:
+            if (tok == ',') {
+                *expect = inarr ? LJJ_EXPECT_FIRSTVAL : LJJ_EXPECT_FIRSTKEY;
+                return LJJ_STEP_PUNCT;
+            }
+            if (tok != (inarr ? ']' : '}')) {
+                return LJJ_STEP_ERR;
+            }
+            break;
+        default:
+            return LJJ_STEP_ERR;
+    }
+    // closes the innermost container
+    *expect = depth > 1 ? LJJ_EXPECT_NEXT : LJJ_EXPECT_END;
+    return LJJ_STEP_CLOSE;
+}
+
+static void ljj_parser_clear(jj_parser* p) {
+    while (p->depth > 0) {
+        ljj_parser_frame* f = p->stack + --p->depth;
+        ojj_key_release(f->key);
+        ojj_free_innerval(&f->node);
+    }
+    ljj_keytab_clear(&p->state->keys);
+    if (p->root) jj_free(p->root);
+    p->root = NULL;
+    charvec_clear(p->carry);
+    p->carrystr = false;
+    p->carryesc = false;
+    p->expect = LJJ_EXPECT_VALUE;
+    p->offset = 0;
+    p->tokoffset = 0;
+    p->utf8carrylen = 0;
+}
+
+jj_parser* jj_parser_new(void) {
+    ljj_simd_init();
+    jj_parser* p = malloc(sizeof(jj_parser));
+    if (!p) {
+        return NULL;
+    }
+    p->state = ljj_new_lexstate(NULL, 0);
+    p->carry = charvec_new(15);
+    if (!p->state || !p->carry) {
+        if (p->state) ljj_free_lexstate(p->state);
+        if (p->carry) charvec_free(p->carry);
+        free(p);
+        return NULL;
+    }
+    p->state->err = &p->err;
+    p->err = (jj_error){0};
+    p->stack = NULL;
+    p->depth = 0;
+    p->stackcap = 0;
+    p->max_depth = JJ_MAX_DEPTH;
+    p->check_utf8 = JJ_CHECK_UTF8;
+    p->root = NULL;
+    ljj_parser_clear(p);
+    return p;
+}
+
+void jj_parser_free(jj_parser* p) {
+    if (!p) return;
+    ljj_parser_clear(p);
+    free(p->stack);
+    charvec_free(p->carry);
+    ljj_free_lexstate(p->state);
+    free(p);
+}
+
+// records an error of `code` at the current token in `p->err`.
+static void ljj_parser_err(jj_parser* p, int code) {
+    ljj_lexstate* s = p->state;
+    bool ateof = s->curtoken & LJJ_TOKEN_EOF;
+    if (code == JJ_ERR_SYNTAX && ateof) {
+        code = JJ_ERR_EOF;
+    }
+    p->err = (jj_error){
+        .code = code,
+        .offset = ateof ? p->offset : p->tokoffset,
+        .token = ateof ? JJ_TOKKIND_EOF : ljj_tokkind(s->original[s->tokstart]),
+    };
+}
+
+// scans a string from `*pos` for its closing quote, `*esc` telling if the
+// char at `*pos` is escaped. Returns true and leaves `*pos` past the quote if
+// found, otherwise leaves it at `len` and `*esc` for the next chunk.
+static bool ljj_parser_strend(const char* s, size_t len, size_t* pos,
+                              bool* esc) {
+    size_t i = *pos;
+    while (i < len) {
+        if (*esc) {
+            *esc = false;
+            i++;
+            continue;
+        }
+        i += ljj_scanstr(s + i, len - i);
+        if (i >= len) {
+            break;
+        }
+        char c = s[i++];
+        if (c == '"') {
+            *pos = i;
+            return true;
+        }
+        if (c == '\\') {
+            *esc = true;
+        }
+    }
+    *pos = len;
+    return false;
+}
+
+// appends to the carried token the part of it at the start of `chunk`, and
+// sets `*used` to its length. Returns true if the token is now complete.
+static bool ljj_parser_fillcarry(jj_parser* p, const char* chunk, size_t len,
+                                 size_t* used) {
+    size_t i = 0;
+    bool done;
+    if (p->carrystr) {
+        done = ljj_parser_strend(chunk, len, &i, &p->carryesc);
+    } else {
+        while (i < len && !UJJ_CHAR_IS(chunk[i], UJJ_CC_TERM | UJJ_CC_STRUCT)) {
+            i++;
+        }
+        done = i < len;
+    }
+    charvec_appendn(p->carry, (char*)chunk, i);
+    *used = i;
+    return done;
+}
+
+static void ljj_parser_lexcarry(jj_parser* p) {
+    ljj_lexstate* s = p->state;
+    s->original = p->carry->buf;
+    s->length = p->carry->len;
+    s->cur_idx = 0;
+    s->curtoken = 0;
+    ljj_lex_next(s);
+    p->tokoffset = p->carryoffset;
+    charvec_clear(p->carry);
+    p->carrystr = false;
+    p->carryesc = false;
+}
+
+// lexes the next token of the chunk. Returns false at the end of the chunk,
+// after moving a token cut by it to `carry`.
+static bool ljj_parser_lex(jj_parser* p) {
+    ljj_lexstate* s = p->state;
+    ljj_lex_next(s);
+    if (s->curtoken == LJJ_TOKEN_EOF) {
+        return false;
+    }
+    p->tokoffset = p->offset + s->tokstart;
+    char first = s->original[s->tokstart];
+    if (first == '"') {
+        if (s->curtoken != LJJ_TOKEN_INVALID) {
+            return true;
+        }
+        size_t pos = s->tokstart + 1;
+        bool esc = false;
+        if (ljj_parser_strend(s->original, s->length, &pos, &esc)) {
+            return true;  // closed in this chunk, so really invalid
+        }
+        p->carrystr = true;
+        p->carryesc = esc;
+    } else if (UJJ_CHAR_IS(first, UJJ_CC_STRUCT) ||
+               !ljj_lexstate_isatend(s)) {
+        return true;
+    }
+    // a scalar may go on in the next chunk even if it is valid so far
+    p->carryoffset = p->tokoffset;
+    charvec_appendn(p->carry, (char*)s->original + s->tokstart,
+                    s->length - s->tokstart);
+    return false;
+}
+
+// takes ownership of the value of `node`, even if failed.
+static bool ljj_parser_attach(jj_parser* p, jj_jsonobj* node) {
+    if (p->depth == 0) {
+        p->root = ljj_newroot(node);
+        return p->root != NULL;
+    }
+    return ljj_frame_attach(p->stack + p->depth - 1, node);
+}
+
+static bool ljj_parser_open(jj_parser* p, jj_valtype type) {
+    if (p->depth == p->stackcap) {
+        size_t cap = p->stackcap ? p->stackcap << 1 : 16;
+        ljj_parser_frame* stack =
+            realloc(p->stack, sizeof(ljj_parser_frame) * cap);
+        if (!stack) {
+            return false;
+        }
+        p->stack = stack;
+        p->stackcap = cap;
+    }
+    jj_jsonobj node = ojj_newcontainer(type, 0);
+    if (!node.data.objval) {
+        return false;
+    }
+    p->stack[p->depth++] = (ljj_parser_frame){node, NULL, 0};
+    return true;
+}
+
+static bool ljj_parser_close(jj_parser* p) {
+    jj_jsonobj node = p->stack[--p->depth].node;
+    return ljj_parser_attach(p, &node);
+}
+
+// returns JJ_ERR_NONE, or the JJ_ERR_* why the value cannot be added.
+static int ljj_parser_value(jj_parser* p) {
+    ljj_lexstate* s = p->state;
+    bool ok;
+    switch (s->curtoken) {
+        case '{':
+        case '[':
+            if (p->depth >= p->max_depth) {
+                return JJ_ERR_DEPTH;
+            }
+            ok = ljj_parser_open(p, s->curtoken == '{' ? JJ_VALTYPE_OBJ
+                                                       : JJ_VALTYPE_ARR);
+            break;
+        default: {
+            jj_jsonobj node;
+            if (!ljj_lexstate_parsescalar(s, &node)) {
+                return s->errcode == JJ_ERR_NONE ? JJ_ERR_SYNTAX
+                                                 : JJ_ERR_NOMEM;
+            }
+            ok = ljj_parser_attach(p, &node);
+            break;
+        }
+    }
+    return ok ? JJ_ERR_NONE : JJ_ERR_NOMEM;
+}
+
+// adds the current token to the tree being built. Returns JJ_ERR_NONE, or
+// the JJ_ERR_* why it cannot.
+static int ljj_parser_push(jj_parser* p) {
+    ljj_lexstate* s = p->state;
+    bool ended = p->expect == LJJ_EXPECT_END;
+    if (LJJ_LEXSTATE_ISINVALID(s)) {
+        return ended ? JJ_ERR_TRAILING : JJ_ERR_SYNTAX;
+    }
+    ljj_parser_frame* top = p->depth ? p->stack + p->depth - 1 : NULL;
+    bool inarr = top && top->node.type == JJ_VALTYPE_ARR;
+    bool ok;
+    switch (ljj_grammar_step(&p->expect, s->curtoken, inarr, p->depth)) {
+        case LJJ_STEP_PUNCT:
+            return JJ_ERR_NONE;
+        case LJJ_STEP_KEY:
+            top->key = ljj_lexstate_getkey(s);
+            ok = top->key != NULL;
+            break;
+        case LJJ_STEP_VALUE:
+            return ljj_parser_value(p);
+        case LJJ_STEP_CLOSE:
+            ok = ljj_parser_close(p);
+            break;
+        default:
+            return ended ? JJ_ERR_TRAILING : JJ_ERR_SYNTAX;
+    }
+    return ok ? JJ_ERR_NONE : JJ_ERR_NOMEM;
+}
+
+// the length of the UTF-8 sequence led by `c`, or 1 if it is not a lead.
+static inline size_t ujj_utf8_seqlen(uint8_t c) {
+    return c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+}
+
+static void ljj_parser_utf8err(jj_parser* p, size_t offset) {
+    p->err = (jj_error){
+        .code = JJ_ERR_UTF8,
+        .offset = offset,
+        .token = JJ_TOKKIND_OTHER,
+    };
+}
+
+// checks `chunk` as the continuation of the document fed so far, carrying a
+// sequence cut by its end over to the next chunk.
+static bool ljj_parser_checkutf8(jj_parser* p, const char* chunk,
+                                 size_t len) {
+    const uint8_t* s = (const uint8_t*)chunk;
+    size_t used = 0;
+    if (p->utf8carrylen > 0) {
+        size_t want = ujj_utf8_seqlen(p->utf8carry[0]) - p->utf8carrylen;
+        used = want < len ? want : len;
+        memcpy(p->utf8carry + p->utf8carrylen, s, used);
+        p->utf8carrylen += used;
+        if (used < want) {
+            return true;
+        }
+        if (!ljj_utf8_scalar(p->utf8carry, p->utf8carrylen)) {
+            ljj_parser_utf8err(p, p->offset + used - p->utf8carrylen);
+            return false;
+        }
+        p->utf8carrylen = 0;
+    }
+    // the last lead, if its sequence goes on past the chunk
+    size_t cut = len;
+    for (size_t k = 1; k <= 3 && k <= len - used; k++) {
+        uint8_t c = s[len - k];
+        if (c < 0x80 || c >= 0xC0) {
+            if (c >= 0xC2 && c <= 0xF4 && ujj_utf8_seqlen(c) > k) {
+                cut = len - k;
+            }
+            break;
+        }
+    }
+    if (!ljj_utf8(s + used, cut - used)) {
+        ljj_parser_utf8err(
+            p, p->offset + used + ujj_utf8_valid_prefix(s + used, cut - used));
+        return false;
+    }
+    p->utf8carrylen = len - cut;
+    memcpy(p->utf8carry, s + cut, len - cut);
+    return true;
+}
+
+bool jj_parser_feed(jj_parser* p, const char* chunk, size_t len) {
+    if (p->expect == LJJ_EXPECT_FAILED) {
+        return false;
+    }
+    if (p->check_utf8 && !ljj_parser_checkutf8(p, chunk, len)) {
+        p->expect = LJJ_EXPECT_FAILED;
+        return false;
+    }
+    ljj_lexstate* s = p->state;
+    size_t used = 0;
+    int code;
+    if (p->carry->len > 0) {
+        if (!ljj_parser_fillcarry(p, chunk, len, &used)) {
+            p->offset += len;
+            return true;
+        }
+        ljj_parser_lexcarry(p);
+        if ((code = ljj_parser_push(p)) != JJ_ERR_NONE) {
+            goto ERROR;
+        }
+    }
+    s->original = chunk;
+    s->length = len;
+    s->cur_idx = used;
+    s->curtoken = 0;  // not the EOF of the previous chunk
+    while (ljj_parser_lex(p)) {
+        if ((code = ljj_parser_push(p)) != JJ_ERR_NONE) {
+            goto ERROR;
+        }
+    }
+    p->offset += len;
+    return true;
+ERROR:
+    ljj_parser_err(p, code);
+    p->expect = LJJ_EXPECT_FAILED;
+    return false;
+}
+
+jj_jsonobj* jj_parser_finish(jj_parser* p) {
+    jj_jsonobj* root = NULL;
+    if (p->expect == LJJ_EXPECT_FAILED) {
+        goto END;
+    }
+    if (p->utf8carrylen > 0) {
+        ljj_parser_utf8err(p, p->offset - p->utf8carrylen);
+        goto END;
+    }
+    if (p->carry->len > 0) {
+        ljj_parser_lexcarry(p);
+        int code = ljj_parser_push(p);
+        if (code != JJ_ERR_NONE) {
+            ljj_parser_err(p, code);
+            goto END;
+        }
+    }
+    if (p->expect != LJJ_EXPECT_END) {
+        p->state->curtoken = LJJ_TOKEN_EOF;
+        ljj_parser_err(p, JJ_ERR_EOF);
+        goto END;
+    }
+    root = p->root;
+    p->root = NULL;
+    p->err = (jj_error){0};
+END:
+    ljj_parser_clear(p);
+    return root;
+}
+
+jj_jsonobj* jj_parser_parse(jj_parser* p, const char* json_str,
+                            size_t length) {
+    ljj_parser_clear(p);
+    p->err = (jj_error){0};
+    // keeps the string buffer and the index as large as they have grown
+    ljj_lexstate_reset(p->state, json_str, length);
+    p->state->max_depth = p->max_depth;
+    p->state->check_utf8 = p->check_utf8;
+    jj_jsonobj* root = ljj_lexstate_parsedoc(p->state);
+    // chunks being fed are lexed without one
+    p->state->index = NULL;
+    p->state->sizes_len = 0;
+    ljj_lexstate_trim(p->state);
+    return root;
+}
+
+jj_jsonobj* jj_parser_parse_arena(jj_parser* p, jj_doc* doc,
+                                  const char* json_str, size_t length) {
+    ljj_parser_clear(p);  // its nodes are on the heap
+    jj_doc_reset(doc);
+    arena* prev = ojj_cur_arena;
+    ojj_cur_arena = doc->arena;
+    doc->root = jj_parser_parse(p, json_str, length);
+    ojj_cur_arena = prev;
+    doc->err = p->err;
+    return doc->root;
+}
+
+// ***************************** sax *****************************
+
+static int ljj_sax_str(ljj_lexstate* state,
+                       int (*f)(void*, const char*, size_t), void* udata) {
+    if (!f) {
+        return 0;
+    }
+    size_t len = ljj_lexstate_buflen(state);
+    ljj_lexstate_append_strbuf(state, '\0');
+    return f(udata, ljj_lexstate_buf(state), len);
+}
+
+static int ljj_sax_value(ljj_lexstate* state, charvec* stack,
+                         const jj_sax_callbacks* cb, void* udata) {
+    switch (state->curtoken) {
+        case '{':
+        case '[': {
+            bool isobj = state->curtoken == '{';
+            if (charvec_len(stack) >= state->max_depth) {
+                state->errcode = JJ_ERR_DEPTH;
+                return JJ_SAX_ERR;
+            }
+            if (charvec_append(stack, (char)state->curtoken) != 0) {
+                state->errcode = JJ_ERR_NOMEM;
+                return JJ_SAX_ERR;
+            }
+            int (*f)(void*) = isobj ? cb->start_obj : cb->start_arr;
+            return f ? f(udata) : 0;
+        }
+        case LJJ_TOKEN_STR:
+            return ljj_sax_str(state, cb->str, udata);
+        case LJJ_TOKEN_INT:
+            return cb->intval ? cb->intval(udata, state->intval) : 0;
+        case LJJ_TOKEN_FLOAT:
+            return cb->floatval ? cb->floatval(udata, state->floatval) : 0;
+        case LJJ_TOKEN_TRUE:
+        case LJJ_TOKEN_FALSE: {
+            bool v = state->curtoken == LJJ_TOKEN_TRUE;
+            return cb->boolval ? cb->boolval(udata, v) : 0;
+        }
+        case LJJ_TOKEN_NULL:
+            return cb->null ? cb->null(udata) : 0;
+        default:
+            return JJ_SAX_ERR;
+    }
+}
+
+int jj_sax_parse(const char* json_str, size_t length,
+                 const jj_sax_callbacks* cb, void* udata, jj_error* err) {
+    if (err) {
+        *err = (jj_error){0};
+    }
+    ljj_lexstate* state = ljj_new_lexstate(json_str, length);
+    if (!state) {
+        if (err) err->code = JJ_ERR_NOMEM;
+        return JJ_SAX_ERR;
+    }
+    state->err = err;
+    if (!ljj_lexstate_checkutf8(state)) {
+        ljj_lexstate_err(state, JJ_ERR_UTF8);
+        ljj_free_lexstate(state);
+        return JJ_SAX_ERR;
+    }
+    charvec* stack = charvec_new(16);  // '{' or '[' of each open container
+    if (!stack) {
+        if (err) err->code = JJ_ERR_NOMEM;
+        ljj_free_lexstate(state);
+        return JJ_SAX_ERR;
+    }
+    ljj_lexstate_buildindex(state);
+    uint8_t expect = LJJ_EXPECT_VALUE;
+    int code = JJ_ERR_NONE;
+    int rc = 0;
+    while (rc == 0) {
+        ljj_lex_next(state);
+        bool ended = expect == LJJ_EXPECT_END;
+        if (LJJ_LEXSTATE_ISINVALID(state)) {
+            if (!(state->curtoken == LJJ_TOKEN_EOF && ended)) {
+                code = ended ? JJ_ERR_TRAILING : JJ_ERR_SYNTAX;
+            }
+            break;
+        }
+        size_t depth = charvec_len(stack);
+        bool inarr = depth && stack->buf[depth - 1] == '[';
+        switch (ljj_grammar_step(&expect, state->curtoken, inarr, depth)) {
+            case LJJ_STEP_PUNCT:
+                break;
+            case LJJ_STEP_KEY:
+                rc = ljj_sax_str(state, cb->key, udata);
+                break;
+            case LJJ_STEP_VALUE:
+                rc = ljj_sax_value(state, stack, cb, udata);
+                // told apart from a callback stopping by the code it left
+                if (state->errcode != JJ_ERR_NONE) {
+                    code = state->errcode;
+                }
+                break;
+            case LJJ_STEP_CLOSE: {
+                stack->len--;
+                int (*f)(void*) = inarr ? cb->end_arr : cb->end_obj;
+                rc = f ? f(udata) : 0;
+                break;
+            }
+            default:
+                code = ended ? JJ_ERR_TRAILING : JJ_ERR_SYNTAX;
+                break;
+        }
+        if (code != JJ_ERR_NONE) {
+            break;
+        }
+    }
+    if (code != JJ_ERR_NONE) {
+        if (code == JJ_ERR_SYNTAX && !LJJ_LEXSTATE_ISINVALID(state)) {
+            state->curtoken |= LJJ_TOKEN_INVALID;
+        }
+        ljj_lexstate_err(state, code);
+        rc = JJ_SAX_ERR;
+    }
+    charvec_free(stack);
+    ljj_free_lexstate(state);
+    return rc;
+}
+
+// ***************************** threads *****************************
+
+#ifdef LJJ_HAVE_PTHREAD
+#define LJJ_LOCK(m)      pthread_mutex_lock(m)
+#define LJJ_UNLOCK(m)    pthread_mutex_unlock(m)
+#define LJJ_WAIT(c, m)   pthread_cond_wait(c, m)
+#define LJJ_BROADCAST(c) pthread_cond_broadcast(c)
+#else
+#define LJJ_LOCK(m)
+#define LJJ_UNLOCK(m)
+#define LJJ_WAIT(c, m)
+#define LJJ_BROADCAST(c)
+#endif
+
+// the number of workers for `requested`, 0 meaning one per online core.
+static int ljj_nthreads(int requested) {
+#ifdef LJJ_HAVE_PTHREAD
+    if (requested <= 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        return ncpu > 0 ? (int)ncpu : 1;
+    }
+    return requested;
+#else
+    return 1;
+#endif
+}
+
+// runs `worker(arg)` on `nthreads` threads, the calling one included, and
+// waits for all of them. Runs on fewer threads if some cannot be started.
+static void ljj_run_workers(int nthreads, void* (*worker)(void*), void* arg) {
+#ifdef LJJ_HAVE_PTHREAD
+    pthread_t* threads = malloc(sizeof(pthread_t) * nthreads);
+    int started = 0;
+    if (threads) {
+        while (started < nthreads - 1 &&
+               pthread_create(threads + started, NULL, worker, arg) == 0) {
+            started++;
+        }
+    }
+    worker(arg);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+#else
+    worker(arg);
+#endif
+}
+
+// ***************************** ndjson *****************************
+
+#define LJJ_NDJSON_MINBATCH (64 * 1024)
+#define LJJ_NDJSON_MAXBATCH (16 * 1024 * 1024)
+// batches per thread that may be parsed ahead of delivery
+#define LJJ_NDJSON_WINDOW 4
+
+typedef struct ljj_ndjson_rec {
+    size_t lineno;
+    jj_jsonobj* root;
+    jj_error err;  // why `root` is NULL
+} ljj_ndjson_rec;
+
+// a range of whole lines parsed by one worker at a time
+typedef struct ljj_ndjson_batch {
+    size_t start;
+    size_t end;
+    size_t lineno;  // of the first line
+    ljj_ndjson_rec* recs;
+    size_t nrecs;
+    bool done;
+    struct ljj_ndjson_batch* next;  // in `ready`, if unordered
+} ljj_ndjson_batch;
+
+typedef struct ljj_ndjson_job {
+    const char* buf;
+    ljj_ndjson_batch* batches;
+    size_t nbatches;
+    bool ordered;
+    jj_ndjson_func cb;
+    void* udata;
+
+    // how many batches may be taken and not delivered yet, so that a slow
+    // batch holds back a bounded number of parsed ones
+    size_t window;
+
+    // fields below are guarded by `lock`
+    size_t nextbatch;    // next batch to parse
+    size_t nextdeliver;  // next batch to deliver, if ordered
+    size_t ndelivered;
+    ljj_ndjson_batch* ready;  // parsed and not delivered yet, if unordered
+    bool delivering;          // if a worker is running the callback
+    long invalid;
+    bool failed;
+#ifdef LJJ_HAVE_PTHREAD
+    pthread_mutex_t lock;
+    pthread_cond_t delivered;  // signaled when `ndelivered` moves
+#endif
+} ljj_ndjson_job;
+
+// splits `buf` into batches of whole lines, of about `target` bytes each.
+static ljj_ndjson_batch* ljj_ndjson_split(const char* buf, size_t len,
+                                          size_t target, size_t* count) {
+    size_t n = 0, cap = len / target + 1;
+    ljj_ndjson_batch* batches = malloc(sizeof(ljj_ndjson_batch) * cap);
+    if (!batches) {
+        return NULL;
+    }
+    size_t start = 0, lineno = 1;
+    while (start < len) {
+        size_t end = len;
+        if (len - start > target) {
+            const char* nl = memchr(buf + start + target, '\n',
+                                    len - start - target);
+            end = nl ? (size_t)(nl - buf) + 1 : len;
+        }
+        if (n == cap) {
+            cap <<= 1;
+            ljj_ndjson_batch* nb =
+                realloc(batches, sizeof(ljj_ndjson_batch) * cap);
+            if (!nb) {
+                free(batches);
+                return NULL;
+            }
+            batches = nb;
+        }
+        batches[n++] =
+            (ljj_ndjson_batch){start, end, lineno, NULL, 0, false, NULL};
+        for (const char* p = buf + start;
+             (p = memchr(p, '\n', buf + end - p)) != NULL; p++) {
+            lineno++;
+        }
+        start = end;
+    }
+    *count = n;
+    return batches;
+}
+
+static void ljj_ndjson_parsebatch(ljj_ndjson_job* job, ljj_ndjson_batch* b) {
+    const char* p = job->buf + b->start;
+    const char* end = job->buf + b->end;
+    size_t cap = 0;
+    // reused for every line, along with its buffers
+    ljj_lexstate* state = ljj_new_lexstate(NULL, 0);
+    if (!state) {
+        LJJ_LOCK(&job->lock);
+        job->failed = true;
+        LJJ_UNLOCK(&job->lock);
+        return;
+    }
+    for (size_t lineno = b->lineno; p < end; lineno++) {
+        const char* nl = memchr(p, '\n', end - p);
+        const char* eol = nl ? nl : end;
+        const char* q = p;
+        while (q < eol && UJJ_CHAR_IS(*q, UJJ_CC_WS)) {
+            q++;
+        }
+        if (q < eol) {  // not a blank line
+            // from the start of the line, for the column of an error
+            jj_error err = {0};
+            state->err = &err;
+            ljj_lexstate_reset(state, p, eol - p);
+            jj_jsonobj* root = ljj_lexstate_parsedoc(state);
+            if (!root) {
+                err.offset += (size_t)(p - job->buf);
+                err.line = lineno;
+            }
+            if (b->nrecs == cap) {
+                cap = cap ? cap << 1 : 64;
+                ljj_ndjson_rec* recs =
+                    realloc(b->recs, sizeof(ljj_ndjson_rec) * cap);
+                if (!recs) {
+                    if (root) jj_free(root);
+                    LJJ_LOCK(&job->lock);
+                    job->failed = true;
+                    LJJ_UNLOCK(&job->lock);
+                    break;
+                }
+                b->recs = recs;
+            }
+            b->recs[b->nrecs++] = (ljj_ndjson_rec){lineno, root, err};
+        }
+        p = eol + 1;
+    }
+    ljj_free_lexstate(state);
+}
+
+// hands the records of `b` to the callback. Returns how many are invalid.
+static long ljj_ndjson_deliver(ljj_ndjson_job* job, ljj_ndjson_batch* b) {
+    long invalid = 0;
+    for (size_t i = 0; i < b->nrecs; i++) {
+        ljj_ndjson_rec* r = b->recs + i;
+        if (!r->root) {
+            invalid++;
+        }
+        job->cb(job->udata, r->lineno, r->root, r->root ? NULL : &r->err);
+    }
+    free(b->recs);
+    b->recs = NULL;
+    return invalid;
+}
+
+// the next batch that can be delivered, or NULL. Called with `lock` held.
+static ljj_ndjson_batch* ljj_ndjson_nextready(ljj_ndjson_job* job) {
+    ljj_ndjson_batch* b = NULL;
+    if (job->ordered) {
+        if (job->nextdeliver < job->nbatches &&
+            job->batches[job->nextdeliver].done) {
+            b = job->batches + job->nextdeliver++;
+        }
+    } else if (job->ready) {
+        b = job->ready;
+        job->ready = b->next;
+    }
+    return b;
+}
+
+static void* ljj_ndjson_worker(void* arg) {
+    ljj_ndjson_job* job = arg;
+    while (true) {
+        LJJ_LOCK(&job->lock);
+        while (job->nextbatch < job->nbatches &&
+               job->nextbatch - job->ndelivered >= job->window) {
+            LJJ_WAIT(&job->delivered, &job->lock);
+        }
+        size_t i = job->nextbatch++;
+        LJJ_UNLOCK(&job->lock);
+        if (i >= job->nbatches) {
+            return NULL;
+        }
+        ljj_ndjson_batch* b = job->batches + i;
+        ljj_ndjson_parsebatch(job, b);
+        LJJ_LOCK(&job->lock);
+        b->done = true;
+        if (!job->ordered) {
+            b->next = job->ready;
+            job->ready = b;
+        }
+        // one worker at a time runs the callback, without the lock, while
+        // the others go on parsing
+        if (!job->delivering) {
+            job->delivering = true;
+            ljj_ndjson_batch* r;
+            while ((r = ljj_ndjson_nextready(job)) != NULL) {
+                LJJ_UNLOCK(&job->lock);
+                long invalid = ljj_ndjson_deliver(job, r);
+                LJJ_LOCK(&job->lock);
+                job->invalid += invalid;
+                job->ndelivered++;
+                LJJ_BROADCAST(&job->delivered);
+            }
+            job->delivering = false;
+        }
+        LJJ_UNLOCK(&job->lock);
+    }
+}
+
+long jj_parse_ndjson(const char* buf, size_t len,
+                     const jj_ndjson_config* config, jj_ndjson_func cb,
+                     void* udata) {
+    ljj_simd_init();  // before any worker reads the dispatch pointers
+    int nthreads = ljj_nthreads(config ? config->nthreads : 0);
+    // a few batches per thread to balance lines of uneven cost
+    size_t target = len / ((size_t)nthreads * 8) + 1;
+    if (target < LJJ_NDJSON_MINBATCH) target = LJJ_NDJSON_MINBATCH;
+    if (target > LJJ_NDJSON_MAXBATCH) target = LJJ_NDJSON_MAXBATCH;
+    ljj_ndjson_job job = {
+        .buf = buf,
+        .ordered = config ? config->ordered : true,
+        .cb = cb,
+        .udata = udata,
+    };
+    job.batches = ljj_ndjson_split(buf, len, target, &job.nbatches);
+    if (!job.batches) {
+        return -1;
+    }
+    if ((size_t)nthreads > job.nbatches) {
+        nthreads = job.nbatches ? (int)job.nbatches : 1;
+    }
+    job.window = (size_t)nthreads * LJJ_NDJSON_WINDOW;
+#ifdef LJJ_HAVE_PTHREAD
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.delivered, NULL);
+#endif
+    ljj_run_workers(nthreads, ljj_ndjson_worker, &job);
+#ifdef LJJ_HAVE_PTHREAD
+    pthread_cond_destroy(&job.delivered);
+    pthread_mutex_destroy(&job.lock);
+#endif
+    // batches left undelivered after a failed allocation
+    for (size_t i = 0; i < job.nbatches; i++) {
+        for (size_t j = 0; job.batches[i].recs && j < job.batches[i].nrecs;
+             j++) {
+            if (job.batches[i].recs[j].root) {
+                jj_free(job.batches[i].recs[j].root);
+            }
+        }
+        free(job.batches[i].recs);
+    }
+    free(job.batches);
+    return job.failed ? -1 : job.invalid;
+}
+
+typedef struct ljj_ndjson_all {
+    jj_jsonobj** roots;
+    jj_error* errs;  // NULL if not wanted
+    size_t count;
+    size_t cap;
+    bool wanterrs;
+    bool failed;
+} ljj_ndjson_all;
+
+static void ljj_ndjson_collect(void* udata, UJJ_MAYBE_UNUSED size_t lineno,
+                               jj_jsonobj* root, const jj_error* err) {
+    ljj_ndjson_all* all = udata;
+    if (all->count == all->cap) {
+        size_t cap = all->cap ? all->cap << 1 : 64;
+        jj_jsonobj** roots = realloc(all->roots, sizeof(jj_jsonobj*) * cap);
+        if (roots) all->roots = roots;
+        jj_error* errs = NULL;
+        if (roots && all->wanterrs) {
+            errs = realloc(all->errs, sizeof(jj_error) * cap);
+            if (errs) all->errs = errs;
+        }
+        if (!roots || (all->wanterrs && !errs)) {
+            if (root) jj_free(root);
+            all->failed = true;
+            return;
+        }
+        all->cap = cap;
+    }
+    if (all->wanterrs) {
+        all->errs[all->count] = err ? *err : (jj_error){0};
+    }
+    all->roots[all->count++] = root;
+}
+
+jj_jsonobj** jj_parse_ndjson_all(const char* buf, size_t len, int nthreads,
+                                 size_t* count, jj_error** errs) {
+    ljj_ndjson_all all = {NULL, NULL, 0, 0, errs != NULL, false};
+    jj_ndjson_config config = {.nthreads = nthreads, .ordered = true};
+    long rc = jj_parse_ndjson(buf, len, &config, ljj_ndjson_collect, &all);
+    if (rc < 0 || all.failed) {
+        for (size_t i = 0; i < all.count; i++) {
+            if (all.roots[i]) jj_free(all.roots[i]);
+        }
+        free(all.roots);
+        free(all.errs);
+        return NULL;
+    }
+    if (!all.roots) {  // no records, which is not a failure
+        all.roots = malloc(sizeof(jj_jsonobj*));
+        all.errs = errs ? malloc(sizeof(jj_error)) : NULL;
+        if (!all.roots || (errs && !all.errs)) {
+            free(all.roots);
+            free(all.errs);
+            return NULL;
+        }
+    }
+    *count = all.count;
+    if (errs) *errs = all.errs;
+    return all.roots;
+}
+
+// ***************************** parallel *****************************
+
+#ifndef LJJ_PARALLEL_MINSIZE
+#define LJJ_PARALLEL_MINSIZE (1024 * 1024)
+#endif
+
+// a range of elements of the split container, parsed by one worker
+typedef struct ljj_par_range {
+    size_t first;  // index entry of the first token of the first element
+    size_t end;    // index entry of the separator after the last element
+    size_t count;  // of elements
+    jj_jsonarrdata* elems;    // if the container is an array
+    jj_jsonobjdata* members;  // if it is an object
+    bool ok;
+    jj_error err;  // why it failed, if not `ok`
+} ljj_par_range;
+
+typedef struct ljj_par_job {
+    const char* original;
+    size_t length;
+    uint32_t* index;
+    bool isobj;
+    size_t max_depth;  // for the elements, below the split container
+    ljj_par_range* ranges;
+    size_t nranges;
+    size_t nextrange;  // guarded by `lock`
+#ifdef LJJ_HAVE_PTHREAD
+    pthread_mutex_t lock;
+#endif
+} ljj_par_job;
+
+// index entries of the separators of a container: its ',' and its close
+typedef struct ljj_par_seps {
+    uint32_t* buf;
+    size_t len;
+    size_t cap;
+} ljj_par_seps;
+
+static inline bool ljj_par_addsep(ljj_par_seps* seps, size_t e) {
+    if (seps->len == seps->cap) {
+        size_t cap = seps->cap ? seps->cap << 1 : 64;
+        uint32_t* buf = realloc(seps->buf, sizeof(uint32_t) * cap);
+        if (!buf) {
+            return false;
+        }
+        seps->buf = buf;
+        seps->cap = cap;
+    }
+    seps->buf[seps->len++] = (uint32_t)e;
+    return true;
+}
+
+// finds the separators of the container opened at index entry `open`.
+// Returns false if it is not closed, or closed by the wrong bracket.
+static bool ljj_par_scan(const char* s, const uint32_t* index, size_t n,
+                         size_t open, ljj_par_seps* seps) {
+    seps->len = 0;
+    size_t depth = 0;
+    for (size_t e = open + 1; e < n; e++) {
+        char c = s[index[e]];
+        if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            if (depth-- == 0) {
+                // mismatches inside are found when parsing the elements
+                char close = s[index[open]] == '{' ? '}' : ']';
+                return c == close && ljj_par_addsep(seps, e);
+            }
+        } else if (c == ',' && depth == 0) {
+            if (!ljj_par_addsep(seps, e)) {
+                return false;
+            }
+        }
+    }
+    return false;
+}
+
+// records in `r` why its range failed to parse, as `code`.
+static void ljj_par_rangeerr(ljj_lexstate* state, ljj_par_range* r,
+                             int code) {
+    if (state->curtoken == LJJ_TOKEN_EOF && state->index_pos >= r->end) {
+        // the range ends at the separator of the container, which is where
+        // the error is in the whole input
+        state->tokstart = state->index[r->end];
+        state->curtoken = LJJ_TOKEN_INVALID;
+    }
+    state->err = &r->err;
+    ljj_lexstate_err(state, code);
+}
+
+static bool ljj_par_parserange(ljj_par_job* job, ljj_par_range* r) {
+    ljj_lexstate* state = ljj_new_lexstate(job->original, job->length);
+    if (!state) {
+        r->err.code = JJ_ERR_NOMEM;
+        return false;
+    }
+    state->index = job->index;  // shared, not owned
+    state->max_depth = job->max_depth;
+    state->index_pos = r->first;
+    state->index_len = r->end;
+    ljj_lexstate_buildsizes(state);
+    int code = JJ_ERR_NONE;
+    size_t cap = r->count < LJJ_HINT_STEP ? r->count : LJJ_HINT_STEP;
+    jj_valtype type = job->isobj ? JJ_VALTYPE_OBJ : JJ_VALTYPE_ARR;
+    union jj_jsondata data;
+    if (job->isobj) {
+        r->members = data.objval = ojj_newobjdata();
+        if (!r->members || ojj_objreserve(r->members, cap) != 0) {
+            code = JJ_ERR_NOMEM;
+        }
+    } else {
+        r->elems = data.arrval = ojj_newarrdata(cap);
+        if (!r->elems) {
+            code = JJ_ERR_NOMEM;
+        }
+    }
+    while (code == JJ_ERR_NONE) {
+        ljj_lex_next(state);
+        char* key = NULL;
+        if (job->isobj) {
+            if (state->curtoken != LJJ_TOKEN_STR) {
+                code = JJ_ERR_SYNTAX;
+                break;
+            }
+            key = ljj_lexstate_getkey(state);
+            if (!key) {
+                code = JJ_ERR_NOMEM;
+                break;
+            }
+            ljj_lex_next(state);
+            if (state->curtoken != ':') {
+                ojj_key_release(key);
+                code = JJ_ERR_SYNTAX;
+                break;
+            }
+            ljj_lex_next(state);
+        }
+        // copied into the container, as by the serial parse
+        jj_jsonobj val;
+        if (!ljj_lexstate_parseval(state, &val)) {
+            ojj_key_release(key);
+            code = ljj_lexstate_endcode(state, NULL);
+            break;
+        }
+        if (ljj_reservenext(type, data, r->count) != 0 ||
+            (key ? !ojj_objput(r->members, key, &val)
+                 : !ojj_arrpush(r->elems, &val))) {
+            ojj_key_release(key);
+            ojj_free_innerval(&val);
+            code = JJ_ERR_NOMEM;
+            break;
+        }
+        ljj_lex_next(state);
+        if (state->curtoken == LJJ_TOKEN_EOF) {
+            break;  // the end of the range
+        }
+        if (state->curtoken != ',') {
+            code = JJ_ERR_SYNTAX;
+        }
+    }
+    if (code != JJ_ERR_NONE) {
+        ljj_par_rangeerr(state, r, code);
+    }
+    ljj_keytab_clear(&state->keys);
+    ljj_free_lexstate(state);
+    return code == JJ_ERR_NONE;
+}
+
+static void* ljj_par_worker(void* arg) {
+    ljj_par_job* job = arg;
+    while (true) {
+        LJJ_LOCK(&job->lock);
+        size_t i = job->nextrange++;
+        LJJ_UNLOCK(&job->lock);
+        if (i >= job->nranges) {
+            return NULL;
+        }
+        job->ranges[i].ok = ljj_par_parserange(job, job->ranges + i);
+    }
+}
+
+// moves the elements parsed by the workers into `node`, in order.
+static bool ljj_par_stitch(ljj_par_job* job, jj_jsonobj* node) {
+    if (!job->isobj) {
+        size_t total = 0;
+        for (size_t i = 0; i < job->nranges; i++) {
+            total += job->ranges[i].elems->length;
+        }
+        jj_jsonarrdata* arr = node->data.arrval;
+        if (total > arr->cap && ojj_arrresize(arr, total) != 0) {
+            return false;
+        }
+        for (size_t i = 0; i < job->nranges; i++) {
+            jj_jsonarrdata* elems = job->ranges[i].elems;
+            memcpy(arr->arr + arr->length, elems->arr,
+                   sizeof(jj_jsonobj) * elems->length);
+            arr->length += elems->length;
+            elems->length = 0;  // moved
+        }
+        return true;
+    }
+    size_t total = 0;
+    for (size_t i = 0; i < job->nranges; i++) {
+        total += job->ranges[i].members->length;
+    }
+    bool ok = ojj_objreserve(node->data.objval, total) == 0;
+    for (size_t i = 0; i < job->nranges; i++) {
+        jj_jsonobjdata* members = job->ranges[i].members;
+        for (size_t j = 0; j < members->length; j++) {
+            // a later duplicated key replaces the earlier one, as in jj_oput
+            ok = ok && ojj_objput(node->data.objval, members->names[j],
+                                  members->members + j) != NULL;
+            if (!ok) {
+                ojj_key_release(members->names[j]);
+                ojj_free_innerval(members->members + j);
+            }
+        }
+        members->length = 0;  // moved or freed
+    }
+    return ok;
+}
+
+// Picks the container to split, starting from the root and going down into
+// a child holding most of the bytes while there are too few elements to share
+// among the workers. Leaves its separators in `seps`, and in `depth` how many
+// containers it is inside of.
+static bool ljj_par_pick(ljj_lexstate* state, int nthreads,
+                         ljj_par_seps* seps, size_t* open, size_t* depth) {
+    const char* s = state->original;
+    const uint32_t* index = state->index;
+    size_t e = 0;
+    *depth = 0;
+    while (true) {
+        char c = s[index[e]];
+        if ((c != '{' && c != '[') || !ljj_par_scan(s, index, state->index_len,
+                                                    e, seps)) {
+            return false;
+        }
+        const uint32_t* sep = seps->buf;
+        size_t nseps = seps->len;
+        if (nseps >= (size_t)nthreads * 4) {
+            *open = e;
+            return true;
+        }
+        // the child container spanning the most bytes
+        size_t span = index[sep[nseps - 1]] - index[e];
+        size_t best = 0, bestspan = 0, first = e + 1;
+        for (size_t i = 0; i < nseps; first = sep[i++] + 1) {
+            size_t v = c == '{' ? first + 2 : first;  // skips "key" ':'
+            if (v >= sep[i]) continue;
+            char vc = s[index[v]];
+            if ((vc == '{' || vc == '[') &&
+                index[sep[i]] - index[v] > bestspan) {
+                best = v;
+                bestspan = index[sep[i]] - index[v];
+            }
+        }
+        if (bestspan <= span / 2) {
+            *open = e;
+            return nseps >= 2;
+        }
+        e = best;
+        ++*depth;
+    }
+}
+
+// splits the elements of the container at entry `open` into ranges of about
+// the same size, a few per thread.
+static ljj_par_range* ljj_par_split(ljj_lexstate* state, ljj_par_seps* seps,
+                                    size_t open, int nthreads,
+                                    size_t* nranges) {
+    const uint32_t* index = state->index;
+    const uint32_t* sep = seps->buf;
+    size_t nseps = seps->len;
+    if (nseps >= 2 && sep[nseps - 2] + 1 == sep[nseps - 1]) {
+        nseps--;  // a trailing ',' is not followed by an element
+    }
+    size_t want = (size_t)nthreads * 4;
+    if (want > nseps) want = nseps;
+    ljj_par_range* ranges = malloc(sizeof(ljj_par_range) * want);
+    if (!ranges) {
+        return NULL;
+    }
+    size_t start = index[open];
+    size_t bytes = index[sep[nseps - 1]] - start;
+    size_t n = 0, first = open + 1, firstsep = 0;
+    for (size_t i = 0; i < nseps; i++) {
+        // cuts after the element that crosses the next share of bytes
+        if (i + 1 < nseps &&
+            (index[sep[i]] - start) * want < bytes * (n + 1)) {
+            continue;
+        }
+        ranges[n++] = (ljj_par_range){
+            first, sep[i], i + 1 - firstsep, NULL, NULL, false, {0}};
+        first = sep[i] + 1;
+        firstsep = i + 1;
+        if (n == want) break;
+    }
+    ranges[n - 1].end = sep[nseps - 1];
+    ranges[n - 1].count += nseps - firstsep;
+    *nranges = n;
+    return ranges;
+}
+
+// parses `state` with the container picked by `ljj_par_pick` built by the
+// workers. Leaves `*nused`, the threads it parsed on, 0 if the input cannot
+// be split, and otherwise returns NULL if it fails, with the error first in
+// the input reported.
+static jj_jsonobj* ljj_par_parse(ljj_lexstate* state, int nthreads,
+                                 int* nused) {
+    *nused = 0;
+    if (!ljj_lexstate_checkutf8(state)) {
+        *nused = 1;  // checked whole, on this thread
+        ljj_lexstate_err(state, JJ_ERR_UTF8);
+        return NULL;
+    }
+    ljj_lexstate_buildindex(state);
+    if (!state->index || state->index_len == 0) {
+        return NULL;
+    }
+    ljj_par_seps seps = {NULL, 0, 0};
+    size_t open, depth;
+    ljj_par_job job = {
+        .original = state->original,
+        .length = state->length,
+        .index = state->index,
+    };
+    if (!ljj_par_pick(state, nthreads, &seps, &open, &depth) ||
+        depth >= state->max_depth) {
+        free(seps.buf);
+        return NULL;
+    }
+    job.max_depth = state->max_depth - depth - 1;
+    job.isobj = state->original[state->index[open]] == '{';
+    job.ranges = ljj_par_split(state, &seps, open, nthreads, &job.nranges);
+    size_t close = seps.buf[seps.len - 1];
+    free(seps.buf);
+    if (!job.ranges) {
+        return NULL;
+    }
+    *nused = nthreads < (int)job.nranges ? nthreads : (int)job.nranges;
+#ifdef LJJ_HAVE_PTHREAD
+    pthread_mutex_init(&job.lock, NULL);
+#endif
+    ljj_run_workers(*nused, ljj_par_worker, &job);
+#ifdef LJJ_HAVE_PTHREAD
+    pthread_mutex_destroy(&job.lock);
+#endif
+    // the first range that failed, whose error comes first in the container
+    const jj_error* rangeerr = NULL;
+    for (size_t i = 0; i < job.nranges && !rangeerr; i++) {
+        if (!job.ranges[i].ok) {
+            rangeerr = &job.ranges[i].err;
+        }
+    }
+    jj_jsonobj* node = job.isobj ? jj_new_jsonobj() : jj_new_jsonarr();
+    int code = node ? JJ_ERR_NONE : JJ_ERR_NOMEM;
+    // the container stays empty if a range failed, to still parse around it
+    if (node && !rangeerr && !ljj_par_stitch(&job, node)) {
+        code = JJ_ERR_NOMEM;
+    }
+    for (size_t i = 0; i < job.nranges; i++) {
+        if (job.ranges[i].elems) ojj_arrfree(job.ranges[i].elems);
+        if (job.ranges[i].members) ojj_objfree(job.ranges[i].members);
+    }
+    jj_jsonobj* root = NULL;
+    if (code == JJ_ERR_NONE) {
+        // the rest of the document around the container, on this thread
+        state->splice = node;
+        state->splice_open = open;
+        state->splice_close = close;
+        node = NULL;
+        ljj_lex_next(state);
+        root = ljj_lexstate_parsenode(state);
+        code = ljj_lexstate_endcode(state, root);
+        if (code != JJ_ERR_NONE) {
+            ljj_lexstate_err(state, code);
+        }
+        if (state->splice) {  // not reached
+            jj_free(state->splice);
+            state->splice = NULL;
+        }
+    } else if (state->err) {
+        state->err->code = code;
+    }
+    if (node) jj_free(node);
+    // an error around the container only comes first if it is before it
+    if (rangeerr && (code == JJ_ERR_NONE ||
+                     (state->err &&
+                      state->err->offset > state->index[open]))) {
+        if (state->err) *state->err = *rangeerr;
+        code = rangeerr->code;
+    }
+    free(job.ranges);
+    if (code != JJ_ERR_NONE) {
+        if (root) jj_free(root);
+        return NULL;
+    }
+    return root;
+}
+
+jj_jsonobj* jj_parse_parallel(const char* json_str, size_t length,
+                              int nthreads, jj_error* err, int* nused) {
+    if (nused) {
+        *nused = 1;
+    }
+    nthreads = ljj_nthreads(nthreads);
+    // the split needs the structural index, which is for up to 4 GiB
+    if (nthreads < 2 || length < LJJ_PARALLEL_MINSIZE ||
+        length > UINT32_MAX) {
+        return jj_parse_err(json_str, length, err);
+    }
+    if (err) {
+        *err = (jj_error){0};
+    }
+    ljj_simd_init();  // before any worker reads the dispatch pointers
+    ljj_lexstate* state = ljj_new_lexstate(json_str, length);
+    if (!state) {
+        if (err) err->code = JJ_ERR_NOMEM;
+        return NULL;
+    }
+    state->err = err;
+    int used;
+    jj_jsonobj* root = ljj_par_parse(state, nthreads, &used);
+    ljj_free_lexstate(state);
+    if (used && nused) {
+        *nused = used;
+    }
+    if (!used) {
+        // a scalar, a container with too few elements, or a broken one:
+        // parse it whole on this thread
+        return jj_parse_err(json_str, length, err);
+    }
+    return root;
+}
+
+// ***************************** on demand *****************************
+
+jj_ondemand_doc* jj_ondemand_new(const char* json_str, size_t length) {
+    jj_ondemand_doc* doc = malloc(sizeof(jj_ondemand_doc));
+    if (!doc) {
+        return NULL;
+    }
+    doc->state = ljj_new_lexstate(json_str, length);
+    if (!doc->state || !ljj_lexstate_checkutf8(doc->state)) {
+        if (doc->state) ljj_free_lexstate(doc->state);
+        free(doc);
+        return NULL;
+    }
+    ljj_lexstate_buildindex(doc->state);
+    // zeroed pages are only touched for the containers skipped
+    doc->skip = doc->state->index_len
+                    ? calloc(doc->state->index_len, sizeof(uint32_t))
+                    : NULL;
+    if (!doc->skip) {
+        ljj_free_lexstate(doc->state);
+        free(doc);
+        return NULL;
+    }
+    doc->cur_container = SIZE_MAX;
+    doc->cur_pos = 0;
+    doc->cur_idx = 0;
+    return doc;
+}
+
+void jj_ondemand_free(jj_ondemand_doc* doc) {
+    if (!doc) return;
+    free(doc->skip);
+    ljj_free_lexstate(doc->state);
+    free(doc);
+}
+
+jj_ondemand_val jj_ondemand_root(jj_ondemand_doc* doc) {
+    return (jj_ondemand_val){doc, 0};
+}
+
+// the first char of the token at entry `e`, or 0 past the end.
+static inline char ljj_od_char(jj_ondemand_doc* doc, size_t e) {
+    ljj_lexstate* s = doc->state;
+    return e < s->index_len ? s->original[s->index[e]] : 0;
+}
+
+// the entry after the value starting at entry `e`.
+static size_t ljj_od_skip(jj_ondemand_doc* doc, size_t e) {
+    char c = ljj_od_char(doc, e);
+    if (c != '{' && c != '[') {
+        return e + 1;
+    }
+    if (doc->skip[e]) {
+        return doc->skip[e];
+    }
+    size_t n = doc->state->index_len;
+    size_t depth = 0;
+    for (size_t i = e + 1; i < n; i++) {
+        c = ljj_od_char(doc, i);
+        if (c == '{' || c == '[') {
+            if (doc->skip[i]) {  // skipped before
+                i = doc->skip[i] - 1;
+                continue;
+            }
+            depth++;
+        } else if (c == '}' || c == ']') {
+            if (depth-- == 0) {
+                doc->skip[e] = (uint32_t)(i + 1);
+                return i + 1;
+            }
+        }
+    }
+    return n;  // not closed
+}
+
+// the entry of the next member or element after the value at entry `e`.
+static inline size_t ljj_od_next(jj_ondemand_doc* doc, size_t e) {
+    e = ljj_od_skip(doc, e);
+    return ljj_od_char(doc, e) == ',' ? e + 1 : e;
+}
+
+// lexes the token at entry `e`.
+static void ljj_od_lex(jj_ondemand_doc* doc, size_t e) {
+    ljj_lexstate* s = doc->state;
+    s->index_pos = e;
+    ljj_lex_next(s);
+}
+
+// if the key at entry `e` is `name`.
+static bool ljj_od_keyis(jj_ondemand_doc* doc, size_t e, const char* name,
+                         size_t namelen) {
+    ljj_lexstate* s = doc->state;
+    const char* key = s->original + s->index[e] + 1;
+    // the closing quote is the last non-whitespace char before the ':'
+    const char* end = s->original + s->index[e + 1];
+    while (end > key && UJJ_CHAR_IS(end[-1], UJJ_CC_WS)) {
+        end--;
+    }
+    if (end == key || end[-1] != '"') {
+        return false;
+    }
+    size_t rawlen = end - 1 - key;
+    if (!memchr(key, '\\', rawlen)) {  // as it is in the input
+        return rawlen == namelen && memcmp(key, name, namelen) == 0;
+    }
+    ljj_od_lex(doc, e);
+    return s->curtoken == LJJ_TOKEN_STR && ljj_lexstate_buflen(s) == namelen &&
+           memcmp(ljj_lexstate_buf(s), name, namelen) == 0;
+}
+
+jj_ondemand_val jj_ondemand_oget(jj_ondemand_val obj, const char* name) {
+    jj_ondemand_val missing = {NULL, 0};
+    jj_ondemand_doc* doc = obj.doc;
+    if (!doc || ljj_od_char(doc, obj.entry) != '{') {
+        return missing;
+    }
+    size_t namelen = strlen(name);
+    size_t start = obj.entry + 1;
+    size_t first = doc->cur_container == obj.entry ? doc->cur_pos : start;
+    bool wrapped = first == start;
+    for (size_t e = first;;) {
+        char c = ljj_od_char(doc, e);
+        if (c == '}' && !wrapped) {  // read from the cursor to the end
+            e = start;
+            wrapped = true;
+            continue;
+        }
+        if (c != '"' || (wrapped && e == first && e != start) ||
+            ljj_od_char(doc, e + 1) != ':') {
+            return missing;
+        }
+        size_t next = ljj_od_next(doc, e + 2);
+        if (ljj_od_keyis(doc, e, name, namelen)) {
+            doc->cur_container = obj.entry;
+            doc->cur_pos = next;
+            return (jj_ondemand_val){doc, e + 2};
+        }
+        e = next;
+        if (wrapped && e == first) {
+            return missing;
+        }
+    }
+}
+
+jj_ondemand_val jj_ondemand_aget(jj_ondemand_val arr, size_t idx) {
+    jj_ondemand_val missing = {NULL, 0};
+    jj_ondemand_doc* doc = arr.doc;
+    if (!doc || ljj_od_char(doc, arr.entry) != '[') {
+        return missing;
+    }
+    size_t e = arr.entry + 1, i = 0;
+    if (doc->cur_container == arr.entry && doc->cur_idx <= idx) {
+        e = doc->cur_pos;
+        i = doc->cur_idx;
+    }
+    for (;; i++) {
+        char c = ljj_od_char(doc, e);
+        if (c == ']' || c == ',' || c == 0) {
+            return missing;
+        }
+        size_t next = ljj_od_next(doc, e);
+        if (i == idx) {
+            doc->cur_container = arr.entry;
+            doc->cur_pos = next;
+            doc->cur_idx = i + 1;
+            return (jj_ondemand_val){doc, e};
+        }
+        e = next;
+    }
+}
+
+jj_valtype jj_ondemand_type(jj_ondemand_val v) {
+    if (!v.doc) {
+        return 0;
+    }
+    switch (ljj_od_char(v.doc, v.entry)) {
+        case '{':
+            return JJ_VALTYPE_OBJ;
+        case '[':
+            return JJ_VALTYPE_ARR;
+        case '"':
+            return JJ_VALTYPE_STR;
+        default:
+            break;
+    }
+    ljj_od_lex(v.doc, v.entry);
+    switch (v.doc->state->curtoken) {
+        case LJJ_TOKEN_INT:
+            return JJ_VALTYPE_INT;
+        case LJJ_TOKEN_FLOAT:
+            return JJ_VALTYPE_FLOAT;
+        case LJJ_TOKEN_TRUE:
+        case LJJ_TOKEN_FALSE:
+            return JJ_VALTYPE_BOOL;
+        case LJJ_TOKEN_NULL:
+            return JJ_VALTYPE_NULL;
+        default:
+            return 0;
+    }
+}
+
+bool jj_ondemand_getint(jj_ondemand_val v, jj_jsontype_int* result) {
+    if (!v.doc) return false;
+    ljj_od_lex(v.doc, v.entry);
+    return ljj_lexstate_getint(v.doc->state, result);
+}
+
+bool jj_ondemand_getfloat(jj_ondemand_val v, jj_jsontype_float* result) {
+    if (!v.doc) return false;
+    ljj_od_lex(v.doc, v.entry);
+    return ljj_lexstate_getfloat(v.doc->state, result);
+}
+
+bool jj_ondemand_getbool(jj_ondemand_val v, jj_jsontype_bool* result) {
+    if (!v.doc) return false;
+    ljj_od_lex(v.doc, v.entry);
+    ljj_token_type tok = v.doc->state->curtoken;
+    if (tok != LJJ_TOKEN_TRUE && tok != LJJ_TOKEN_FALSE) return false;
+    *result = tok == LJJ_TOKEN_TRUE;
+    return true;
+}
+
+const char* jj_ondemand_getstrref(jj_ondemand_val v, size_t* len) {
+    if (!v.doc || ljj_od_char(v.doc, v.entry) != '"') return NULL;
+    ljj_lexstate* s = v.doc->state;
+    ljj_od_lex(v.doc, v.entry);
+    if (s->curtoken != LJJ_TOKEN_STR) return NULL;
+    if (len) *len = ljj_lexstate_buflen(s);
+    ljj_lexstate_append_strbuf(s, '\0');
+    return ljj_lexstate_buf(s);
+}
+
+jj_jsonobj* jj_ondemand_tojson(jj_ondemand_val v) {
+    if (!v.doc) return NULL;
+    ljj_od_lex(v.doc, v.entry);
+    return ljj_lexstate_parsenode(v.doc->state);
+}
+
+// ***************************** tape *****************************
+
+typedef struct ljj_tape_frame {
+    size_t open;   // the word of the open tag
+    size_t count;  // members or elements so far
+} ljj_tape_frame;
+
+static inline bool ojj_tape_push(jj_tape* t, uint64_t w) {
+    if (t->len == t->cap) {
+        size_t cap = t->cap ? t->cap << 1 : 64;
+        uint64_t* words = realloc(t->words, cap * sizeof(uint64_t));
+        if (!words) {
+            return false;
+        }
+        t->words = words;
+        t->cap = cap;
+    }
+    t->words[t->len++] = w;
+    return true;
+}
+
+// the word after the value at `pos`.
+static inline size_t ojj_tape_after(const jj_tape* t, size_t pos) {
+    uint64_t w = t->words[pos];
+    switch (OJJ_TAPE_TAG(w)) {
+        case '{':
+        case '[':
+            return OJJ_TAPE_PAYLOAD(w);
+        case '"':
+        case 'l':
+        case 'd':
+            return pos + 2;
+        default:
+            return pos + 1;
+    }
+}
+
+static inline const char* ojj_tape_str(const jj_tape* t, size_t pos) {
+    return t->strs->buf + OJJ_TAPE_PAYLOAD(t->words[pos]);
+}
+
+static bool ljj_tape_str(jj_tape* t, ljj_lexstate* state) {
+    size_t off = charvec_len(t->strs);
+    size_t len = ljj_lexstate_buflen(state);
+    if (charvec_appendn(t->strs, ljj_lexstate_buf(state), len) != 0 ||
+        charvec_append(t->strs, '\0') != 0) {
+        return false;
+    }
+    return ojj_tape_push(t, OJJ_TAPE_WORD('"', off)) && ojj_tape_push(t, len);
+}
+
+// appends the scalar or the open tag of the current token.
+static bool ljj_tape_value(jj_tape* t, ljj_lexstate* state) {
+    switch (state->curtoken) {
+        case '{':
+        case '[':
+            return ojj_tape_push(t, OJJ_TAPE_WORD(state->curtoken, 0));
+        case LJJ_TOKEN_STR:
+            return ljj_tape_str(t, state);
+        case LJJ_TOKEN_INT:
+            return ojj_tape_push(t, OJJ_TAPE_WORD('l', 0)) &&
+                   ojj_tape_push(t, (uint64_t)state->intval);
+        case LJJ_TOKEN_FLOAT: {
+            double d = (double)state->floatval;
+            uint64_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            return ojj_tape_push(t, OJJ_TAPE_WORD('d', 0)) &&
+                   ojj_tape_push(t, bits);
+        }
+        case LJJ_TOKEN_TRUE:
+            return ojj_tape_push(t, OJJ_TAPE_WORD('t', 0));
+        case LJJ_TOKEN_FALSE:
+            return ojj_tape_push(t, OJJ_TAPE_WORD('f', 0));
+        case LJJ_TOKEN_NULL:
+            return ojj_tape_push(t, OJJ_TAPE_WORD('n', 0));
+        default:
+            return false;
+    }
+}
+
+// fills `t` from `state`, and returns false if failed or invalid.
+static bool ljj_tape_build(jj_tape* t, ljj_lexstate* state) {
+    ljj_tape_frame* stack = NULL;
+    size_t depth = 0, stackcap = 0;
+    uint8_t expect = LJJ_EXPECT_VALUE;
+    bool invalid = false, ok = false;
+    while (true) {
+        ljj_lex_next(state);
+        if (LJJ_LEXSTATE_ISINVALID(state)) {
+            ok = state->curtoken == LJJ_TOKEN_EOF && expect == LJJ_EXPECT_END;
+            invalid = !ok;
+            break;
+        }
+        bool inarr =
+            depth && OJJ_TAPE_TAG(t->words[stack[depth - 1].open]) == '[';
+        int step = ljj_grammar_step(&expect, state->curtoken, inarr, depth);
+        if (step == LJJ_STEP_PUNCT) {
+            continue;
+        }
+        if (step == LJJ_STEP_KEY) {
+            if (!ljj_tape_str(t, state)) {
+                break;
+            }
+            continue;
+        }
+        if (step == LJJ_STEP_CLOSE) {
+            ljj_tape_frame* f = stack + --depth;
+            // the open tag jumps over the close
+            t->words[f->open] =
+                OJJ_TAPE_WORD(OJJ_TAPE_TAG(t->words[f->open]), t->len + 1);
+            if (!ojj_tape_push(t, OJJ_TAPE_WORD(state->curtoken, f->count))) {
+                break;
+            }
+            continue;
+        }
+        if (step != LJJ_STEP_VALUE) {
+            invalid = true;
+            break;
+        }
+        if ((state->curtoken == '{' || state->curtoken == '[') &&
+            depth >= state->max_depth) {
+            break;
+        }
+        if (depth) {
+            stack[depth - 1].count++;
+        }
+        if (!ljj_tape_value(t, state)) {
+            break;
+        }
+        if (state->curtoken == '{' || state->curtoken == '[') {
+            if (depth == stackcap) {
+                size_t cap = stackcap ? stackcap << 1 : 16;
+                ljj_tape_frame* s = realloc(stack, cap * sizeof(*s));
+                if (!s) {
+                    break;
+                }
+                stack = s;
+                stackcap = cap;
+            }
+            stack[depth++] = (ljj_tape_frame){t->len - 1, 0};
+        }
+    }
+    if (invalid) {
+        if (!LJJ_LEXSTATE_ISINVALID(state)) {
+            state->curtoken |= LJJ_TOKEN_INVALID;
+        }
+        ljj_lexstate_err(state, JJ_ERR_SYNTAX);
+    }
+    free(stack);
+    return ok;
+}
+
+jj_tape* jj_parse_tape(const char* json_str, size_t length) {
+    ljj_lexstate* state = ljj_new_lexstate(json_str, length);
+    if (!state) {
+        return NULL;
+    }
+    if (!ljj_lexstate_checkutf8(state)) {
+        ljj_free_lexstate(state);
+        return NULL;
+    }
+    ljj_lexstate_buildindex(state);
+    jj_tape* t = malloc(sizeof(jj_tape));
+    if (!t) {
+        ljj_free_lexstate(state);
+        return NULL;
+    }
+    // a token takes at most 2 words, so with the index the tape never grows
+    t->cap = state->index ? 2 * state->index_len + 1 : 0;
+    t->len = 0;
+    t->words = t->cap ? malloc(t->cap * sizeof(uint64_t)) : NULL;
+    t->strs = charvec_new(length / 2 + 16);
+    if ((t->cap && !t->words) || !t->strs || !ljj_tape_build(t, state)) {
+        ljj_free_lexstate(state);
+        jj_tape_free(t);
+        return NULL;
+    }
+    ljj_free_lexstate(state);
+    uint64_t* words = realloc(t->words, t->len * sizeof(uint64_t));
+    if (words) {
+        t->words = words;
+        t->cap = t->len;
+    }
+    return t;
+}
+
+void jj_tape_free(jj_tape* tape) {
+    if (!tape) return;
+    free(tape->words);
+    if (tape->strs) charvec_free(tape->strs);
+    free(tape);
+}
+
+jj_tape_val jj_tape_root(const jj_tape* tape) {
+    return (jj_tape_val){tape, 0};
+}
+
+jj_valtype jj_tape_type(jj_tape_val v) {
+    if (!v.tape) {
+        return 0;
+    }
+    switch (OJJ_TAPE_TAG(v.tape->words[v.pos])) {
+        case '{':
+            return JJ_VALTYPE_OBJ;
+        case '[':
+            return JJ_VALTYPE_ARR;
+        case '"':
+            return JJ_VALTYPE_STR;
+        case 'l':
+            return JJ_VALTYPE_INT;
+        case 'd':
+            return JJ_VALTYPE_FLOAT;
+        case 't':
+        case 'f':
+            return JJ_VALTYPE_BOOL;
+        case 'n':
+            return JJ_VALTYPE_NULL;
+        default:
+            return 0;
+    }
+}
+
+size_t jj_tape_count(jj_tape_val v) {
+    jj_valtype type = jj_tape_type(v);
+    if (type != JJ_VALTYPE_OBJ && type != JJ_VALTYPE_ARR) {
+        return 0;
+    }
+    size_t close = OJJ_TAPE_PAYLOAD(v.tape->words[v.pos]) - 1;
+    return OJJ_TAPE_PAYLOAD(v.tape->words[close]);
+}
+
+jj_tape_val jj_tape_oget(jj_tape_val obj, const char* name) {
+    jj_tape_val missing = {NULL, 0};
+    if (jj_tape_type(obj) != JJ_VALTYPE_OBJ) {
+        return missing;
+    }
+    const jj_tape* t = obj.tape;
+    size_t namelen = strlen(name);
+    size_t end = OJJ_TAPE_PAYLOAD(t->words[obj.pos]) - 1;
+    for (size_t pos = obj.pos + 1; pos < end;
+         pos = ojj_tape_after(t, pos + 2)) {
+        // the length is on the tape, so most keys are told apart without
+        // reading their chars
+        if (t->words[pos + 1] == namelen &&
+            memcmp(ojj_tape_str(t, pos), name, namelen) == 0) {
+            return (jj_tape_val){t, pos + 2};
+        }
+    }
+    return missing;
+}
+
+jj_tape_val jj_tape_aget(jj_tape_val arr, size_t idx) {
+    jj_tape_val missing = {NULL, 0};
+    if (jj_tape_type(arr) != JJ_VALTYPE_ARR || jj_tape_count(arr) <= idx) {
+        return missing;
+    }
+    size_t pos = arr.pos + 1;
+    for (size_t i = 0; i < idx; i++) {
+        pos = ojj_tape_after(arr.tape, pos);
+    }
+    return (jj_tape_val){arr.tape, pos};
+}
+
+bool jj_tape_getint(jj_tape_val v, jj_jsontype_int* result) {
+    if (jj_tape_type(v) != JJ_VALTYPE_INT) return false;
+    *result = (jj_jsontype_int)v.tape->words[v.pos + 1];
+    return true;
+}
+
+bool jj_tape_getfloat(jj_tape_val v, jj_jsontype_float* result) {
+    if (jj_tape_type(v) != JJ_VALTYPE_FLOAT) return false;
+    double d;
+    memcpy(&d, v.tape->words + v.pos + 1, sizeof(d));
+    *result = d;
+    return true;
+}
+
+bool jj_tape_getbool(jj_tape_val v, jj_jsontype_bool* result) {
+    if (jj_tape_type(v) != JJ_VALTYPE_BOOL) return false;
+    *result = OJJ_TAPE_TAG(v.tape->words[v.pos]) == 't';
+    return true;
+}
+
+const char* jj_tape_getstrref(jj_tape_val v, size_t* len) {
+    if (jj_tape_type(v) != JJ_VALTYPE_STR) return NULL;
+    if (len) *len = v.tape->words[v.pos + 1];
+    return ojj_tape_str(v.tape, v.pos);
+}
+
+jj_tape_iter jj_tape_iter_new(jj_tape_val v) {
+    jj_tape_iter it = {v.tape, 0, 0, false};
+    jj_valtype type = jj_tape_type(v);
+    if (type == JJ_VALTYPE_OBJ || type == JJ_VALTYPE_ARR) {
+        it.pos = v.pos + 1;
+        it.end = OJJ_TAPE_PAYLOAD(v.tape->words[v.pos]) - 1;
+        it.inobj = type == JJ_VALTYPE_OBJ;
+    }
+    return it;
+}
+
+bool jj_tape_iter_next(jj_tape_iter* it, jj_tape_val* val, const char** key) {
+    if (it->pos >= it->end) {
+        return false;
+    }
+    if (key) {
+        *key = it->inobj ? ojj_tape_str(it->tape, it->pos) : NULL;
+    }
+    if (it->inobj) {
+        it->pos += 2;
+    }
+    *val = (jj_tape_val){it->tape, it->pos};
+    it->pos = ojj_tape_after(it->tape, it->pos);
+    return true;
+}
+
+static inline void sjj_tostr_appendesc(charvec* strbuf, char c) {
+    switch (c) {
+        case '"':
+            charvec_appendn(strbuf, "\\\"", 2);
+            break;
+        case '\\':
+            charvec_appendn(strbuf, "\\\\", 2);
+            break;
+        case '\b':
+            charvec_appendn(strbuf, "\\b", 2);
+            break;
+        case '\f':
+            charvec_appendn(strbuf, "\\f", 2);
+            break;
+        case '\n':
+            charvec_appendn(strbuf, "\\n", 2);
+            break;
+        case '\r':
+            charvec_appendn(strbuf, "\\r", 2);
+            break;
+        case '\t':
+            charvec_appendn(strbuf, "\\t", 2);
+            break;
+        default:
+            if (UJJ_CHAR_IS(c, UJJ_CC_ESC)) {  // other control chars
+                char u[6] = {'\\', 'u', '0', '0', "0123456789abcdef"[c >> 4],
+                             "0123456789abcdef"[c & 0xF]};
+                charvec_appendn(strbuf, u, 6);
+                break;
+            }
+            charvec_append(strbuf, c);
+            break;
+    }
+}
+
+static inline bool sjj_tostr_escunic(charvec* strbuf, char* data) {
+    int cp = 0;
+    uint8_t readlen;
+    while ((cp = ujj_utf8_to_unicode(data, &readlen)) != 0) {
+        if (cp < 0) {
+            return false;
+        }
+        if (readlen == 1) {
+            sjj_tostr_appendesc(strbuf, *data);
+        } else if (readlen >= 4) {
+            charvec_appendn(strbuf, data, readlen);
+        } else {
+            char tmp[5];
+            charvec_appendn(strbuf, "\\u", 2);
+            sprintf(tmp, "%04x", cp);
+            charvec_appendn(strbuf, tmp, 4);
+        }
+        data += readlen;
+    }
+    return true;
+}
+
+void sjj_tostr_putindent(charvec* strbuf, int depth, jj_tostr_config* config) {
+    if (config->formatted) {
+        for (int i = 0; i < depth; i++) {
+            for (int j = 0; j < config->indent; j++) {
+                charvec_append(strbuf, ' ');
+            }
+        }
+    }
+}
+
+void sjj_tostr_str(charvec* strbuf, char* data, int depth,
+                   jj_tostr_config* config) {
+    charvec_append(strbuf, '"');
     if (config->esc_unic) {
         sjj_tostr_escunic(strbuf, data);
     } else {
         while (*data != 0) {
+            // copy the run of chars that need no escape in one go
+            char* run = data;
+            while (*data != 0 && !UJJ_CHAR_IS(*data, UJJ_CC_ESC)) {
+                data++;
+            }
+            charvec_appendn(strbuf, run, data - run);
+            if (*data == 0) {
+                break;
+            }
             sjj_tostr_appendesc(strbuf, *data);
             data++;
         }
     }
-    charvec_append(strbuf, '"');
+    charvec_append(strbuf, '"');
+}
+
+void sjj_tostr_jstr(charvec* strbuf, jj_jsondata data, int depth,
+                    jj_tostr_config* config, bool inarr) {
+    if (inarr) sjj_tostr_putindent(strbuf, depth, config);
+    sjj_tostr_str(strbuf, data.strval, depth, config);
+}
+
+void sjj_tostr_jbool(charvec* strbuf, jj_jsondata data, int depth,
+                     jj_tostr_config* config, bool inarr) {
+    if (inarr) sjj_tostr_putindent(strbuf, depth, config);
+    charvec_appendn(strbuf, data.boolval ? "true" : "false",
+                    data.boolval ? 4 : 5);
+}
+
+void sjj_tostr_jint(charvec* strbuf, jj_jsondata data, int depth,
+                    jj_tostr_config* config, bool inarr) {
+    if (inarr) sjj_tostr_putindent(strbuf, depth, config);
+    char buf[30];
+    int len = sprintf(buf, "%ld", data.intval);
+    charvec_appendn(strbuf, buf, len);
+}
+
+void sjj_tostr_jfloat(charvec* strbuf, jj_jsondata data, int depth,
+                      jj_tostr_config* config, bool inarr) {
+    if (inarr) sjj_tostr_putindent(strbuf, depth, config);
+    char buf[30];
+    int len;
+    if (UJJ_FLOAT_IS_LONG) {
+        len = sprintf(buf, "%.17Lg", (long double)data.floatval);
+    } else {
+        // the fewest digits, from 15 to 17, that read back as the same double
+        double d = (double)data.floatval;
+        for (int prec = 15;; prec++) {
+            len = sprintf(buf, "%.*g", prec, d);
+            if (prec == 17 || strtod(buf, NULL) == d) break;
+        }
+    }
+    charvec_appendn(strbuf, buf, len);
+}
+
+void sjj_tostr_jnull(charvec* strbuf, int depth, jj_tostr_config* config,
+                     bool inarr) {
+    if (inarr) sjj_tostr_putindent(strbuf, depth, config);
+    charvec_appendn(strbuf, "null", 4);
+}
+
+static void sjj_tostr_name(charvec* strbuf, char* name, int depth,
+                           jj_tostr_config* config) {
+    sjj_tostr_putindent(strbuf, depth, config);
+    sjj_tostr_str(strbuf, name, depth, config);
+    charvec_append(strbuf, ':');
+    if (config->sp) {
+        charvec_append(strbuf, ' ');
+    }
+}
+
+// writes the open of a container that is not empty.
+static void sjj_tostr_open(charvec* strbuf, char c, int depth,
+                           jj_tostr_config* config, bool inarr) {
+    if (inarr) sjj_tostr_putindent(strbuf, depth, config);
+    charvec_append(strbuf, c);
+    if (config->formatted) {
+        charvec_append(strbuf, '\n');
+    }
+}
+
+static void sjj_tostr_sep(charvec* strbuf, jj_tostr_config* config) {
+    charvec_append(strbuf, ',');
+    if (config->formatted) {
+        charvec_append(strbuf, '\n');
+    } else if (config->sp) {
+        charvec_append(strbuf, ' ');
+    }
+}
+
+static void sjj_tostr_close(charvec* strbuf, char c, int depth,
+                            jj_tostr_config* config) {
+    if (config->formatted) {
+        charvec_append(strbuf, '\n');
+        sjj_tostr_putindent(strbuf, depth, config);
+    }
+    charvec_append(strbuf, c);
+}
+
+static void sjj_tostr_empty(charvec* strbuf, char* s, int depth,
+                            jj_tostr_config* config, bool inarr) {
+    if (inarr) sjj_tostr_putindent(strbuf, depth, config);
+    charvec_appendn(strbuf, s, 2);
+}
+
+#define SJJ_TOSTR_STACKSIZE 32
+
+// a container being written, and where its next member is
+typedef struct sjj_tostr_frame {
+    jj_jsonobj* node;
+    size_t count;  // members written
+} sjj_tostr_frame;
+
+// grows `*stack` which starts as `local`. Returns false if failed.
+static bool sjj_tostr_grow(void** stack, size_t* cap, void* local,
+                           size_t size) {
+    size_t newcap = *cap << 1;
+    void* s;
+    if (*stack == local) {
+        s = malloc(newcap * size);
+        if (s) memcpy(s, local, *cap * size);
+    } else {
+        s = realloc(*stack, newcap * size);
+    }
+    if (!s) {
+        return false;
+    }
+    *stack = s;
+    *cap = newcap;
+    return true;
+}
+
+// writes `obj`, keeping the containers being written on a stack rather than
+// recursing into them.
+static int sjj_tostr_walk(jj_jsonobj* obj, charvec* strbuf, int depth,
+                          jj_tostr_config* config, bool inarr) {
+    sjj_tostr_frame local[SJJ_TOSTR_STACKSIZE];
+    sjj_tostr_frame* stack = local;
+    size_t n = 0, cap = SJJ_TOSTR_STACKSIZE;
+    int ret = 0;
+    jj_jsonobj* node = obj;  // the next value to write
+    char* name = NULL;       // of `node` if it is a member
+    while (node) {
+        int d = depth + (int)n;
+        if (name) {
+            sjj_tostr_name(strbuf, name, d, config);
+        }
+        bool isarr = node->type == JJ_VALTYPE_ARR;
+        if (node->type != JJ_VALTYPE_OBJ && !isarr) {
+            ret = sjj_tostr_jdata(node, strbuf, d, config, inarr);
+            if (ret != 0) break;
+        } else if (isarr ? node->data.arrval->length == 0
+                         : node->data.objval->length == 0) {
+            sjj_tostr_empty(strbuf, isarr ? "[]" : "{}", d, config, inarr);
+        } else {
+            if (n == cap && !sjj_tostr_grow((void**)&stack, &cap, local,
+                                            sizeof(sjj_tostr_frame))) {
+                ret = 1;
+                break;
+            }
+            sjj_tostr_open(strbuf, isarr ? '[' : '{', d, config, inarr);
+            stack[n++] = (sjj_tostr_frame){node, 0};
+        }
+        // the next member of the innermost container, closing those done
+        node = NULL;
+        while (n > 0 && !node) {
+            sjj_tostr_frame* f = stack + n - 1;
+            isarr = f->node->type == JJ_VALTYPE_ARR;
+            size_t len = isarr ? f->node->data.arrval->length
+                               : f->node->data.objval->length;
+            if (f->count == len) {
+                sjj_tostr_close(strbuf, isarr ? ']' : '}', depth + (int)--n,
+                                config);
+                continue;
+            }
+            if (f->count) {
+                sjj_tostr_sep(strbuf, config);
+            }
+            if (isarr) {
+                node = f->node->data.arrval->arr + f->count++;
+                name = NULL;
+            } else {
+                name = f->node->data.objval->names[f->count];
+                node = f->node->data.objval->members + f->count++;
+            }
+            inarr = isarr;
+        }
+    }
+    if (stack != local) free(stack);
+    return ret;
+}
+
+int sjj_tostr_jdata(jj_jsonobj* obj, charvec* strbuf, int depth,
+                    jj_tostr_config* config, bool inarr) {
+    switch (obj->type) {
+        case JJ_VALTYPE_BOOL:
+            sjj_tostr_jbool(strbuf, obj->data, depth, config, inarr);
+            break;
+        case JJ_VALTYPE_STR:
+            sjj_tostr_jstr(strbuf, obj->data, depth, config, inarr);
+            break;
+        case JJ_VALTYPE_INT:
+            sjj_tostr_jint(strbuf, obj->data, depth, config, inarr);
+            break;
+        case JJ_VALTYPE_FLOAT:
+            sjj_tostr_jfloat(strbuf, obj->data, depth, config, inarr);
+            break;
+        case JJ_VALTYPE_NULL:
+            sjj_tostr_jnull(strbuf, depth, config, inarr);
+            break;
+        case JJ_VALTYPE_OBJ:
+        case JJ_VALTYPE_ARR:
+            return sjj_tostr_walk(obj, strbuf, depth, config, inarr);
+        default:
+            return 1;
+    }
+    return 0;
+}
+
+int sjj_tostr(jj_jsonobj* obj, charvec* strbuf, int depth,
+              jj_tostr_config* config, bool inarr) {
+    return sjj_tostr_walk(obj, strbuf, depth, config, inarr);
+}
+
+char* jj_tostr(jj_jsonobj* obj, jj_tostr_config* config) {
+    charvec* strbuf = charvec_new(30);
+    int ret = sjj_tostr(obj, strbuf, 0, config, false);
+    if (ret != 0) {
+        charvec_free(strbuf);
+        return NULL;
+    }
+    char* str = charvec_tostr(strbuf);
+    charvec_free(strbuf);
+    return str;
+}
+
+// writes the value at `pos` if it is a scalar or an empty container, and
+// returns false otherwise.
+static bool sjj_tostr_tapeleaf(const jj_tape* t, size_t pos, charvec* strbuf,
+                               int depth, jj_tostr_config* config,
+                               bool inarr) {
+    uint64_t w = t->words[pos];
+    char tag = OJJ_TAPE_TAG(w);
+    jj_jsondata data;
+    switch (tag) {
+        case '"':
+            data.strval = (char*)ojj_tape_str(t, pos);
+            sjj_tostr_jstr(strbuf, data, depth, config, inarr);
+            return true;
+        case 'l':
+            data.intval = (jj_jsontype_int)t->words[pos + 1];
+            sjj_tostr_jint(strbuf, data, depth, config, inarr);
+            return true;
+        case 'd': {
+            double d;
+            memcpy(&d, t->words + pos + 1, sizeof(d));
+            data.floatval = d;
+            sjj_tostr_jfloat(strbuf, data, depth, config, inarr);
+            return true;
+        }
+        case 't':
+        case 'f':
+            data.boolval = tag == 't';
+            sjj_tostr_jbool(strbuf, data, depth, config, inarr);
+            return true;
+        case 'n':
+            sjj_tostr_jnull(strbuf, depth, config, inarr);
+            return true;
+        default:
+            break;
+    }
+    if (pos + 2 != OJJ_TAPE_PAYLOAD(w)) {
+        return false;
+    }
+    sjj_tostr_empty(strbuf, tag == '{' ? "{}" : "[]", depth, config, inarr);
+    return true;
+}
+
+// a container of the tape being written
+typedef struct sjj_tostr_tapeframe {
+    size_t next;  // position of the next member
+    size_t end;   // position of the close
+    bool isobj;
+    bool any;  // if a member was written
+} sjj_tostr_tapeframe;
+
+// laid out as `sjj_tostr_walk` does. Returns false if failed to allocate.
+static bool sjj_tostr_tape(const jj_tape* t, size_t pos, charvec* strbuf,
+                           int depth, jj_tostr_config* config, bool inarr) {
+    sjj_tostr_tapeframe local[SJJ_TOSTR_STACKSIZE];
+    sjj_tostr_tapeframe* stack = local;
+    size_t n = 0, cap = SJJ_TOSTR_STACKSIZE;
+    bool ok = true, more = true;
+    while (more) {
+        int d = depth + (int)n;
+        if (!sjj_tostr_tapeleaf(t, pos, strbuf, d, config, inarr)) {
+            if (n == cap && !sjj_tostr_grow((void**)&stack, &cap, local,
+                                            sizeof(sjj_tostr_tapeframe))) {
+                ok = false;
+                break;
+            }
+            char tag = OJJ_TAPE_TAG(t->words[pos]);
+            sjj_tostr_open(strbuf, tag, d, config, inarr);
+            size_t end = OJJ_TAPE_PAYLOAD(t->words[pos]) - 1;
+            stack[n++] = (sjj_tostr_tapeframe){pos + 1, end, tag == '{', false};
+        }
+        // the next member of the innermost container, closing those done
+        more = false;
+        while (n > 0 && !more) {
+            sjj_tostr_tapeframe* f = stack + n - 1;
+            if (f->next == f->end) {
+                sjj_tostr_close(strbuf, f->isobj ? '}' : ']',
+                                depth + (int)--n, config);
+                continue;
+            }
+            if (f->any) {
+                sjj_tostr_sep(strbuf, config);
+            }
+            f->any = true;
+            if (f->isobj) {
+                sjj_tostr_name(strbuf, (char*)ojj_tape_str(t, f->next),
+                               depth + (int)n, config);
+                f->next += 2;
+            }
+            pos = f->next;
+            f->next = ojj_tape_after(t, pos);
+            inarr = !f->isobj;
+            more = true;
+        }
+    }
+    if (stack != local) free(stack);
+    return ok;
 }
 
-void sjj_tostr_jstr(charvec* strbuf, jj_jsondata data, int depth,
-                    jj_tostr_config* config, bool inarr) {
-    if (inarr) sjj_tostr_putindent(strbuf, depth, config);
-    sjj_tostr_str(strbuf, data.strval, depth, config);
+char* jj_tape_tostr(jj_tape_val v, jj_tostr_config* config) {
+    if (!v.tape) {
+        return NULL;
+    }
+    charvec* strbuf = charvec_new(30);
+    if (!strbuf) {
+        return NULL;
+    }
+    if (!sjj_tostr_tape(v.tape, v.pos, strbuf, 0, config, false)) {
+        charvec_free(strbuf);
+        return NULL;
+    }
+    char* str = charvec_tostr(strbuf);
+    charvec_free(strbuf);
+    return str;
 }
 
-void sjj_tostr_jbool(charvec* strbuf, jj_jsondata data, int depth,
-                     jj_tostr_config* config, bool inarr) {
-    if (inarr) sjj_tostr_putindent(strbuf, depth, config);
-    charvec_appendn(strbuf, data.boolval ? "true" : "false",
-                    data.boolval ? 4 : 5);
+// ***************************** schema *****************************
+
+// the size of a value of the JJ_FIELD_* `type`, as an element of an array, or
+// 0 if it cannot be one.
+static size_t ojj_bind_size(int type, const jj_schema* schema) {
+    switch (type) {
+        case JJ_FIELD_BOOL:
+            return sizeof(jj_jsontype_bool);
+        case JJ_FIELD_INT:
+            return sizeof(jj_jsontype_int);
+        case JJ_FIELD_FLOAT:
+            return sizeof(jj_jsontype_float);
+        case JJ_FIELD_STR:
+            return sizeof(char*);
+        case JJ_FIELD_OBJ:
+            return schema->size;
+        default:
+            return 0;
+    }
 }
 
-void sjj_tostr_jint(charvec* strbuf, jj_jsondata data, int depth,
-                    jj_tostr_config* config, bool inarr) {
-    if (inarr) sjj_tostr_putindent(strbuf, depth, config);
-    char buf[30];
-    int len = sprintf(buf, "%ld", data.intval);
-    charvec_appendn(strbuf, buf, len);
+#define OJJ_BIND_STACKSIZE 32
+
+// doubles the `*cap` items of `size` of a stack of the binding, moving it off
+// `local`, the storage it starts on, if it still is there.
+static bool ojj_bind_grow(void** stack, size_t* cap, void* local,
+                          size_t size) {
+    if (*cap > SIZE_MAX / 2 / size) {
+        return false;
+    }
+    size_t newcap = *cap << 1;
+    void* s;
+    if (*stack == local) {
+        s = malloc(newcap * size);
+        if (s) memcpy(s, local, *cap * size);
+    } else {
+        s = realloc(*stack, newcap * size);
+    }
+    if (!s) {
+        return false;
+    }
+    *stack = s;
+    *cap = newcap;
+    return true;
 }
 
-void sjj_tostr_jfloat(charvec* strbuf, jj_jsondata data, int depth,
-                      jj_tostr_config* config, bool inarr) {
-    if (inarr) sjj_tostr_putindent(strbuf, depth, config);
-    char buf[30];
-    int len = sprintf(buf, "%.17Lg", data.floatval);
-    charvec_appendn(strbuf, buf, len);
+// a field left to release, or with `field` NULL, elements left to free once
+// they are released
+typedef struct ojj_bind_item {
+    const jj_field* field;
+    char* base;  // the struct holding the field, or the elements
+} ojj_bind_item;
+
+typedef struct ojj_bind_stack {
+    ojj_bind_item* items;
+    size_t n;
+    size_t cap;
+    ojj_bind_item local[OJJ_BIND_STACKSIZE];
+} ojj_bind_stack;
+
+static bool ojj_bind_push(ojj_bind_stack* s, const jj_field* field,
+                          char* base) {
+    if (s->n == s->cap &&
+        !ojj_bind_grow((void**)&s->items, &s->cap, s->local,
+                       sizeof(ojj_bind_item))) {
+        return false;
+    }
+    s->items[s->n++] = (ojj_bind_item){field, base};
+    return true;
 }
 
-void sjj_tostr_jnull(charvec* strbuf, int depth, jj_tostr_config* config,
-                     bool inarr) {
-    if (inarr) sjj_tostr_putindent(strbuf, depth, config);
-    charvec_appendn(strbuf, "null", 4);
+static void ojj_bind_release(const jj_field* fields, size_t n, char* base);
+
+// keeps the fields of the struct at `base` that hold allocations on `s`.
+static void ojj_bind_pushfields(ojj_bind_stack* s, const jj_field* fields,
+                                size_t n, char* base) {
+    for (size_t i = 0; i < n; i++) {
+        const jj_field* f = fields + i;
+        if (f->type != JJ_FIELD_STR && f->type != JJ_FIELD_OBJ &&
+            f->type != JJ_FIELD_ARR) {
+            continue;
+        }
+        if (!ojj_bind_push(s, f, base)) {
+            // rare enough to release this one with a nested call instead
+            ojj_bind_release(f, 1, base);
+        }
+    }
 }
 
-void sjj_tostr_jobj(charvec* strbuf, jj_jsondata data, int depth,
-                    jj_tostr_config* config, bool inarr) {
-    if (inarr) sjj_tostr_putindent(strbuf, depth, config);
-    size_t cnt = hashmap_count(data.objval);
-    if (cnt == 0) {
-        charvec_appendn(strbuf, "{}", 2);
+// releases the elements of the array `f` held by the struct at `base`.
+static void ojj_bind_releasearr(ojj_bind_stack* s, const jj_field* f,
+                                char* base) {
+    char** p = (char**)(base + f->offset);
+    size_t* count = (size_t*)(base + f->countoff);
+    char* elems = *p;
+    size_t len = *count;
+    *p = NULL;
+    *count = 0;
+    if (!elems) {
         return;
     }
-    charvec_append(strbuf, '{');
-    if (config->formatted) {
-        charvec_append(strbuf, '\n');
-    }
-    size_t i = 0;
-    jj_jsonobj* obj;
-    size_t cur = 0;
-    while (hashmap_iter(data.objval, &i, (void**)&obj)) {
-        cur++;
-        sjj_tostr(obj, strbuf, depth + 1, config, false);
-        if (cur == cnt) {
-            break;
+    if (f->elem == JJ_FIELD_STR) {
+        for (size_t i = 0; i < len; i++) {
+            free(((char**)elems)[i]);
         }
-        charvec_append(strbuf, ',');
-        if (config->formatted) {
-            charvec_append(strbuf, '\n');
-        } else if (config->sp) {
-            charvec_append(strbuf, ' ');
+    } else if (f->elem == JJ_FIELD_OBJ) {
+        const jj_schema* sc = f->schema;
+        // the elements are freed after what they hold, which is above them
+        if (ojj_bind_push(s, NULL, elems)) {
+            for (size_t i = 0; i < len; i++) {
+                ojj_bind_pushfields(s, sc->fields, sc->nfields,
+                                    elems + i * sc->size);
+            }
+            return;
+        }
+        for (size_t i = 0; i < len; i++) {
+            ojj_bind_release(sc->fields, sc->nfields, elems + i * sc->size);
         }
     }
-    if (config->formatted) {
-        charvec_append(strbuf, '\n');
-        sjj_tostr_putindent(strbuf, depth, config);
-    }
-    charvec_append(strbuf, '}');
+    free(elems);
 }
 
-void sjj_tostr_jarr(charvec* strbuf, jj_jsondata data, int depth,
-                    jj_tostr_config* config, bool inarr) {
-    if (inarr) sjj_tostr_putindent(strbuf, depth, config);
-    if (data.arrval->length == 0) {
-        charvec_appendn(strbuf, "[]", 2);
-        return;
+// frees what the decoder allocated for the `n` fields from `fields` of the
+// struct at `base`, and zeroes it. Nested structs and arrays are kept on a
+// stack rather than recursed into.
+static void ojj_bind_release(const jj_field* fields, size_t n, char* base) {
+    ojj_bind_stack s;
+    s.items = s.local;
+    s.n = 0;
+    s.cap = OJJ_BIND_STACKSIZE;
+    ojj_bind_pushfields(&s, fields, n, base);
+    while (s.n > 0) {
+        ojj_bind_item it = s.items[--s.n];
+        const jj_field* f = it.field;
+        if (!f) {
+            free(it.base);
+            continue;
+        }
+        char* p = it.base + f->offset;
+        if (f->type == JJ_FIELD_STR) {
+            free(*(char**)p);
+            *(char**)p = NULL;
+        } else if (f->type == JJ_FIELD_OBJ) {
+            ojj_bind_pushfields(&s, f->schema->fields, f->schema->nfields, p);
+        } else {
+            ojj_bind_releasearr(&s, f, it.base);
+        }
     }
-    charvec_append(strbuf, '[');
-    if (config->formatted) {
-        charvec_append(strbuf, '\n');
+    if (s.items != s.local) free(s.items);
+}
+
+void jj_schema_free(const jj_schema* schema, void* v) {
+    ojj_bind_release(schema->fields, schema->nfields, v);
+}
+
+#define LJJ_BIND_SKIP 0  // a value with no field, checked and dropped
+
+// where the next value decoded goes
+typedef struct ljj_bind_slot {
+    int type;   // JJ_FIELD_*, or LJJ_BIND_SKIP
+    char* dst;
+    char* base;               // the struct holding `dst`, for an array
+    const jj_field* field;    // of `dst`, for an array
+    const jj_schema* schema;  // of `dst`, for a struct
+} ljj_bind_slot;
+
+// a container being decoded. It fills a struct if `schema` is set, an array
+// if `field` is, and is checked and dropped otherwise.
+typedef struct ljj_bind_frame {
+    const jj_schema* schema;
+    const jj_field* field;
+    char* base;   // the struct being filled, or the one holding the array
+    size_t hint;  // the field tried first for the next key
+    size_t cap;   // of the elements of the array
+    size_t size;  // elements counted for the array by the pre-scan
+    bool isarr;
+} ljj_bind_frame;
+
+// the slot of the member named by the current key, in the struct of `top`.
+// Members usually come in the order of the schema, so the search starts
+// after the last one found.
+static ljj_bind_slot ljj_bind_key(ljj_lexstate* state, ljj_bind_frame* top) {
+    ljj_bind_slot slot = {LJJ_BIND_SKIP, NULL, NULL, NULL, NULL};
+    const jj_schema* sc = top->schema;
+    if (!sc) {
+        return slot;
     }
-    // TODO: if arr is short, put it in one line.
-    jj_jsonobj* obj;
-    size_t i = 0;
-    while (true) {
-        sjj_tostr(data.arrval->arr + i, strbuf, depth + 1, config, true);
-        if (i == data.arrval->length - 1) {
+    const char* name = state->insitu ? state->insitu + state->strstart
+                                     : ljj_lexstate_buf(state);
+    size_t len = state->insitu ? state->strend - state->strstart
+                               : ljj_lexstate_buflen(state);
+    size_t j = top->hint;
+    for (size_t i = 0; i < sc->nfields; i++, j++) {
+        if (j == sc->nfields) j = 0;
+        const jj_field* f = sc->fields + j;
+        if (f->namelen == len && memcmp(f->name, name, len) == 0) {
+            top->hint = j + 1 < sc->nfields ? j + 1 : 0;
+            slot = (ljj_bind_slot){f->type, top->base + f->offset, top->base,
+                                   f, f->schema};
             break;
         }
-        charvec_append(strbuf, ',');
-        if (config->formatted) {
-            charvec_append(strbuf, '\n');
-        } else if (config->sp) {
-            charvec_append(strbuf, ' ');
+    }
+    return slot;
+}
+
+// the slot of a new element at the end of the array of `top`.
+static int ljj_bind_elem(ljj_bind_frame* top, ljj_bind_slot* slot) {
+    const jj_field* f = top->field;
+    if (!f) {
+        *slot = (ljj_bind_slot){LJJ_BIND_SKIP, NULL, NULL, NULL, NULL};
+        return JJ_ERR_NONE;
+    }
+    char** elems = (char**)(top->base + f->offset);
+    size_t* count = (size_t*)(top->base + f->countoff);
+    size_t size = ojj_bind_size(f->elem, f->schema);
+    if (*count == top->cap) {
+        // toward the count of the pre-scan, in steps as it is not validated
+        size_t cap = top->cap ? top->cap << 1 : 4;
+        if (top->size > top->cap) {
+            cap = top->cap < LJJ_HINT_STEP ? LJJ_HINT_STEP : cap;
+            if (cap > top->size) cap = top->size;
+        }
+        char* e = realloc(*elems, cap * size);
+        if (!e) {
+            return JJ_ERR_NOMEM;
         }
-        i++;
+        memset(e + top->cap * size, 0, (cap - top->cap) * size);
+        *elems = e;
+        top->cap = cap;
     }
-    if (config->formatted) {
-        charvec_append(strbuf, '\n');
-        sjj_tostr_putindent(strbuf, depth, config);
+    *slot = (ljj_bind_slot){f->elem, *elems + (*count)++ * size, NULL, NULL,
+                            f->schema};
+    return JJ_ERR_NONE;
+}
+
+// opens the container of the current token into `slot`, allocating the
+// elements of an array at the count found by the pre-scan, up to
+// LJJ_HINT_STEP.
+static int ljj_bind_open(ljj_lexstate* state, const ljj_bind_slot* slot,
+                         ljj_bind_frame* fr) {
+    bool isarr = state->curtoken == '[';
+    size_t size = ljj_lexstate_nextsize(state);
+    *fr = (ljj_bind_frame){NULL, NULL, slot->dst, 0, 0, 0, isarr};
+    if (slot->type == LJJ_BIND_SKIP) {
+        return JJ_ERR_NONE;
+    }
+    if (slot->type != (isarr ? JJ_FIELD_ARR : JJ_FIELD_OBJ)) {
+        return JJ_ERR_TYPE;
+    }
+    if (!isarr) {
+        // of a duplicated member, which is replaced rather than merged into
+        const jj_schema* sc = slot->schema;
+        ojj_bind_release(sc->fields, sc->nfields, slot->dst);
+        memset(slot->dst, 0, sc->size);
+        fr->schema = sc;
+        return JJ_ERR_NONE;
+    }
+    const jj_field* f = slot->field;
+    size_t elemsize = ojj_bind_size(f->elem, f->schema);
+    if (!elemsize) {
+        return JJ_ERR_TYPE;
     }
-    charvec_append(strbuf, ']');
+    ojj_bind_release(f, 1, slot->base);  // of a duplicated member
+    size_t cap = size < LJJ_HINT_STEP ? size : LJJ_HINT_STEP;
+    char* elems = cap ? calloc(cap, elemsize) : NULL;
+    if (cap && !elems) {
+        return JJ_ERR_NOMEM;
+    }
+    *(char**)slot->dst = elems;
+    fr->field = f;
+    fr->base = slot->base;
+    fr->cap = cap;
+    fr->size = size;
+    return JJ_ERR_NONE;
 }
 
-int sjj_tostr_jdata(jj_jsonobj* obj, charvec* strbuf, int depth,
-                    jj_tostr_config* config, bool inarr) {
-    switch (obj->type) {
-        case JJ_VALTYPE_BOOL:
-            sjj_tostr_jbool(strbuf, obj->data, depth, config, inarr);
-            break;
-        case JJ_VALTYPE_STR:
-            sjj_tostr_jstr(strbuf, obj->data, depth, config, inarr);
-            break;
-        case JJ_VALTYPE_INT:
-            sjj_tostr_jint(strbuf, obj->data, depth, config, inarr);
-            break;
-        case JJ_VALTYPE_FLOAT:
-            sjj_tostr_jfloat(strbuf, obj->data, depth, config, inarr);
-            break;
-        case JJ_VALTYPE_NULL:
-            sjj_tostr_jnull(strbuf, depth, config, inarr);
+// stores the scalar of the current token into `slot`. null leaves it as is.
+static int ljj_bind_scalar(ljj_lexstate* state, const ljj_bind_slot* slot) {
+    ljj_token_type tok = state->curtoken;
+    if (slot->type == LJJ_BIND_SKIP || tok == LJJ_TOKEN_NULL) {
+        return JJ_ERR_NONE;
+    }
+    switch (slot->type) {
+        case JJ_FIELD_BOOL:
+            if (tok != LJJ_TOKEN_TRUE && tok != LJJ_TOKEN_FALSE) break;
+            *(jj_jsontype_bool*)slot->dst = tok == LJJ_TOKEN_TRUE;
+            return JJ_ERR_NONE;
+        case JJ_FIELD_INT:
+            if (tok != LJJ_TOKEN_INT) break;
+            *(jj_jsontype_int*)slot->dst = state->intval;
+            return JJ_ERR_NONE;
+        case JJ_FIELD_FLOAT:
+            if (tok != LJJ_TOKEN_INT && tok != LJJ_TOKEN_FLOAT) break;
+            *(jj_jsontype_float*)slot->dst =
+                tok == LJJ_TOKEN_INT ? (jj_jsontype_float)state->intval
+                                     : state->floatval;
+            return JJ_ERR_NONE;
+        case JJ_FIELD_STR: {
+            if (tok != LJJ_TOKEN_STR) break;
+            char* s = ljj_lexstate_getstr(state);
+            if (!s) {
+                return JJ_ERR_NOMEM;
+            }
+            free(*(char**)slot->dst);  // of a duplicated member
+            *(char**)slot->dst = s;
+            return JJ_ERR_NONE;
+        }
+        default:
             break;
-        case JJ_VALTYPE_OBJ:
-            sjj_tostr_jobj(strbuf, obj->data, depth, config, inarr);
+    }
+    return JJ_ERR_TYPE;
+}
+
+// decodes the whole input of `state` into `out`, going over its tokens with
+// a stack of the containers open. Returns a JJ_ERR_*.
+static int ljj_bind_decode(ljj_lexstate* state, const jj_schema* schema,
+                           char* out) {
+    ljj_lexstate_buildindex(state);
+    ljj_lexstate_buildsizes(state);
+    ljj_bind_frame local[OJJ_BIND_STACKSIZE];
+    ljj_bind_frame* stack = local;
+    size_t n = 0, cap = OJJ_BIND_STACKSIZE;
+    ljj_bind_slot slot = {JJ_FIELD_OBJ, out, NULL, NULL, schema};
+    uint8_t expect = LJJ_EXPECT_VALUE;
+    int code = JJ_ERR_NONE;
+    while (code == JJ_ERR_NONE) {
+        ljj_lex_next(state);
+        if (expect == LJJ_EXPECT_END) {
+            if (state->curtoken != LJJ_TOKEN_EOF) {
+                code = JJ_ERR_TRAILING;
+            }
             break;
-        case JJ_VALTYPE_ARR:
-            sjj_tostr_jarr(strbuf, obj->data, depth, config, inarr);
+        }
+        if (LJJ_LEXSTATE_ISINVALID(state)) {
+            code = JJ_ERR_SYNTAX;
             break;
-        default:
-            return 1;
+        }
+        ljj_bind_frame* top = n ? stack + n - 1 : NULL;
+        bool inarr = top && top->isarr;
+        switch (ljj_grammar_step(&expect, state->curtoken, inarr, n)) {
+            case LJJ_STEP_PUNCT:
+                break;
+            case LJJ_STEP_KEY:
+                slot = ljj_bind_key(state, top);
+                break;
+            case LJJ_STEP_VALUE:
+                if (inarr) {
+                    code = ljj_bind_elem(top, &slot);
+                    if (code != JJ_ERR_NONE) break;
+                }
+                if (state->curtoken != '{' && state->curtoken != '[') {
+                    code = ljj_bind_scalar(state, &slot);
+                    break;
+                }
+                if (n >= state->max_depth) {
+                    code = JJ_ERR_DEPTH;
+                    break;
+                }
+                if (n == cap && !ojj_bind_grow((void**)&stack, &cap, local,
+                                               sizeof(ljj_bind_frame))) {
+                    code = JJ_ERR_NOMEM;
+                    break;
+                }
+                code = ljj_bind_open(state, &slot, stack + n);
+                n++;
+                break;
+            case LJJ_STEP_CLOSE:
+                n--;
+                break;
+            default:
+                code = JJ_ERR_SYNTAX;
+                break;
+        }
     }
-    return 0;
+    if (stack != local) free(stack);
+    return code;
 }
 
-int sjj_tostr(jj_jsonobj* obj, charvec* strbuf, int depth,
-              jj_tostr_config* config, bool inarr) {
-    if (obj->name != NULL) {
-        sjj_tostr_putindent(strbuf, depth, config);
-        sjj_tostr_str(strbuf, obj->name, depth, config);
-        charvec_append(strbuf, ':');
-        if (config->sp) {
-            charvec_append(strbuf, ' ');
+bool jj_decode(const jj_schema* schema, const char* json_str, size_t length,
+               void* out, jj_error* err) {
+    if (err) {
+        *err = (jj_error){0};
+    }
+    memset(out, 0, schema->size);
+    ljj_lexstate* state = ljj_new_lexstate(json_str, length);
+    if (!state) {
+        if (err) err->code = JJ_ERR_NOMEM;
+        return false;
+    }
+    state->err = err;
+    int code = ljj_lexstate_checkutf8(state)
+                   ? ljj_bind_decode(state, schema, out)
+                   : JJ_ERR_UTF8;
+    if (code != JJ_ERR_NONE) {
+        ljj_lexstate_err(state, code);
+        jj_schema_free(schema, out);
+        memset(out, 0, schema->size);
+    }
+    ljj_free_lexstate(state);
+    return code == JJ_ERR_NONE;
+}
+
+// a struct or an array being encoded
+typedef struct sjj_bind_frame {
+    const jj_schema* schema;  // of the struct, NULL for an array
+    const jj_field* field;    // of the array
+    const char* base;         // the struct, or the elements of the array
+    size_t count;             // fields or elements written
+    size_t len;               // of the elements of the array
+} sjj_bind_frame;
+
+// writes the struct `in`, keeping the structs and arrays being written on a
+// stack rather than recursing into them.
+static int sjj_bind_walk(const jj_schema* schema, const char* in,
+                         charvec* strbuf, jj_tostr_config* config) {
+    sjj_bind_frame local[SJJ_TOSTR_STACKSIZE];
+    sjj_bind_frame* stack = local;
+    size_t n = 0, cap = SJJ_TOSTR_STACKSIZE;
+    int ret = 0;
+    // the next value to write
+    int type = JJ_FIELD_OBJ;
+    const char* p = in;
+    const char* holder = NULL;  // the struct holding `p`, for an array
+    const jj_field* f = NULL;   // of `p`, for an array
+    const jj_schema* sc = schema;
+    char* name = NULL;
+    bool inarr = false;
+    bool more = true;
+    while (more) {
+        int d = (int)n;
+        if (name) {
+            sjj_tostr_name(strbuf, name, d, config);
+        }
+        jj_jsondata data;
+        sjj_bind_frame fr = {NULL, NULL, NULL, 0, 0};
+        switch (type) {
+            case JJ_FIELD_BOOL:
+                data.boolval = *(const jj_jsontype_bool*)p;
+                sjj_tostr_jbool(strbuf, data, d, config, inarr);
+                break;
+            case JJ_FIELD_INT:
+                data.intval = *(const jj_jsontype_int*)p;
+                sjj_tostr_jint(strbuf, data, d, config, inarr);
+                break;
+            case JJ_FIELD_FLOAT:
+                data.floatval = *(const jj_jsontype_float*)p;
+                sjj_tostr_jfloat(strbuf, data, d, config, inarr);
+                break;
+            case JJ_FIELD_STR:
+                data.strval = *(char* const*)p;
+                if (data.strval) {
+                    sjj_tostr_jstr(strbuf, data, d, config, inarr);
+                } else {
+                    sjj_tostr_jnull(strbuf, d, config, inarr);
+                }
+                break;
+            case JJ_FIELD_OBJ:
+                fr = (sjj_bind_frame){sc, NULL, p, 0, sc->nfields};
+                break;
+            case JJ_FIELD_ARR:
+                fr = (sjj_bind_frame){NULL, f, *(char* const*)p, 0,
+                                      *(const size_t*)(holder + f->countoff)};
+                if (fr.len && !ojj_bind_size(f->elem, f->schema)) {
+                    ret = 1;  // arrays of arrays are not bound
+                }
+                break;
+            default:
+                ret = 1;
+                break;
+        }
+        if (ret != 0) break;
+        if (fr.schema || fr.field) {
+            bool isarr = !fr.schema;
+            if (fr.len == 0) {
+                sjj_tostr_empty(strbuf, isarr ? "[]" : "{}", d, config, inarr);
+            } else {
+                if (n == cap && !ojj_bind_grow((void**)&stack, &cap, local,
+                                               sizeof(sjj_bind_frame))) {
+                    ret = 1;
+                    break;
+                }
+                sjj_tostr_open(strbuf, isarr ? '[' : '{', d, config, inarr);
+                stack[n++] = fr;
+            }
+        }
+        // the next field or element of the innermost container, closing
+        // those done
+        more = false;
+        while (n > 0 && !more) {
+            sjj_bind_frame* top = stack + n - 1;
+            if (top->count == top->len) {
+                sjj_tostr_close(strbuf, top->schema ? '}' : ']', (int)--n,
+                                config);
+                continue;
+            }
+            if (top->count) {
+                sjj_tostr_sep(strbuf, config);
+            }
+            if (top->schema) {
+                f = top->schema->fields + top->count++;
+                type = f->type;
+                p = top->base + f->offset;
+                holder = top->base;
+                name = (char*)f->name;
+            } else {
+                f = top->field;
+                type = f->elem;
+                p = top->base +
+                    top->count++ * ojj_bind_size(f->elem, f->schema);
+                holder = NULL;
+                name = NULL;
+            }
+            sc = f->schema;
+            inarr = !top->schema;
+            more = true;
         }
     }
-    return sjj_tostr_jdata(obj, strbuf, depth, config, inarr);
+    if (stack != local) free(stack);
+    return ret;
 }
 
-char* jj_tostr(jj_jsonobj* obj, jj_tostr_config* config) {
+char* jj_encode(const jj_schema* schema, const void* in,
+                jj_tostr_config* config) {
     charvec* strbuf = charvec_new(30);
-    int ret = sjj_tostr(obj, strbuf, 0, config, false);
-    if (ret != 0) {
+    if (!strbuf) {
+        return NULL;
+    }
+    if (sjj_bind_walk(schema, in, strbuf, config) != 0) {
         charvec_free(strbuf);
         return NULL;
     }
@@ -640,3 +4855,284 @@ char* jj_tostr(jj_jsonobj* obj, jj_tostr_config* config) {
     charvec_free(strbuf);
     return str;
 }
+
+// ***************************** paths *****************************
+
+// `name` as an array index: digits with no leading 0, or SIZE_MAX.
+static size_t ojj_path_index(const char* name, size_t len) {
+    if (len == 0 || (name[0] == '0' && len > 1)) {
+        return SIZE_MAX;
+    }
+    size_t idx = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (!UJJ_CHAR_IS(name[i], UJJ_CC_DIGIT)) {
+            return SIZE_MAX;
+        }
+        size_t d = (size_t)(name[i] - '0');
+        if (idx > (SIZE_MAX - 1 - d) / 10) {
+            return SIZE_MAX;
+        }
+        idx = idx * 10 + d;
+    }
+    return idx;
+}
+
+jj_path* jj_path_compile(const char* pointer) {
+    if (!pointer || (*pointer != 0 && *pointer != '/')) {
+        return NULL;
+    }
+    size_t nsegs = 0, len = strlen(pointer);
+    for (const char* p = pointer; *p; p++) {
+        nsegs += *p == '/';
+    }
+    // the path, its segments and their names in one block. Names take no
+    // more than the text they are unescaped from, with its '/' for their NUL.
+    jj_path* path =
+        malloc(sizeof(jj_path) + nsegs * sizeof(ojj_pathseg) + len + 1);
+    if (!path) {
+        return NULL;
+    }
+    path->nsegs = nsegs;
+    path->segs = (ojj_pathseg*)(path + 1);
+    char* names = (char*)(path->segs + nsegs);
+    const char* p = pointer;
+    for (size_t i = 0; i < nsegs; i++) {
+        p++;  // the '/'
+        char* name = names;
+        while (*p && *p != '/') {
+            if (*p != '~') {
+                *names++ = *p++;
+                continue;
+            }
+            if (p[1] != '0' && p[1] != '1') {
+                free(path);
+                return NULL;
+            }
+            *names++ = p[1] == '0' ? '~' : '/';
+            p += 2;
+        }
+        size_t n = names - name;
+        *names++ = 0;
+        path->segs[i] = (ojj_pathseg){name, n, ojj_hash(name, n),
+                                      ojj_path_index(name, n)};
+    }
+    return path;
+}
+
+void jj_path_free(jj_path* path) { free(path); }
+
+// the value `seg` leads to from `node`. Members are told apart by the hash
+// kept with their names before any byte is compared.
+static jj_jsonobj* ojj_path_step(jj_jsonobj* node, const ojj_pathseg* seg) {
+    if (node->type == JJ_VALTYPE_ARR) {
+        jj_jsonarrdata* arr = node->data.arrval;
+        return seg->idx < arr->length ? arr->arr + seg->idx : NULL;
+    }
+    if (node->type != JJ_VALTYPE_OBJ) {
+        return NULL;
+    }
+    jj_jsonobjdata* obj = node->data.objval;
+    if (obj->index) {
+        ojj_objslot* slot =
+            ojj_objfind_index(obj, seg->name, seg->len, seg->hash);
+        return slot ? obj->members + slot->pos : NULL;
+    }
+    for (size_t i = 0; i < obj->length; i++) {
+        ojj_key* k = OJJ_KEY(obj->names[i]);
+        if (k->hash == seg->hash && k->len == seg->len &&
+            memcmp(k->str, seg->name, seg->len) == 0) {
+            return obj->members + i;
+        }
+    }
+    return NULL;
+}
+
+jj_jsonobj* jj_path_get(jj_jsonobj* root, const jj_path* path) {
+    if (!path) {
+        return NULL;
+    }
+    jj_jsonobj* node = root;
+    for (size_t i = 0; node && i < path->nsegs; i++) {
+        node = ojj_path_step(node, path->segs + i);
+    }
+    return node;
+}
+
+typedef struct ojj_pathref {
+    const jj_path* path;
+    size_t i;  // in `paths`
+} ojj_pathref;
+
+// orders paths by their segments, a path before those it is a prefix of, so
+// that paths sharing steps are next to each other.
+static int ojj_pathset_cmp(const void* a, const void* b) {
+    const jj_path* p = ((const ojj_pathref*)a)->path;
+    const jj_path* q = ((const ojj_pathref*)b)->path;
+    for (size_t i = 0; i < p->nsegs && i < q->nsegs; i++) {
+        const ojj_pathseg* s = p->segs + i;
+        const ojj_pathseg* t = q->segs + i;
+        if (s->len != t->len) {
+            return s->len < t->len ? -1 : 1;
+        }
+        int c = memcmp(s->name, t->name, s->len);
+        if (c != 0) {
+            return c;
+        }
+    }
+    if (p->nsegs != q->nsegs) {
+        return p->nsegs < q->nsegs ? -1 : 1;
+    }
+    // keeps qsort from reordering equal paths between runs
+    size_t i = ((const ojj_pathref*)a)->i, j = ((const ojj_pathref*)b)->i;
+    return i < j ? -1 : i > j;
+}
+
+// the number of leading segments `p` and `q` share.
+static size_t ojj_path_common(const jj_path* p, const jj_path* q) {
+    size_t i = 0;
+    while (i < p->nsegs && i < q->nsegs && p->segs[i].len == q->segs[i].len &&
+           memcmp(p->segs[i].name, q->segs[i].name, p->segs[i].len) == 0) {
+        i++;
+    }
+    return i;
+}
+
+// lays out the trie of the paths of `set` in preorder: each path in sorted
+// order adds the steps it does not share with the one before.
+static bool ojj_pathset_build(jj_pathset* set) {
+    size_t nsegs = 0;
+    for (size_t i = 0; i < set->npaths; i++) {
+        nsegs += set->paths[i]->nsegs;
+        if (set->paths[i]->nsegs > set->maxdepth) {
+            set->maxdepth = set->paths[i]->nsegs;
+        }
+    }
+    ojj_pathref* sorted = malloc(sizeof(ojj_pathref) * (set->npaths + 1));
+    // the node of each depth on the way to the current path
+    size_t* chain = malloc(sizeof(size_t) * (set->maxdepth + 1));
+    set->nodes = malloc(sizeof(ojj_pathnode) * (nsegs + 1));
+    set->order = malloc(sizeof(size_t) * (set->npaths + 1));
+    if (!sorted || !chain || !set->nodes || !set->order) {
+        free(sorted);
+        free(chain);
+        return false;
+    }
+    for (size_t i = 0; i < set->npaths; i++) {
+        sorted[i] = (ojj_pathref){set->paths[i], i};
+    }
+    qsort(sorted, set->npaths, sizeof(ojj_pathref), ojj_pathset_cmp);
+    set->nodes[0] = (ojj_pathnode){NULL, 0, 0, 0, 0};
+    set->nnodes = 1;
+    chain[0] = 0;
+    for (size_t k = 0; k < set->npaths; k++) {
+        const jj_path* path = sorted[k].path;
+        size_t d = k ? ojj_path_common(sorted[k - 1].path, path) : 0;
+        for (; d < path->nsegs; d++) {
+            chain[d + 1] = set->nnodes;
+            set->nodes[set->nnodes++] =
+                (ojj_pathnode){path->segs + d, d + 1, 0, 0, 0};
+        }
+        // equal paths are next to each other, so they end on the same node
+        // with their places in `order` next to each other too
+        ojj_pathnode* end = set->nodes + chain[path->nsegs];
+        if (end->count++ == 0) {
+            end->first = k;
+        }
+        set->order[k] = sorted[k].i;
+    }
+    // the subtree of a node goes on until the next one that is not deeper,
+    // found with `chain` as a stack of the nodes still open
+    size_t top = 0;
+    for (size_t i = 1; i < set->nnodes; i++) {
+        while (top > 0 && set->nodes[chain[top - 1]].depth >=
+                              set->nodes[i].depth) {
+            set->nodes[chain[--top]].end = i;
+        }
+        chain[top++] = i;
+    }
+    while (top > 0) {
+        set->nodes[chain[--top]].end = set->nnodes;
+    }
+    set->nodes[0].end = set->nnodes;
+    free(sorted);
+    free(chain);
+    return true;
+}
+
+jj_pathset* jj_pathset_compile(const char* const* pointers, size_t n) {
+    if (!pointers && n) {
+        return NULL;
+    }
+    jj_pathset* set = calloc(1, sizeof(jj_pathset));
+    if (!set) {
+        return NULL;
+    }
+    set->paths = calloc(n + 1, sizeof(jj_path*));
+    if (!set->paths) {
+        free(set);
+        return NULL;
+    }
+    for (; set->npaths < n; set->npaths++) {
+        set->paths[set->npaths] = jj_path_compile(pointers[set->npaths]);
+        if (!set->paths[set->npaths]) {
+            jj_pathset_free(set);
+            return NULL;
+        }
+    }
+    if (!ojj_pathset_build(set)) {
+        jj_pathset_free(set);
+        return NULL;
+    }
+    return set;
+}
+
+void jj_pathset_free(jj_pathset* set) {
+    if (!set) return;
+    for (size_t i = 0; i < set->npaths; i++) {
+        jj_path_free(set->paths[i]);
+    }
+    free(set->paths);
+    free(set->nodes);
+    free(set->order);
+    free(set);
+}
+
+bool jj_pathset_get(jj_jsonobj* root, const jj_pathset* set,
+                    jj_jsonobj** results) {
+    if (!set) {
+        return false;
+    }
+    for (size_t i = 0; i < set->npaths; i++) {
+        results[i] = NULL;
+    }
+    // the value reached at each depth of the current branch of the trie
+    jj_jsonobj* local[32];
+    jj_jsonobj** at = local;
+    if (set->maxdepth + 1 > sizeof(local) / sizeof(local[0])) {
+        at = malloc(sizeof(jj_jsonobj*) * (set->maxdepth + 1));
+        if (!at) {
+            return false;
+        }
+    }
+    size_t i = 0;
+    while (i < set->nnodes) {
+        const ojj_pathnode* node = set->nodes + i;
+        jj_jsonobj* val = node->seg ? ojj_path_step(at[node->depth - 1],
+                                                    node->seg)
+                                    : root;
+        if (!val) {
+            // nothing below resolves either
+            i = node->end;
+            continue;
+        }
+        at[node->depth] = val;
+        for (size_t k = 0; k < node->count; k++) {
+            results[set->order[node->first + k]] = val;
+        }
+        i++;
+    }
+    if (at != local) {
+        free(at);
+    }
+    return true;
+}
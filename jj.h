@@ -5,11 +5,13 @@
 #include <errno.h>
 #include <memory.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "charvec.h"
 #include "hashmap.c/hashmap.h"
 
@@ -17,9 +19,24 @@ typedef struct hashmap hashmap;
 
 typedef uint16_t jj_valtype;
 
+// Whether floats are stored as `double` rather than `long double`. Nodes then
+// take 16 bytes instead of 32, as the union of their value no longer needs
+// the size and alignment of a long double. Floats are also parsed faster: with
+// long double, only those whose digits and power of ten are both exact are
+// converted while lexing, and the rest are copied out for `strtold`, while
+// doubles go through Eisel-Lemire and only reach `strtod` in its rare
+// ambiguous cases.
+#ifndef JJ_FLOAT_DOUBLE
+#define JJ_FLOAT_DOUBLE 0
+#endif
+
 typedef int64_t jj_jsontype_int;
 typedef char* jj_jsontype_str;
+#if JJ_FLOAT_DOUBLE
+typedef double jj_jsontype_float;
+#else
 typedef long double jj_jsontype_float;
+#endif
 typedef bool jj_jsontype_bool;
 
 #if defined(__GNUC__) || defined(__clang__)
@@ -28,6 +45,20 @@ typedef bool jj_jsontype_bool;
 #define UJJ_MAYBE_UNUSED
 #endif
 
+#if defined(_MSC_VER)
+#define UJJ_THREAD_LOCAL __declspec(thread)
+#else
+#define UJJ_THREAD_LOCAL _Thread_local
+#endif
+
+// loads a word other threads may store to concurrently. MSVC makes volatile
+// accesses atomic.
+#if defined(__GNUC__) || defined(__clang__)
+#define UJJ_ATOMIC_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#else
+#define UJJ_ATOMIC_LOAD(p) (*(volatile uint64_t*)(p))
+#endif
+
 #if !(defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || \
       defined(__NT__))
 #define strcpy_s(dest, destlen, src)       strcpy((dest), (src))
@@ -46,30 +77,56 @@ typedef bool jj_jsontype_bool;
 #define JJ_VALTYPE_STR   6
 
 typedef union jj_jsondata jj_jsondata;
-// if name is NULL, then it's root
 typedef struct jj_jsonobj jj_jsonobj;
 typedef struct jj_jsonarrdata jj_jsonarrdata;
+typedef struct jj_jsonobjdata jj_jsonobjdata;
 typedef struct jj_tostr_config jj_tostr_config;
+typedef struct jj_doc jj_doc;
+typedef struct jj_error jj_error;
+typedef struct jj_parser jj_parser;
+typedef struct jj_sax_callbacks jj_sax_callbacks;
+typedef struct jj_ndjson_config jj_ndjson_config;
+typedef struct jj_ondemand_doc jj_ondemand_doc;
+typedef struct jj_ondemand_val jj_ondemand_val;
+typedef struct jj_tape jj_tape;
+typedef struct jj_tape_val jj_tape_val;
+typedef struct jj_tape_iter jj_tape_iter;
+typedef struct jj_field jj_field;
+typedef struct jj_schema jj_schema;
+typedef struct jj_path jj_path;
+typedef struct jj_pathset jj_pathset;
 
 struct jj_jsonarrdata {
-    uint32_t length;
-    uint32_t cap;
+    size_t length;
+    size_t cap;
     struct jj_jsonobj* arr;
 };
 
+// An object keeps its members in insertion order, and their names next to
+// them rather than in the nodes. While it has at most OJJ_OBJ_FLATMAX of
+// them, names are looked up by comparing them one by one, which is cheaper
+// than hashing for so few; past that, `index` maps names to positions.
+struct jj_jsonobjdata {
+    size_t length;
+    size_t cap;
+    struct jj_jsonobj* members;
+    char** names;    // the `ojj_key` of each member
+    hashmap* index;  // NULL while the object is small
+};
+
 union jj_jsondata {
     UJJ_MAYBE_UNUSED jj_jsontype_int intval;
     UJJ_MAYBE_UNUSED jj_jsontype_str strval;
     UJJ_MAYBE_UNUSED jj_jsontype_float floatval;
     UJJ_MAYBE_UNUSED jj_jsontype_bool boolval;
-    UJJ_MAYBE_UNUSED hashmap* objval;
+    UJJ_MAYBE_UNUSED struct jj_jsonobjdata* objval;
     UJJ_MAYBE_UNUSED struct jj_jsonarrdata* arrval;
 };
 
+// A value. It has no name: those of members are kept by their object, so
+// that elements of arrays don't pay for one.
 struct jj_jsonobj {
     jj_valtype type;
-    char* name;
-
     union jj_jsondata data;
 };
 
@@ -80,47 +137,271 @@ struct jj_tostr_config {
     int indent;     /** number of spaces for indentation when formatted */
 };
 
+// what went wrong in a parse, see `jj_error`
+#define JJ_ERR_NONE     0
+#define JJ_ERR_SYNTAX   1  // a token is malformed, or not allowed where it is
+#define JJ_ERR_EOF      2  // the input ends before the document does
+#define JJ_ERR_TRAILING 3  // something follows the end of the document
+#define JJ_ERR_NOMEM    4  // failed to allocate
+#define JJ_ERR_DEPTH    5  // containers nest deeper than allowed
+#define JJ_ERR_UTF8     6  // the input is not valid UTF-8
+#define JJ_ERR_TYPE     7  // a value does not fit its field, see `jj_decode`
+
+// How deep containers may nest in a parsed document, unless set otherwise
+// for a `jj_parser`. Nesting costs no call stack when parsing, serializing
+// or freeing, so this only makes hostile documents fail fast.
+#ifndef JJ_MAX_DEPTH
+#define JJ_MAX_DEPTH 1024
+#endif
+
+// Whether parsed documents must be valid UTF-8, unless set otherwise for a
+// `jj_parser`. The check is a pass of its own over the whole input, before
+// it is indexed or lexed, with AVX2 when the CPU has it and otherwise a
+// scalar loop that skips ASCII 8 bytes at a time; there is no SSE2 kernel.
+// Invalid input is rejected with JJ_ERR_UTF8. Otherwise bytes of strings are
+// taken as they are.
+#ifndef JJ_CHECK_UTF8
+#define JJ_CHECK_UTF8 0
+#endif
+
+// Whether names of members are hashed with xxh3 rather than SipHash, both
+// from hashmap.c. xxh3 is several times faster on short names, SipHash is
+// harder to flood with colliding names. Either is seeded once per process
+// from the random source of the system, unless JJ_HASH_SEED is defined to a
+// fixed nonzero seed.
+#ifndef JJ_HASH_XXH3
+#define JJ_HASH_XXH3 0
+#endif
+
+// the kind of token an error is at, see `jj_error`
+#define JJ_TOKKIND_EOF     0  // the end of the input
+#define JJ_TOKKIND_PUNCT   1  // one of "{}[]:,"
+#define JJ_TOKKIND_STR     2  // a string or key
+#define JJ_TOKKIND_NUM     3  // a number
+#define JJ_TOKKIND_LITERAL 4  // true, false or null, or what starts like one
+#define JJ_TOKKIND_OTHER   5  // any other char
+
+// Why a parse failed. It is filled without any I/O; nothing in the parse path
+// prints, so it is up to the caller to report or ignore errors.
+struct jj_error {
+    int code;      /** one of JJ_ERR_* */
+    size_t offset; /** byte offset of the token at fault in the input */
+    size_t line;   /** line of `offset`, from 1; 0 if not known */
+    size_t col;    /** byte column of `offset`, from 1; 0 if not known */
+    int token;     /** kind of the token at fault, one of JJ_TOKKIND_* */
+};
+
+// A document whose nodes, names, strings, arrays and hashmaps all live in one
+// arena. Nodes of a doc are read-only: they must not be modified or passed to
+// `jj_free`. Release them all at once with `jj_doc_reset` or `jj_doc_free`.
+struct jj_doc {
+    arena* arena;
+    jj_jsonobj* root;
+    jj_error err;  // why the last parse into the doc failed
+};
+
+// The arena that node allocations currently go to, or NULL for the heap. Only
+// set while a document is being built into a `jj_doc`.
+extern UJJ_THREAD_LOCAL arena* ojj_cur_arena;
+
+static inline void* ojj_malloc(size_t size) {
+    if (ojj_cur_arena) {
+        return arena_alloc(ojj_cur_arena, size);
+    }
+    return malloc(size);
+}
+
+static inline void* ojj_realloc(void* p, size_t oldsize, size_t newsize) {
+    if (ojj_cur_arena) {
+        return arena_realloc(ojj_cur_arena, p, oldsize, newsize);
+    }
+    return realloc(p, newsize);
+}
+
+// memory in an arena is only released with the arena itself.
+static inline void ojj_free(void* p) {
+    if (ojj_cur_arena) {
+        return;
+    }
+    free(p);
+}
+
+// hashmap.c only hands the pointer to its allocator, so arena allocations made
+// on its behalf carry their size in front of the block for `ojj_hm_realloc`.
+#define OJJ_HM_HDRSIZE ARENA_ALIGN
+
+static void* ojj_hm_malloc(size_t size) {
+    if (!ojj_cur_arena) {  // a doc's hashmap being grown outside of parsing
+        return NULL;
+    }
+    char* p = arena_alloc(ojj_cur_arena, size + OJJ_HM_HDRSIZE);
+    if (!p) {
+        return NULL;
+    }
+    *(size_t*)p = size;
+    return p + OJJ_HM_HDRSIZE;
+}
+
+static void* ojj_hm_realloc(void* p, size_t size) {
+    if (!p) {
+        return ojj_hm_malloc(size);
+    }
+    size_t oldsize = *(size_t*)((char*)p - OJJ_HM_HDRSIZE);
+    if (size <= oldsize) {
+        return p;
+    }
+    void* np = ojj_hm_malloc(size);
+    if (!np) {
+        return NULL;
+    }
+    memcpy(np, p, oldsize);
+    return np;
+}
+
+static void ojj_hm_free(UJJ_MAYBE_UNUSED void* p) {}
+
+// the seed of `ojj_hash`, 0 until first used. Set once, atomically.
+extern uint64_t ojj_hash_seed;
+uint64_t ojj_hash_seed_init(void);
+
+// hashes a name of `len` bytes. The seed is the same for every hashmap, so the
+// hash of a name can be kept with it.
+static inline uint64_t ojj_hash(const char* s, size_t len) {
+    uint64_t seed = UJJ_ATOMIC_LOAD(&ojj_hash_seed);
+    if (!seed) {
+        seed = ojj_hash_seed_init();
+    }
+#if JJ_HASH_XXH3
+    return hashmap_xxhash3(s, len, seed, seed);
+#else
+    return hashmap_sip(s, len, seed, seed);
+#endif
+}
+
+// The name of a member, with its length and hash so that hashmaps never go
+// over its bytes but to tell apart names with the same hash. The parser
+// interns them: the members of a document with the same name share one. A
+// document is freed from one thread, so `refs` is not atomic.
+typedef struct ojj_key {
+    uint64_t hash;  // `ojj_hash` of `str`
+    size_t len;
+    size_t refs;  // members named by it, and the intern table that holds it
+    char str[];
+} ojj_key;
+
+#define OJJ_KEY(name) ((ojj_key*)((name) - offsetof(ojj_key, str)))
+
+// returns the `str` of a new key for `s`, with one reference.
+static inline char* ojj_key_new(const char* s, size_t len, uint64_t hash) {
+    ojj_key* k = (ojj_key*)ojj_malloc(sizeof(ojj_key) + len + 1);
+    if (!k) {
+        return NULL;
+    }
+    k->hash = hash;
+    k->len = len;
+    k->refs = 1;
+    memcpy(k->str, s, len);
+    k->str[len] = 0;
+    return k->str;
+}
+
+// drops a reference to the key of `name`, freeing it with the last one.
+static inline void ojj_key_release(char* name) {
+    if (!name || ojj_cur_arena) {
+        return;
+    }
+    ojj_key* k = OJJ_KEY(name);
+    if (--k->refs == 0) {
+        free(k);
+    }
+}
+
 // don't free subelements of json structure. only free the root.
 void ojj_free_innerval(jj_jsonobj* obj);
 void jj_free(jj_jsonobj* root);
-void ojj_objfree(hashmap* root);
+void ojj_objfree(jj_jsonobjdata* obj);
 void ojj_arrfree(jj_jsonarrdata* arr);
 
-static uint64_t ojj_hm_hash_func(const void* item, uint64_t seed0,
-                                 uint64_t seed1) {
-    const jj_jsonobj* j = (const jj_jsonobj*)item;
-    return hashmap_sip(j->name, strlen(j->name), seed0, seed1);
+#define OJJ_OBJ_FLATMAX 8
+#define OJJ_OBJ_NOTFOUND SIZE_MAX
+
+// an entry of the index of a large object. The hash and the length of the
+// name are kept in it, so the hashmap never goes over the bytes of names but
+// to tell apart those with the same hash.
+typedef struct ojj_objslot {
+    uint64_t hash;
+    size_t len;
+    const char* name;
+    size_t pos;  // of the member in `members`
+} ojj_objslot;
+
+static uint64_t ojj_hm_hash_func(const void* item,
+                                 UJJ_MAYBE_UNUSED uint64_t seed0,
+                                 UJJ_MAYBE_UNUSED uint64_t seed1) {
+    return ((const ojj_objslot*)item)->hash;
 }
 
 static int ojj_hm_comp_func(const void* a, const void* b,
                             UJJ_MAYBE_UNUSED void* udata) {
-    const jj_jsonobj* j1 = (const jj_jsonobj*)a;
-    const jj_jsonobj* j2 = (const jj_jsonobj*)b;
-    return strcmp(j1->name, j2->name);
+    const ojj_objslot* s1 = (const ojj_objslot*)a;
+    const ojj_objslot* s2 = (const ojj_objslot*)b;
+    if (s1->hash != s2->hash || s1->len != s2->len) {
+        return 1;
+    }
+    return s1->name == s2->name ? 0 : memcmp(s1->name, s2->name, s1->len);
 }
 
-static void ojj_hm_free_func(void* v) {
-    jj_jsonobj* j = (jj_jsonobj*)v;
-    ojj_free_innerval(j);
+// the index of an object about to have more than OJJ_OBJ_FLATMAX members.
+static inline hashmap* ojj_new_objindex(size_t cap) {
+    if (ojj_cur_arena) {
+        return hashmap_new_with_allocator(
+            ojj_hm_malloc, ojj_hm_realloc, ojj_hm_free, sizeof(ojj_objslot),
+            cap, 0, 0, ojj_hm_hash_func, ojj_hm_comp_func, NULL, NULL);
+    }
+    return hashmap_new(sizeof(ojj_objslot), cap, 0, 0, ojj_hm_hash_func,
+                       ojj_hm_comp_func, NULL, NULL);
 }
 
-static inline hashmap* ojj_new_hashmap() {
-    return hashmap_new(sizeof(jj_jsonobj), 0, 0, 0, ojj_hm_hash_func,
-                       ojj_hm_comp_func, ojj_hm_free_func, NULL);
+// members are allocated with the first one.
+static inline jj_jsonobjdata* ojj_newobjdata(void) {
+    jj_jsonobjdata* objdata = ojj_malloc(sizeof(jj_jsonobjdata));
+    if (!objdata) {
+        return NULL;
+    }
+    objdata->length = 0;
+    objdata->cap = 0;
+    objdata->members = NULL;
+    objdata->names = NULL;
+    objdata->index = NULL;
+    return objdata;
 }
 
-static inline void ojj_hashmap_free(hashmap* map) { hashmap_free(map); }
+// copies `val` into `obj` as the member named by the `ojj_key` `name`, in
+// place of the member of the same name if any, and returns the member. Takes
+// the reference to `name` unless it fails to allocate, and returns NULL.
+jj_jsonobj* ojj_objput(jj_jsonobjdata* obj, char* name, const jj_jsonobj* val);
+
+// makes room in `obj` for `n` members in all.
+int ojj_objreserve(jj_jsonobjdata* obj, size_t n);
 
 static inline jj_jsonarrdata* ojj_newarrdata(size_t cap) {
-    jj_jsonarrdata* arrdata = malloc(sizeof(jj_jsonarrdata));
+    jj_jsonarrdata* arrdata = ojj_malloc(sizeof(jj_jsonarrdata));
+    if (!arrdata) {
+        return NULL;
+    }
     arrdata->length = 0;
     arrdata->cap = cap;
-    arrdata->arr = malloc(sizeof(jj_jsonobj) * cap);
+    arrdata->arr = cap ? ojj_malloc(sizeof(jj_jsonobj) * cap) : NULL;
+    if (cap && !arrdata->arr) {
+        ojj_free(arrdata);
+        return NULL;
+    }
     return arrdata;
 }
 
 static inline int ojj_arrresize(jj_jsonarrdata* arr, size_t size) {
-    jj_jsonobj* new = realloc(arr->arr, size * sizeof(jj_jsonobj));
+    jj_jsonobj* new = ojj_realloc(arr->arr, arr->cap * sizeof(jj_jsonobj),
+                                  size * sizeof(jj_jsonobj));
     if (!new) {
         return -1;
     }
@@ -129,19 +410,26 @@ static inline int ojj_arrresize(jj_jsonarrdata* arr, size_t size) {
     return 0;
 }
 
+// copies `val` to the end of `arr`, and returns the element, or NULL if
+// failed to grow.
+static inline jj_jsonobj* ojj_arrpush(jj_jsonarrdata* arr,
+                                      const jj_jsonobj* val) {
+    if (arr->length == arr->cap) {
+        if (ojj_arrresize(arr, (arr->length + 1) << 1) != 0) {
+            return NULL;
+        }
+    }
+    jj_jsonobj* elem = arr->arr + arr->length++;
+    *elem = *val;
+    return elem;
+}
+
 // takes ownership of obj.
 static inline int ojj_arrappend(jj_jsonarrdata* arr, jj_jsonobj* obj) {
-    if (!obj) {
+    if (!obj || !ojj_arrpush(arr, obj)) {
         return -1;
     }
-    if (arr->length + 1 >= arr->cap) {
-        if (ojj_arrresize(arr, (arr->length + 1) << 1) != 0) {
-            return -1;
-        }
-    }
-    memcpy(arr->arr + arr->length, obj, sizeof(jj_jsonobj));
-    arr->length++;
-    free(obj);  // since I make a shallow copy of it
+    ojj_free(obj);  // since I make a shallow copy of it
     return 0;
 }
 
@@ -154,6 +442,15 @@ static inline jj_jsontype_str ujj_clonestr(jj_jsontype_str orig, size_t len) {
     return s;
 }
 
+// same as `ujj_clonestr`, but allocated for a node of the current document.
+static inline jj_jsontype_str ojj_clonestr(const char* orig, size_t len) {
+    jj_jsontype_str s = ojj_malloc(len + 1);
+    if (!s) return NULL;
+    memcpy(s, orig, len);
+    s[len] = 0;
+    return s;
+}
+
 #define OJJ_MALLOC_NEW_JSONOBJ()             \
     (jj_jsonobj*)malloc(sizeof(jj_jsonobj)); \
     if (!val) {                              \
@@ -162,49 +459,29 @@ static inline jj_jsontype_str ujj_clonestr(jj_jsontype_str orig, size_t len) {
 
 // ***************************** exposed apis *****************************
 
-UJJ_MAYBE_UNUSED static inline bool jj_is_json_root(jj_jsonobj* json) {
-    return json->name == NULL;
-}
-
 UJJ_MAYBE_UNUSED static inline bool jj_is_json_type(jj_jsonobj* json,
                                                     jj_valtype type) {
     if (!json) return false;
     return json->type == type;
 }
 
-// Sets name for a json object. Creates a new copy of `name`.
-static inline void jj_setname(jj_jsonobj* json, const char* const name) {
-    free(json->name);
-    if (!name) {
-        json->name = NULL;
-        return;
-    }
-    size_t len = strlen(name);
-    char* buf = malloc(len + 1);
-    strcpy_s(buf, len + 1, name);
-    json->name = buf;
-}
-
 #define OJJ_GENFUNC_NEWOBJ(ty, valtype)                         \
     UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_new_json##ty( \
-        const char* name, jj_jsontype_##ty v) {                 \
-        jj_jsonobj* obj = jj_new_empty_obj(name);               \
+        jj_jsontype_##ty v) {                                   \
+        jj_jsonobj* obj = jj_new_empty_obj();                   \
+        if (!obj) return NULL;                                  \
         obj->type = valtype;                                    \
         obj->data.ty##val = v;                                  \
         return obj;                                             \
     }
 
-#define OJJ_JSONOBJ_INIT_SETNAME(val, name) \
-    (val)->name = NULL;                     \
-    if (name) jj_setname((val), (name));
-
-// if name is NULL then it's root
-UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_new_empty_obj(const char* name) {
-    jj_jsonobj* val = (jj_jsonobj*)malloc(sizeof(jj_jsonobj));
+// a node of type null. It is named by the object it is put in, if any.
+UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_new_empty_obj(void) {
+    jj_jsonobj* val = (jj_jsonobj*)ojj_malloc(sizeof(jj_jsonobj));
     if (!val) {
         return NULL;
     }
-    OJJ_JSONOBJ_INIT_SETNAME(val, name);
+    val->type = JJ_VALTYPE_NULL;
     return val;
 }
 
@@ -214,50 +491,83 @@ OJJ_GENFUNC_NEWOBJ(float, JJ_VALTYPE_FLOAT)
 // Takes ownership of `s`. If you want to put a copy of the string in the
 // new object, use `jj_new_jsonstr` instead.
 UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_new_jsonstrref(
-    const char* name, jj_jsontype_str v) {
-    jj_jsonobj* obj = jj_new_empty_obj(name);
+    jj_jsontype_str v) {
+    jj_jsonobj* obj = jj_new_empty_obj();
+    if (!obj) return NULL;
     obj->type = JJ_VALTYPE_STR;
     obj->data.strval = v;
     return obj;
 }
 // Copies `s` with specific length. If you want the new object to take ownership
 // of the string, use `jj_new_jsonstrref` instead.
-UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_new_jsonstrn(const char* name,
-                                                           jj_jsontype_str v,
+UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_new_jsonstrn(jj_jsontype_str v,
                                                            size_t len) {
-    jj_jsontype_str s = ujj_clonestr(v, len);
-    return jj_new_jsonstrref(name, s);
+    jj_jsontype_str s = ojj_clonestr(v, len);
+    return jj_new_jsonstrref(s);
 }
 // Copies `s`. If you want the new object to take ownership of the string,
 // use `jj_new_jsonstrref` instead.
-UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_new_jsonstr(const char* name,
-                                                          jj_jsontype_str v) {
-    return jj_new_jsonstrn(name, v, strlen(v));
+UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_new_jsonstr(jj_jsontype_str v) {
+    return jj_new_jsonstrn(v, strlen(v));
 }
-UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_new_jsonnull(const char* name) {
-    jj_jsonobj* val = jj_new_empty_obj(name);
-    val->type = JJ_VALTYPE_NULL;
-    return val;
+UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_new_jsonnull(void) {
+    return jj_new_empty_obj();
 }
-UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_new_jsonobj(const char* name) {
-    jj_jsonobj* val = jj_new_empty_obj(name);
+UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_new_jsonobj(void) {
+    jj_jsonobj* val = jj_new_empty_obj();
+    if (!val) return NULL;
     val->type = JJ_VALTYPE_OBJ;
-    val->data.objval = ojj_new_hashmap();
+    val->data.objval = ojj_newobjdata();
+    if (!val->data.objval) {
+        ojj_free(val);
+        return NULL;
+    }
     return val;
-};
-UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_new_jsonarr(const char* name) {
-    jj_jsonobj* val = jj_new_empty_obj(name);
+}
+UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_new_jsonarr(void) {
+    jj_jsonobj* val = jj_new_empty_obj();
+    if (!val) return NULL;
     val->type = JJ_VALTYPE_ARR;
     val->data.arrval = ojj_newarrdata(3);
+    if (!val->data.arrval) {
+        ojj_free(val);
+        return NULL;
+    }
     return val;
-};
+}
 
-// takes ownership of `val`
-UJJ_MAYBE_UNUSED void jj_oput(jj_jsonobj* obj, jj_jsonobj* val);
+// takes ownership of `val`, and puts it as the member `name`, which is copied.
+UJJ_MAYBE_UNUSED void jj_oput(jj_jsonobj* obj, const char* name,
+                              jj_jsonobj* val);
 UJJ_MAYBE_UNUSED jj_jsonobj* jj_oget(jj_jsonobj* obj, const char* name);
 
+// the number of members of `obj`, or 0 if it is not an object.
+UJJ_MAYBE_UNUSED static inline size_t jj_olen(jj_jsonobj* obj) {
+    if (!jj_is_json_type(obj, JJ_VALTYPE_OBJ)) {
+        return 0;
+    }
+    return obj->data.objval->length;
+}
+
+// Goes over the members of an object in the order they were put, without
+// allocating. Start with `*i` at 0; returns false past the last member.
+//     size_t i = 0;
+//     const char* name;
+//     jj_jsonobj* member;
+//     while (jj_oiter(obj, &i, &name, &member)) { ... }
+UJJ_MAYBE_UNUSED static inline bool jj_oiter(jj_jsonobj* obj, size_t* i,
+                                             const char** name,
+                                             jj_jsonobj** member) {
+    if (*i >= jj_olen(obj)) {
+        return false;
+    }
+    *name = obj->data.objval->names[*i];
+    *member = obj->data.objval->members + (*i)++;
+    return true;
+}
+
 UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_aget(jj_jsonobj* obj,
-                                                   uint32_t idx) {
+                                                   size_t idx) {
     if (!jj_is_json_type(obj, JJ_VALTYPE_ARR)) {
         return NULL;
     }
@@ -266,7 +576,7 @@ UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_aget(jj_jsonobj* obj,
 
 #define OJJ_GENFUNC_AGET_ASTYPE(type, valtype)                       \
     UJJ_MAYBE_UNUSED static inline bool jj_aget##type(               \
-        jj_jsonobj* obj, uint32_t idx, jj_jsontype_##type* result) { \
+        jj_jsonobj* obj, size_t idx, jj_jsontype_##type* result) {   \
         jj_jsonobj* ref = jj_aget(obj, idx);                         \
         if (!jj_is_json_type(ref, valtype)) {                        \
             return false;                                            \
@@ -280,7 +590,7 @@ OJJ_GENFUNC_AGET_ASTYPE(float, JJ_VALTYPE_FLOAT)
 OJJ_GENFUNC_AGET_ASTYPE(bool, JJ_VALTYPE_BOOL)
 // returns a reference of string for this object, or NULL if not of type string.
 UJJ_MAYBE_UNUSED static inline jj_jsontype_str jj_agetstrref(jj_jsonobj* obj,
-                                                             uint32_t idx) {
+                                                             size_t idx) {
     jj_jsonobj* ref = jj_aget(obj, idx);
     if (!jj_is_json_type(ref, JJ_VALTYPE_STR)) {
         return NULL;
@@ -290,7 +600,7 @@ UJJ_MAYBE_UNUSED static inline jj_jsontype_str jj_agetstrref(jj_jsonobj* obj,
 // returns a newly allocated string, or NULL if failed.
 // If you just want a reference, use `jj_agetstrref` instead.
 UJJ_MAYBE_UNUSED static inline jj_jsontype_str jj_agetstr(jj_jsonobj* obj,
-                                                          uint32_t idx) {
+                                                          size_t idx) {
     jj_jsontype_str s = jj_agetstrref(obj, idx);
     return ujj_clonestr(s, strlen(s));
 }
@@ -305,6 +615,153 @@ UJJ_MAYBE_UNUSED static inline bool jj_aappend(jj_jsonobj* obj,
     return ojj_arrappend(obj->data.arrval, val) == 0;
 }
 
+// Builders that construct the new value straight in the storage of its
+// container, rather than in a node of its own that is copied in and freed.
+// Scalars return false if the container is not of the right type or failed
+// to allocate. Objects and arrays return the new container, which stays
+// valid until the next value is added to its parent, or NULL.
+//     jj_jsonobj* user = jj_aappend_obj(users);
+//     jj_oput_int(user, "id", 42);
+//     jj_oput_str(user, "name", name, len);
+
+// copies `val` to the end of the array `obj`. Returns the element, or NULL
+// if `obj` is not an array or failed to allocate, leaving `val` to the
+// caller.
+UJJ_MAYBE_UNUSED static inline jj_jsonobj* ojj_aappendval(
+    jj_jsonobj* obj, const jj_jsonobj* val) {
+    if (!jj_is_json_type(obj, JJ_VALTYPE_ARR)) {
+        return NULL;
+    }
+    return ojj_arrpush(obj->data.arrval, val);
+}
+
+// same as `ojj_aappendval`, but puts `val` as the member `name` of the
+// object `obj`, with the name copied.
+jj_jsonobj* ojj_oputval(jj_jsonobj* obj, const char* name,
+                        const jj_jsonobj* val);
+
+#define OJJ_GENFUNC_BUILD_SCALAR(ty, valtype)                              \
+    UJJ_MAYBE_UNUSED static inline bool jj_aappend_##ty(                   \
+        jj_jsonobj* obj, jj_jsontype_##ty v) {                             \
+        jj_jsonobj val;                                                    \
+        val.type = valtype;                                                \
+        val.data.ty##val = v;                                              \
+        return ojj_aappendval(obj, &val) != NULL;                          \
+    }                                                                      \
+    UJJ_MAYBE_UNUSED static inline bool jj_oput_##ty(                      \
+        jj_jsonobj* obj, const char* name, jj_jsontype_##ty v) {           \
+        jj_jsonobj val;                                                    \
+        val.type = valtype;                                                \
+        val.data.ty##val = v;                                              \
+        return ojj_oputval(obj, name, &val) != NULL;                       \
+    }
+
+OJJ_GENFUNC_BUILD_SCALAR(bool, JJ_VALTYPE_BOOL)
+OJJ_GENFUNC_BUILD_SCALAR(int, JJ_VALTYPE_INT)
+OJJ_GENFUNC_BUILD_SCALAR(float, JJ_VALTYPE_FLOAT)
+
+UJJ_MAYBE_UNUSED static inline bool jj_aappend_null(jj_jsonobj* obj) {
+    jj_jsonobj val;
+    val.type = JJ_VALTYPE_NULL;
+    return ojj_aappendval(obj, &val) != NULL;
+}
+UJJ_MAYBE_UNUSED static inline bool jj_oput_null(jj_jsonobj* obj,
+                                                 const char* name) {
+    jj_jsonobj val;
+    val.type = JJ_VALTYPE_NULL;
+    return ojj_oputval(obj, name, &val) != NULL;
+}
+
+// Copies `len` bytes of `s`.
+UJJ_MAYBE_UNUSED static inline bool jj_aappend_str(jj_jsonobj* obj,
+                                                   const char* s, size_t len) {
+    jj_jsonobj val;
+    val.type = JJ_VALTYPE_STR;
+    val.data.strval = ojj_clonestr(s, len);
+    if (!val.data.strval || !ojj_aappendval(obj, &val)) {
+        ojj_free(val.data.strval);
+        return false;
+    }
+    return true;
+}
+// Copies `len` bytes of `s`.
+UJJ_MAYBE_UNUSED static inline bool jj_oput_str(jj_jsonobj* obj,
+                                                const char* name,
+                                                const char* s, size_t len) {
+    jj_jsonobj val;
+    val.type = JJ_VALTYPE_STR;
+    val.data.strval = ojj_clonestr(s, len);
+    if (!val.data.strval || !ojj_oputval(obj, name, &val)) {
+        ojj_free(val.data.strval);
+        return false;
+    }
+    return true;
+}
+
+// an empty object or array as a value, with room for `cap` members or
+// elements, and its data NULL if failed to allocate.
+static inline jj_jsonobj ojj_newcontainer(jj_valtype type, size_t cap) {
+    jj_jsonobj val;
+    val.type = type;
+    if (type == JJ_VALTYPE_ARR) {
+        val.data.arrval = ojj_newarrdata(cap);
+        return val;
+    }
+    val.data.objval = ojj_newobjdata();
+    if (val.data.objval && cap && ojj_objreserve(val.data.objval, cap) != 0) {
+        ojj_objfree(val.data.objval);
+        val.data.objval = NULL;
+    }
+    return val;
+}
+
+UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_aappend_obj(jj_jsonobj* obj) {
+    jj_jsonobj val = ojj_newcontainer(JJ_VALTYPE_OBJ, 0);
+    jj_jsonobj* child = val.data.objval ? ojj_aappendval(obj, &val) : NULL;
+    if (!child) ojj_free(val.data.objval);
+    return child;
+}
+UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_aappend_arr(jj_jsonobj* obj) {
+    jj_jsonobj val = ojj_newcontainer(JJ_VALTYPE_ARR, 0);
+    jj_jsonobj* child = val.data.arrval ? ojj_aappendval(obj, &val) : NULL;
+    if (!child) ojj_free(val.data.arrval);
+    return child;
+}
+UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_oput_obj(jj_jsonobj* obj,
+                                                       const char* name) {
+    jj_jsonobj val = ojj_newcontainer(JJ_VALTYPE_OBJ, 0);
+    jj_jsonobj* child = val.data.objval ? ojj_oputval(obj, name, &val) : NULL;
+    if (!child) ojj_free(val.data.objval);
+    return child;
+}
+UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_oput_arr(jj_jsonobj* obj,
+                                                       const char* name) {
+    jj_jsonobj val = ojj_newcontainer(JJ_VALTYPE_ARR, 0);
+    jj_jsonobj* child = val.data.arrval ? ojj_oputval(obj, name, &val) : NULL;
+    if (!child) ojj_free(val.data.arrval);
+    return child;
+}
+
+// Makes room for `n` elements in all in the array `obj`, so that appending
+// up to them does not grow it. Returns false if `obj` is not an array or
+// failed to allocate.
+UJJ_MAYBE_UNUSED static inline bool jj_arr_reserve(jj_jsonobj* obj,
+                                                   size_t n) {
+    if (!jj_is_json_type(obj, JJ_VALTYPE_ARR)) {
+        return false;
+    }
+    jj_jsonarrdata* arr = obj->data.arrval;
+    return n <= arr->cap || ojj_arrresize(arr, n) == 0;
+}
+// Same as `jj_arr_reserve`, for `n` members of the object `obj`.
+UJJ_MAYBE_UNUSED static inline bool jj_obj_reserve(jj_jsonobj* obj,
+                                                   size_t n) {
+    if (!jj_is_json_type(obj, JJ_VALTYPE_OBJ)) {
+        return false;
+    }
+    return ojj_objreserve(obj->data.objval, n) == 0;
+}
+
 UJJ_MAYBE_UNUSED static inline bool jj_isnull(jj_jsonobj* obj) {
     return jj_is_json_type(obj, JJ_VALTYPE_NULL);
 }
@@ -352,6 +809,61 @@ UJJ_MAYBE_UNUSED static inline jj_jsonobj* jj_ogetarridx(jj_jsonobj* obj,
     return jj_aget(a, idx);
 }
 
+// ***************************** paths *****************************
+
+// a reference token of a `jj_path`, with what a lookup needs worked out
+typedef struct ojj_pathseg {
+    const char* name;  // unescaped, NULL terminated
+    size_t len;
+    uint64_t hash;  // `ojj_hash` of `name`
+    size_t idx;     // `name` as an array index, or SIZE_MAX if it is not one
+} ojj_pathseg;
+
+// A JSON Pointer (RFC 6901) compiled once, to be resolved any number of times
+// without going over its text again.
+struct jj_path {
+    size_t nsegs;
+    ojj_pathseg* segs;
+};
+
+// a step of the trie of a `jj_pathset`, in preorder
+typedef struct ojj_pathnode {
+    const ojj_pathseg* seg;  // NULL for the root
+    size_t depth;
+    size_t end;    // the node after its subtree
+    size_t first;  // in `order`, of the paths ending here
+    size_t count;
+} ojj_pathnode;
+
+// Paths compiled together, so that the steps they share are resolved once.
+struct jj_pathset {
+    jj_path** paths;
+    size_t npaths;
+    ojj_pathnode* nodes;
+    size_t nnodes;
+    size_t* order;  // indices of `paths`, sorted by their segments
+    size_t maxdepth;
+};
+
+// Compiles the JSON Pointer `pointer`, such as "/users/0/name", where "~1"
+// stands for '/' and "~0" for '~'. "" points to the root. Returns NULL if it
+// is NULL, malformed or failed to allocate.
+jj_path* jj_path_compile(const char* pointer);
+void jj_path_free(jj_path* path);
+// the value `path` points to from `root`, or NULL if there is none, or if
+// either is NULL.
+jj_jsonobj* jj_path_get(jj_jsonobj* root, const jj_path* path);
+
+// Compiles `n` JSON Pointers into one set, see `jj_path_compile`. Returns
+// NULL if any of them cannot be compiled.
+jj_pathset* jj_pathset_compile(const char* const* pointers, size_t n);
+void jj_pathset_free(jj_pathset* set);
+// Resolves all the paths of `set` from `root` in one walk, into `results` in
+// the order they were compiled, NULL where there is no value, or all NULL if
+// `root` is. Returns false if `set` is NULL or failed to allocate.
+bool jj_pathset_get(jj_jsonobj* root, const jj_pathset* set,
+                    jj_jsonobj** results);
+
 // ***************************** parsing *****************************
 
 typedef uint16_t ljj_token_type;
@@ -365,39 +877,105 @@ typedef uint16_t ljj_token_type;
 #define LJJ_TOKEN_INVALID 0x4000
 #define LJJ_TOKEN_EOF     0x8000
 
+typedef struct ljj_parser_frame {
+    jj_jsonobj node;  // the container being filled, not attached yet
+    char* key;  // `ojj_key` of the member being read, owned until attached
+    size_t hint;  // values counted for `node` by the pre-scan, 0 if unknown
+} ljj_parser_frame;
+
+// how many values a container is made room for at once from the count of the
+// pre-scan, which is taken before the input is validated
+#ifndef LJJ_HINT_STEP
+#define LJJ_HINT_STEP 4096
+#endif
+
+// the keys of the document being parsed, open addressed by hash
+typedef struct ljj_keytab {
+    ojj_key** slots;  // of `cap`, a power of 2, NULL where free
+    size_t cap;
+    size_t* used;  // the slots taken, in order, so clearing is cheap
+    size_t count;
+} ljj_keytab;
+
+// at most this many distinct keys are shared per document; later ones get a
+// key of their own.
+#define LJJ_KEYTAB_MAXKEYS (1 << 14)
+
 typedef struct ljj_lexstate {
     ljj_token_type curtoken;
-    bool instr;
-    uint32_t length;
+    size_t length;
     const char* original;
 
     size_t cur_idx;
-    size_t line;
-    size_t col;
+    size_t tokstart;  // where the current token starts
+
+    // value of the current LJJ_TOKEN_INT or LJJ_TOKEN_FLOAT token
+    union {
+        jj_jsontype_int intval;
+        jj_jsontype_float floatval;
+    };
     // char* strbuf;
     // size_t buflen;
     // size_t bufcap;
     charvec* strbuf;
+
+    // when not NULL, the writable alias of `original`: strings are decoded in
+    // place into it, from `strstart` up to `strend`, instead of into `strbuf`.
+    char* insitu;
+    size_t strstart;
+    size_t strend;
+
+    // structural index of `original`: the start of every token in order. When
+    // NULL, the lexer finds tokens by skipping whitespace char by char.
+    uint32_t* index;
+    size_t index_len;
+    size_t index_pos;
+    uint32_t* indexbuf;  // kept across inputs, of `index_cap` offsets
+    size_t index_cap;
+
+    // count of values of each container of the input, in the order they
+    // open, found from the index before parsing. Kept across inputs, of
+    // `sizes_cap` counts.
+    uint32_t* sizes;
+    size_t sizes_len;
+    size_t sizes_pos;
+    size_t sizes_cap;
+
+    jj_error* err;  // where errors are recorded, or NULL to ignore them
+    int errcode;    // a JJ_ERR_* found by the parser rather than the lexer
+
+    // containers being parsed, from the outermost one, and how deep they may
+    // nest. Kept across inputs, of `stackcap` frames.
+    ljj_parser_frame* stack;
+    size_t stackcap;
+    size_t max_depth;
+    bool check_utf8;  // if the input must be valid UTF-8
+
+    // keys interned for the document, released once it is parsed. Its slots
+    // are kept across inputs.
+    ljj_keytab keys;
+
+    // a container already parsed, between index entries `splice_open` and
+    // `splice_close`, to take instead of parsing it again
+    jj_jsonobj* splice;
+    size_t splice_open;
+    size_t splice_close;
 } ljj_lexstate;
 
 #define LJJ_LEXSTATE_CURCHAR(state) (state)->original[(state)->cur_idx]
 
 #define LJJ_LEXSTATE_ISINVALID(state) (((state)->curtoken & 0xC000))
 
-static inline bool ujj_is_char_oneof(ljj_token_type c, const char* chars) {
-    if (c > 255) {
-        return false;
-    }
-    for (int i = 0;; i++) {
-        if (chars[i] == '\0') {
-            break;
-        }
-        if (c == chars[i]) {
-            return true;
-        }
-    }
-    return false;
-}
+#define UJJ_CC_WS     0x01  // whitespace: " \t\r\n"
+#define UJJ_CC_STRUCT 0x02  // structural: "{}[]:,"
+#define UJJ_CC_TERM   0x04  // ends a scalar value: whitespace and "}],"
+#define UJJ_CC_ESC    0x08  // must be escaped in a string: '"', '\\', < 0x20
+#define UJJ_CC_DIGIT  0x10  // "0123456789"
+
+// UJJ_CC_* classes of every byte, shared by the lexer and the serializer.
+extern const uint8_t ujj_charclass[256];
+
+#define UJJ_CHAR_IS(c, cls) (ujj_charclass[(uint8_t)(c)] & (cls))
 
 // c cannot be NULL char (0).
 static inline bool ujj_str_contains_s(const char* s, size_t len, char c) {
@@ -415,79 +993,31 @@ static inline bool ujj_str_contains_s(const char* s, size_t len, char c) {
     return false;
 }
 
-static inline bool ujj_str_isjsonint(const char* s, const size_t len) {
-    size_t i = 0;
-    if (s[i] == '-') i++;
-    if (len - i > 19) {
-        return false;
-    }
-    if (s[i] == '0' && len != 1) {  // if not a single 0
-        return false;
-    }
-    // for (; i < len; i++) {
-    //     if (s[i] == 0) return true;
-    //     if (!isdigit(s[i])) return false;
-    // }
-    char* pend;
-    strtoll(s, &pend, 10);
-    if (errno == ERANGE) {
-        return false;
-    }
-    if (pend != s + len) {
-        return false;
-    }
-    return true;
-}
-
-static inline bool ujj_str_isvalidjsonfloat(const char* s, const size_t len) {
-    size_t i = 0;
-    if (s[i] == '-') i++;
-    while (i < len && isdigit(s[i])) {
-        i++;
-    }
-    if (s[i] == '.') {
-        i++;
-        while (i < len && isdigit(s[i])) {
-            i++;
-        }
-    }
-    if (i == len) {
-        return true;
-    }
-    if (!ujj_is_char_oneof(s[i], "eE")) {
-        return false;
-    }
-    i++;
-    if (ujj_is_char_oneof(s[i], "-+")) {
-        i++;
-    }
-    while (i < len && isdigit(s[i])) {
-        i++;
-    }
-    return i == len;
-}
-
-static inline bool ujj_unicode_to_utf8(charvec* strbuf, int c) {
-    if (c < 0x80)
-        charvec_append(strbuf, (char)c);
-    else if (c < 0x800) {
-        charvec_append(strbuf, (char)(192 + c / 64));
-        charvec_append(strbuf, (char)(128 + c % 64));
+// writes the utf-8 encoding of `c` to `out` (at least 4 bytes), and returns
+// the number of bytes written, or 0 if `c` is not a valid code point.
+static inline int ujj_unicode_to_utf8(char* out, int c) {
+    if (c < 0x80) {
+        out[0] = (char)c;
+        return 1;
+    } else if (c < 0x800) {
+        out[0] = (char)(192 + c / 64);
+        out[1] = (char)(128 + c % 64);
+        return 2;
     } else if (c - 0xd800u < 0x800) {
-        return false;
+        return 0;
     } else if (c < 0x10000) {
-        charvec_append(strbuf, (char)(224 + c / 4096));
-        charvec_append(strbuf, (char)(128 + c / 64 % 64));
-        charvec_append(strbuf, (char)(128 + c % 64));
+        out[0] = (char)(224 + c / 4096);
+        out[1] = (char)(128 + c / 64 % 64);
+        out[2] = (char)(128 + c % 64);
+        return 3;
     } else if (c < 0x110000) {
-        charvec_append(strbuf, (char)(240 + c / 262144));
-        charvec_append(strbuf, (char)(128 + c / 4096 % 64));
-        charvec_append(strbuf, (char)(128 + c / 64 % 64));
-        charvec_append(strbuf, (char)(128 + c % 64));
-    } else {
-        return false;
+        out[0] = (char)(240 + c / 262144);
+        out[1] = (char)(128 + c / 4096 % 64);
+        out[2] = (char)(128 + c / 64 % 64);
+        out[3] = (char)(128 + c % 64);
+        return 4;
     }
-    return true;
+    return 0;
 }
 
 /**
@@ -523,36 +1053,116 @@ static inline int ujj_utf8_to_unicode(unsigned char* s, uint8_t* readlen) {
 }
 
 static inline ljj_lexstate* ljj_new_lexstate(const char* original,
-                                             const uint32_t length) {
+                                             const size_t length) {
     ljj_lexstate* s = malloc(sizeof(ljj_lexstate));
     if (!s) {
         return NULL;
     }
     s->original = original;
     s->length = length;
-    s->line = 1;
-    s->col = 1;
     // s->buflen = 0;
     // s->bufcap = 15;
     // s->strbuf = malloc(s->bufcap);
     s->strbuf = charvec_new(15);
     s->cur_idx = 0;
+    s->tokstart = 0;
     s->curtoken = 0;
+    s->insitu = NULL;
+    s->strstart = 0;
+    s->strend = 0;
+    s->index = NULL;
+    s->index_len = 0;
+    s->index_pos = 0;
+    s->indexbuf = NULL;
+    s->index_cap = 0;
+    s->sizes = NULL;
+    s->sizes_len = 0;
+    s->sizes_pos = 0;
+    s->sizes_cap = 0;
+    s->err = NULL;
+    s->errcode = JJ_ERR_NONE;
+    s->stack = NULL;
+    s->stackcap = 0;
+    s->max_depth = JJ_MAX_DEPTH;
+    s->check_utf8 = JJ_CHECK_UTF8;
+    s->keys = (ljj_keytab){NULL, 0, NULL, 0};
+    s->splice = NULL;
+    s->splice_open = 0;
+    s->splice_close = 0;
     return s;
 }
 
+void ljj_keytab_clear(ljj_keytab* t);
+
 static inline void ljj_free_lexstate(ljj_lexstate* s) {
+    ljj_keytab_clear(&s->keys);
+    free(s->keys.slots);
+    free(s->keys.used);
     charvec_free(s->strbuf);
+    free(s->indexbuf);
+    free(s->sizes);
+    free(s->stack);
     free(s);
 }
 
-static inline void ljj_lexstate_nextchar(ljj_lexstate* s) {
-    if (!s->instr && s->original[s->cur_idx] == '\n') {
-        s->line++;
-        s->col = 0;
+// points `s` to a new input, keeping its buffers.
+static inline void ljj_lexstate_reset(ljj_lexstate* s, const char* original,
+                                      size_t length) {
+    s->original = original;
+    s->length = length;
+    s->cur_idx = 0;
+    s->tokstart = 0;
+    s->curtoken = 0;
+    s->strstart = 0;
+    s->strend = 0;
+    s->index = NULL;
+    s->index_len = 0;
+    s->index_pos = 0;
+    s->sizes_len = 0;
+    s->sizes_pos = 0;
+    s->errcode = JJ_ERR_NONE;
+    charvec_clear(s->strbuf);
+}
+
+// how many offsets of the index, or counts of sizes, are kept for the next
+// input at most, so that one large document does not pin its buffers
+#ifndef LJJ_KEEP_MAX
+#define LJJ_KEEP_MAX (1024 * 1024)
+#endif
+
+// frees the buffers kept across inputs that have grown past LJJ_KEEP_MAX.
+static inline void ljj_lexstate_trim(ljj_lexstate* s) {
+    if (s->index_cap > LJJ_KEEP_MAX) {
+        free(s->indexbuf);
+        s->indexbuf = NULL;
+        s->index_cap = 0;
+    }
+    if (s->sizes_cap > LJJ_KEEP_MAX) {
+        free(s->sizes);
+        s->sizes = NULL;
+        s->sizes_cap = 0;
+    }
+}
+
+static inline void ljj_lexstate_nextchar(ljj_lexstate* s) { s->cur_idx++; }
+
+// line and col (both starting from 1) of `offset`. Only used for reporting, so
+// lexing doesn't have to keep track of them.
+static inline void ljj_lexstate_linecol(ljj_lexstate* s, size_t offset,
+                                        size_t* line, size_t* col) {
+    size_t l = 1, linestart = 0;
+    if (offset > s->length) {
+        offset = s->length;
     }
-    s->cur_idx++;
-    s->col++;
+    const char* p = s->original;
+    const char* nl;
+    while (linestart < offset &&
+           (nl = memchr(p + linestart, '\n', offset - linestart)) != NULL) {
+        l++;
+        linestart = nl - p + 1;
+    }
+    *line = l;
+    *col = offset - linestart + 1;
 }
 
 static inline bool ljj_lexstate_isatend(ljj_lexstate* s) {
@@ -603,26 +1213,61 @@ static inline void ljj_lexstate_append_strbuf(ljj_lexstate* s, char c) {
     charvec_append(s->strbuf, c);
 }
 
-static inline void ljj_lexstate_err(ljj_lexstate* s) {
-    if (s->curtoken & LJJ_TOKEN_EOF) {
-        fprintf(stderr, "Encountered EOF\n");
+// appends a decoded char of the string token being read.
+static inline void ljj_lexstate_append_str(ljj_lexstate* s, char c) {
+    if (s->insitu) {
+        // never overtakes the read position, since escapes only shrink
+        s->insitu[s->strend++] = c;
         return;
     }
-    char tok = (char)(s->curtoken & 0xFF);
-    if ((s->curtoken & LJJ_TOKEN_INVALID) && tok > 0) {
-        fprintf(stderr, "Invalid token '%c' at line %zu col %zu\n", tok,
-                s->line, s->col - 1);
+    charvec_append(s->strbuf, c);
+}
+
+// appends `n` plain chars of the string token being read.
+static inline void ljj_lexstate_append_strn(ljj_lexstate* s, const char* p,
+                                            size_t n) {
+    if (s->insitu) {
+        char* dst = s->insitu + s->strend;
+        if (dst != p) {  // only shifted once an escape was shrunk
+            memmove(dst, p, n);
+        }
+        s->strend += n;
         return;
     }
-    ljj_lexstate_append_strbuf(s, '\0');
-    fprintf(stderr, "Invalid token '%s' at line %zu col %zu\n", s->strbuf->buf,
-            s->line, s->col - ljj_lexstate_buflen(s) + 1);
+    charvec_appendn(s->strbuf, (char*)p, n);
 }
 
-#define LJJ_LEXSTATE_ERR(state) \
-    ljj_lexstate_err(state);    \
-    ljj_free_lexstate(state);   \
-    return NULL
+// the JJ_TOKKIND_* of a token starting with `c`.
+static inline int ljj_tokkind(char c) {
+    if (UJJ_CHAR_IS(c, UJJ_CC_STRUCT)) return JJ_TOKKIND_PUNCT;
+    if (c == '"') return JJ_TOKKIND_STR;
+    if (c == '-' || UJJ_CHAR_IS(c, UJJ_CC_DIGIT)) return JJ_TOKKIND_NUM;
+    if (c == 't' || c == 'f' || c == 'n') return JJ_TOKKIND_LITERAL;
+    return JJ_TOKKIND_OTHER;
+}
+
+// records an error of `code` at the current token in `s->err`, if any. A
+// syntax error at the end of the input is recorded as JJ_ERR_EOF.
+static inline void ljj_lexstate_err(ljj_lexstate* s, int code) {
+    jj_error* err = s->err;
+    if (!err) {
+        return;
+    }
+    if (code == JJ_ERR_SYNTAX && (s->curtoken & LJJ_TOKEN_EOF)) {
+        code = JJ_ERR_EOF;
+    }
+    err->code = code;
+    if (s->curtoken & LJJ_TOKEN_EOF) {
+        err->offset = s->length;
+        err->token = JJ_TOKKIND_EOF;
+    } else {
+        err->offset = s->tokstart;
+        err->token = s->tokstart < s->length
+                         ? ljj_tokkind(s->original[s->tokstart])
+                         : JJ_TOKKIND_EOF;
+    }
+    ljj_lexstate_linecol(s, err->offset, &err->line, &err->col);
+}
 
 static void ljj_lex_skip_whitespace(ljj_lexstate* state) {
     char cur;
@@ -632,7 +1277,7 @@ static void ljj_lex_skip_whitespace(ljj_lexstate* state) {
             return;
         }
         cur = LJJ_LEXSTATE_CURCHAR(state);
-        if (ujj_is_char_oneof(cur, " \r\t\n")) {
+        if (UJJ_CHAR_IS(cur, UJJ_CC_WS)) {
             ljj_lexstate_nextchar(state);
             continue;
         }
@@ -640,24 +1285,436 @@ static void ljj_lex_skip_whitespace(ljj_lexstate* state) {
     }
 }
 
+// builds `state->index` from the whole input. Leaves it NULL if the index
+// cannot be allocated, or for inputs over 4 GiB, since offsets are 32-bit.
+void ljj_lexstate_buildindex(ljj_lexstate* state);
+// fills `state->sizes` from the entries of the index left to parse, which
+// must be whole values. Leaves it empty without an index, or if it cannot be
+// allocated.
+void ljj_lexstate_buildsizes(ljj_lexstate* state);
 void ljj_lex_read_str(ljj_lexstate* state);
 void ljj_lex_read_val(ljj_lexstate* state);
 void ljj_lex_next(ljj_lexstate* state);
-// returns a newly allocated string, or null if not able to
+// returns a newly allocated string, or null if not able to. When parsing in
+// situ, returns the string decoded in the input buffer instead.
 jj_jsontype_str ljj_lexstate_getstr(ljj_lexstate* state);
+// the interned key of the current string token, with a reference for the
+// caller, or NULL if failed to allocate.
+char* ljj_lexstate_getkey(ljj_lexstate* state);
+// the value of the current number token, converted while lexing.
 bool ljj_lexstate_getint(ljj_lexstate* state, jj_jsontype_int* result);
 bool ljj_lexstate_getfloat(ljj_lexstate* state, jj_jsontype_float* result);
-jj_jsonobj* ljj_lexstate_parseobj(ljj_lexstate* state, const char* name);
-jj_jsonobj* ljj_lexstate_parsearr(ljj_lexstate* state, const char* name);
+// parses the value starting at the current token into a new node. Returns
+// NULL if failed, with the token marked invalid.
+jj_jsonobj* ljj_lexstate_parsenode(ljj_lexstate* state);
 
-void sjj_tostr_jobj(charvec* strbuf, jj_jsondata data, int depth,
-                    jj_tostr_config* config, bool inarr);
 int sjj_tostr_jdata(jj_jsonobj* obj, charvec* strbuf, int depth,
                     jj_tostr_config* config, bool inarr);
 int sjj_tostr(jj_jsonobj* obj, charvec* strbuf, int depth,
               jj_tostr_config* config, bool inarr);
 
-jj_jsonobj* jj_parse(const char* json_str, uint32_t length);
+jj_jsonobj* jj_parse(const char* json_str, size_t length);
+// Same as `jj_parse`, and tells why it failed in `err` if not NULL.
+jj_jsonobj* jj_parse_err(const char* json_str, size_t length, jj_error* err);
+// a description of a JJ_ERR_* code.
+const char* jj_strerror(int code);
+// Parses the file at `path`, mapped into memory rather than read, so that
+// the file is never copied as a whole. Returns NULL if the file cannot be
+// opened or is invalid.
+jj_jsonobj* jj_parse_file(const char* path);
+
+// blocksize is the size of each arena block; 0 for the default.
+jj_doc* jj_new_doc(size_t blocksize);
+// Parses into `doc`, releasing whatever the doc held before. The returned root
+// is owned by the doc and stays valid until the next parse, `jj_doc_reset` or
+// `jj_doc_free`. Returns NULL if failed, and `doc->err` tells why.
+jj_jsonobj* jj_parse_arena(jj_doc* doc, const char* json_str, size_t length);
+// Same as `jj_parse_arena`, but without copying string values: each is decoded
+// in place and NULL terminated inside `json_str`, and the nodes point into
+// it. Keys are still copied into the doc, interned as by `jj_parse`.
+// `json_str` is modified, and must outlive the use of the doc.
+jj_jsonobj* jj_parse_insitu(jj_doc* doc, char* json_str, size_t length);
+// Releases all nodes of the doc at once and keeps its memory for reuse.
+void jj_doc_reset(jj_doc* doc);
+void jj_doc_free(jj_doc* doc);
 UJJ_MAYBE_UNUSED char* jj_tostr(jj_jsonobj* obj, jj_tostr_config* config);
 
+// ***************************** push parser *****************************
+
+// what the push parser accepts as the next token
+#define LJJ_EXPECT_VALUE    0  // a value
+#define LJJ_EXPECT_FIRSTVAL 1  // a value or ']', as a trailing ',' is allowed
+#define LJJ_EXPECT_FIRSTKEY 2  // a key or '}', as a trailing ',' is allowed
+#define LJJ_EXPECT_COLON    3  // ':'
+#define LJJ_EXPECT_NEXT     4  // ',' or the end of the container
+#define LJJ_EXPECT_END      5  // nothing, the root is complete
+#define LJJ_EXPECT_FAILED   6  // nothing, an error was reported
+
+struct jj_parser {
+    ljj_lexstate* state;  // lexes the chunk being fed, or the document
+    uint8_t expect;       // one of LJJ_EXPECT_*
+
+    // containers from the root down to the innermost open one
+    ljj_parser_frame* stack;
+    size_t depth;
+    size_t stackcap;
+    jj_jsonobj* root;
+
+    // a token cut by the end of a chunk, completed by the next chunks
+    charvec* carry;
+    bool carrystr;       // the carried token is a string
+    bool carryesc;       // the carried string ends inside an escape
+    size_t carryoffset;  // offset of the carried token in the document
+
+    size_t offset;     // bytes of the document fed before the current chunk
+    size_t tokoffset;  // offset of the current token in the document
+
+    // how deep containers may nest, JJ_MAX_DEPTH unless set otherwise
+    size_t max_depth;
+    // if the document must be valid UTF-8, JJ_CHECK_UTF8 unless set otherwise
+    bool check_utf8;
+    uint8_t utf8carry[4];  // a UTF-8 sequence cut by the end of a chunk
+    size_t utf8carrylen;
+
+    // why the last document failed; its line and col are not known when
+    // the document was fed in chunks
+    jj_error err;
+};
+
+// A parser that takes a document in chunks as they arrive, e.g. from a
+// socket. Tokens may be split anywhere between two chunks; only the part of
+// a split token is copied, never the chunks themselves. Nodes are allocated
+// on the heap, as with `jj_parse`.
+jj_parser* jj_parser_new(void);
+// Parses as much of `chunk` as possible. `chunk` is not used after the call
+// returns. Returns false if the document is invalid, after which
+// `parser->err` tells why and the parser ignores further chunks until
+// `jj_parser_finish`.
+bool jj_parser_feed(jj_parser* parser, const char* chunk, size_t len);
+// Ends the document, and returns its root which the caller owns, or NULL if
+// the document is invalid or incomplete, with `parser->err` telling why. The
+// parser is then ready for the next document.
+jj_jsonobj* jj_parser_finish(jj_parser* parser);
+// Parses a whole document at once, as `jj_parse` does, but reusing the
+// buffers the parser kept from previous calls instead of setting up new
+// ones, so that parsing many small documents with one parser allocates
+// little besides the nodes. Buffers grown past LJJ_KEEP_MAX entries by a
+// large document are released after it. A document being fed is dropped.
+// Returns NULL if failed, and `parser->err` tells why.
+jj_jsonobj* jj_parser_parse(jj_parser* parser, const char* json_str,
+                            size_t length);
+// Same as `jj_parser_parse`, but into `doc` as `jj_parse_arena` does, so that
+// the nodes also reuse the memory of the previous document of `doc`. Why it
+// failed is in both `parser->err` and `doc->err`.
+jj_jsonobj* jj_parser_parse_arena(jj_parser* parser, jj_doc* doc,
+                                  const char* json_str, size_t length);
+void jj_parser_free(jj_parser* parser);
+
+// ***************************** sax *****************************
+
+// Callbacks of `jj_sax_parse`, any of which may be NULL to ignore the event.
+// Each returns 0 to go on, or any other value to stop the parse. Strings and
+// keys are decoded and NULL terminated, but only valid during the call.
+struct jj_sax_callbacks {
+    int (*start_obj)(void* udata);
+    int (*end_obj)(void* udata);
+    int (*start_arr)(void* udata);
+    int (*end_arr)(void* udata);
+    int (*key)(void* udata, const char* key, size_t len);
+    int (*str)(void* udata, const char* s, size_t len);
+    int (*intval)(void* udata, jj_jsontype_int v);
+    int (*floatval)(void* udata, jj_jsontype_float v);
+    int (*boolval)(void* udata, jj_jsontype_bool v);
+    int (*null)(void* udata);
+};
+
+#define JJ_SAX_ERR -1
+
+// Parses `json_str` into events instead of nodes, with no allocation besides
+// a few buffers set up once per call. Returns 0 if the whole document was
+// parsed, JJ_SAX_ERR if it is invalid or nests deeper than JJ_MAX_DEPTH
+// (events already emitted stand), or the non-zero value a callback returned
+// to stop. A callback may itself return JJ_SAX_ERR: `err`, if not NULL, tells
+// the two apart, its code being JJ_ERR_NONE unless the parse failed.
+int jj_sax_parse(const char* json_str, size_t length,
+                 const jj_sax_callbacks* cb, void* udata, jj_error* err);
+
+// ***************************** ndjson *****************************
+
+struct jj_ndjson_config {
+    int nthreads; /** worker threads, 0 for one per online core */
+    bool ordered; /** if records are delivered in the order of the input */
+};
+
+// Receives a record of `jj_parse_ndjson` and owns `root`, which is NULL if
+// the record is invalid. `lineno` starts from 1. `err` tells why the record
+// is invalid, with its offset in the whole input and its column in the line,
+// and is NULL if it is not. Never called concurrently.
+typedef void (*jj_ndjson_func)(void* udata, size_t lineno, jj_jsonobj* root,
+                               const jj_error* err);
+
+// Parses newline delimited json (JSON Lines): each non-blank line of `buf` is
+// a record. Lines are parsed in batches by a pool of worker threads, and
+// handed to `cb` as each batch is done. Workers parse only a few batches
+// ahead of those delivered, so neither a slow batch nor a slow `cb` makes
+// memory grow with the input. `config` may be NULL for one thread per core
+// and ordered delivery. Invalid records are reported only to `cb`.
+// Returns the number of invalid records, or -1 if failed to allocate.
+long jj_parse_ndjson(const char* buf, size_t len,
+                     const jj_ndjson_config* config, jj_ndjson_func cb,
+                     void* udata);
+// Same as `jj_parse_ndjson`, but returns the roots of all records in order,
+// NULL for invalid ones, in a newly allocated array of `*count` items. If
+// `errs` is not NULL, it gets a newly allocated array of their errors as
+// well, of code JJ_ERR_NONE for valid records. Free each root with `jj_free`
+// and the arrays with `free`. Returns NULL if failed.
+jj_jsonobj** jj_parse_ndjson_all(const char* buf, size_t len, int nthreads,
+                                 size_t* count, jj_error** errs);
+
+// ***************************** parallel *****************************
+
+// Parses like `jj_parse`, but splits the largest array or object of the
+// document, the root or one nested in it, into ranges of elements, parses
+// them on `nthreads` threads (0 for one per online core), and stitches them
+// into one tree. Nodes are allocated on the heap, as with `jj_parse`. If the
+// input is invalid, `err` (may be NULL) gets the error first in it, as from
+// `jj_parse_err`, without parsing it again.
+// Some documents are parsed on the calling thread alone instead: small ones,
+// those with no container large enough to split, and those over 4 GiB, as
+// the structural index the split is found with has 32-bit offsets. `nused`
+// (may be NULL) gets the number of threads the document was parsed on, 1 if
+// it was parsed on the calling thread.
+jj_jsonobj* jj_parse_parallel(const char* json_str, size_t length,
+                              int nthreads, jj_error* err, int* nused);
+
+// ***************************** on demand *****************************
+
+// A document read lazily: only the structural index of the input is built
+// up front, and accessors walk it to the requested values, skipping others
+// by matching brackets. Parts never visited are neither parsed nor checked.
+struct jj_ondemand_doc {
+    ljj_lexstate* state;  // the input and its index, decodes scalars
+    // for the open entry of each container skipped so far, the entry after
+    // its close; 0 if not known yet
+    uint32_t* skip;
+    // where the last lookup stopped: the container, the entry after the
+    // member found, and for arrays its index. Lookups in the same container
+    // resume from there, as fields are mostly read in document order.
+    size_t cur_container;
+    size_t cur_pos;
+    size_t cur_idx;
+};
+
+// A value of a `jj_ondemand_doc`. `doc` is NULL if the value is missing.
+struct jj_ondemand_val {
+    jj_ondemand_doc* doc;
+    size_t entry;  // index entry of its first token
+};
+
+// `json_str` is not copied, and must outlive the doc. Returns NULL if
+// failed, if the input is blank or over 4 GiB, or if it is not valid UTF-8
+// while JJ_CHECK_UTF8 is set.
+jj_ondemand_doc* jj_ondemand_new(const char* json_str, size_t length);
+void jj_ondemand_free(jj_ondemand_doc* doc);
+jj_ondemand_val jj_ondemand_root(jj_ondemand_doc* doc);
+// the type of `v` (JJ_VALTYPE_*), or 0 if missing or invalid.
+jj_valtype jj_ondemand_type(jj_ondemand_val v);
+// the member `name` of object `obj`, missing if not found.
+jj_ondemand_val jj_ondemand_oget(jj_ondemand_val obj, const char* name);
+// the element `idx` of array `arr`, missing if out of range.
+jj_ondemand_val jj_ondemand_aget(jj_ondemand_val arr, size_t idx);
+bool jj_ondemand_getint(jj_ondemand_val v, jj_jsontype_int* result);
+bool jj_ondemand_getfloat(jj_ondemand_val v, jj_jsontype_float* result);
+bool jj_ondemand_getbool(jj_ondemand_val v, jj_jsontype_bool* result);
+// returns the decoded string, valid until the next access to the doc, or
+// NULL if not of type string. `len` may be NULL.
+const char* jj_ondemand_getstrref(jj_ondemand_val v, size_t* len);
+// parses `v` and all its children into nodes, as `jj_parse` would.
+jj_jsonobj* jj_ondemand_tojson(jj_ondemand_val v);
+
+#define OJJ_GENFUNC_ONDEMAND_OGET_ASTYPE(type)                                \
+    UJJ_MAYBE_UNUSED static inline bool jj_ondemand_oget##type(               \
+        jj_ondemand_val obj, const char* name, jj_jsontype_##type* result) { \
+        return jj_ondemand_get##type(jj_ondemand_oget(obj, name), result);    \
+    }
+
+// returns true if success, false if missing or not of type bool.
+OJJ_GENFUNC_ONDEMAND_OGET_ASTYPE(bool)
+// returns true if success, false if missing or not of type int.
+OJJ_GENFUNC_ONDEMAND_OGET_ASTYPE(int)
+// returns true if success, false if missing or not of type float.
+OJJ_GENFUNC_ONDEMAND_OGET_ASTYPE(float)
+
+// ***************************** tape *****************************
+
+// A read-only document laid out flat, in document order, in one array of
+// 64-bit words: a tag in the top byte and a 56-bit payload.
+//   '{' '[' : open; payload is the word after the matching close
+//   '}' ']' : close; payload is the number of members or elements
+//   '"'     : string or key; payload is its offset in `strs`, and the next
+//             word its length
+//   'l' 'd' : int or float; the next word holds the int64 or double bits
+//   't' 'f' 'n' : true, false, null
+// Skipping a container is a single jump, and walking a document touches
+// memory in order.
+struct jj_tape {
+    uint64_t* words;
+    size_t len;
+    size_t cap;
+    charvec* strs;  // decoded strings and keys, each NULL terminated
+};
+
+// A value of a `jj_tape`. `tape` is NULL if the value is missing.
+struct jj_tape_val {
+    const jj_tape* tape;
+    size_t pos;  // the word of its tag
+};
+
+// Walks the members or elements of a container, see `jj_tape_iter_next`.
+struct jj_tape_iter {
+    const jj_tape* tape;
+    size_t pos;  // the next member or element
+    size_t end;  // the close of the container
+    bool inobj;
+};
+
+#define OJJ_TAPE_PAYLOAD_MASK 0x00FFFFFFFFFFFFFFull
+
+#define OJJ_TAPE_WORD(tag, payload) \
+    (((uint64_t)(tag) << 56) | ((uint64_t)(payload)&OJJ_TAPE_PAYLOAD_MASK))
+#define OJJ_TAPE_TAG(w)     ((char)((w) >> 56))
+#define OJJ_TAPE_PAYLOAD(w) ((size_t)((w)&OJJ_TAPE_PAYLOAD_MASK))
+
+// Parses `json_str` into a new tape, which copies what it needs and does not
+// refer to `json_str`. Floats are kept as double. Returns NULL if failed, or if
+// containers nest deeper than JJ_MAX_DEPTH.
+jj_tape* jj_parse_tape(const char* json_str, size_t length);
+void jj_tape_free(jj_tape* tape);
+jj_tape_val jj_tape_root(const jj_tape* tape);
+// the type of `v` (JJ_VALTYPE_*), or 0 if missing.
+jj_valtype jj_tape_type(jj_tape_val v);
+// the number of members or elements of `v`, 0 if not a container.
+size_t jj_tape_count(jj_tape_val v);
+// the member `name` of object `obj`, missing if not found.
+jj_tape_val jj_tape_oget(jj_tape_val obj, const char* name);
+// the element `idx` of array `arr`, missing if out of range. Unlike `jj_aget`
+// it steps over the `idx` elements before, so walk arrays with a
+// `jj_tape_iter` rather than by index.
+jj_tape_val jj_tape_aget(jj_tape_val arr, size_t idx);
+bool jj_tape_getint(jj_tape_val v, jj_jsontype_int* result);
+bool jj_tape_getfloat(jj_tape_val v, jj_jsontype_float* result);
+bool jj_tape_getbool(jj_tape_val v, jj_jsontype_bool* result);
+// returns a reference of the string, valid as long as the tape, or NULL if
+// not of type string. `len` may be NULL.
+const char* jj_tape_getstrref(jj_tape_val v, size_t* len);
+// an iterator over the members or elements of `v`, which yields nothing if
+// `v` is not a container.
+jj_tape_iter jj_tape_iter_new(jj_tape_val v);
+// moves to the next member or element and returns true, or returns false at
+// the end. `key` may be NULL, and is set to NULL for elements of an array.
+bool jj_tape_iter_next(jj_tape_iter* it, jj_tape_val* val, const char** key);
+// same as `jj_tostr`, for a value of a tape.
+char* jj_tape_tostr(jj_tape_val v, jj_tostr_config* config);
+
+#define OJJ_GENFUNC_TAPE_OGET_ASTYPE(type)                                \
+    UJJ_MAYBE_UNUSED static inline bool jj_tape_oget##type(               \
+        jj_tape_val obj, const char* name, jj_jsontype_##type* result) { \
+        return jj_tape_get##type(jj_tape_oget(obj, name), result);        \
+    }
+
+// returns true if success, false if missing or not of type bool.
+OJJ_GENFUNC_TAPE_OGET_ASTYPE(bool)
+// returns true if success, false if missing or not of type int.
+OJJ_GENFUNC_TAPE_OGET_ASTYPE(int)
+// returns true if success, false if missing or not of type float.
+OJJ_GENFUNC_TAPE_OGET_ASTYPE(float)
+
+// ***************************** schema *****************************
+
+// the C type of a field bound by a `jj_schema`
+#define JJ_FIELD_BOOL  1  // jj_jsontype_bool, from true or false
+#define JJ_FIELD_INT   2  // jj_jsontype_int, from an int
+#define JJ_FIELD_FLOAT 3  // jj_jsontype_float, from an int or a float
+#define JJ_FIELD_STR   4  // char*, a copy allocated by the decoder
+#define JJ_FIELD_OBJ   5  // a struct described by `schema`, held inline
+#define JJ_FIELD_ARR   6  // a pointer to `count` elements of type `elem`
+
+// A member of a struct bound to a member of a json object. Arrays are held
+// as a pointer to their elements, allocated by the decoder, with their size_t
+// count at `countoff`. Elements are scalars, strings or structs of `schema`,
+// but not arrays.
+struct jj_field {
+    const char* name;  // of the member in json
+    size_t namelen;
+    int type;         // JJ_FIELD_*
+    int elem;         // JJ_FIELD_* of the elements of an array
+    size_t offset;    // of the member in the struct
+    size_t countoff;  // of the count of the elements of an array
+    const jj_schema* schema;  // of a struct, or of the elements of an array
+};
+
+// A struct bound to a json object, see `JJ_SCHEMA`.
+struct jj_schema {
+    const jj_field* fields;
+    size_t nfields;
+    size_t size;  // of the struct
+};
+
+#define JJ_FIELD(st, member, type) \
+    JJ_FIELD_AS(st, member, #member, type)
+#define JJ_FIELD_AS(st, member, name, type) \
+    { name, sizeof(name) - 1, type, 0, offsetof(st, member), 0, NULL }
+// `schema` points to the schema of the struct, as for JJ_FIELD_ARRAY.
+#define JJ_FIELD_STRUCT(st, member, schema)                                \
+    { #member, sizeof(#member) - 1, JJ_FIELD_OBJ, 0, offsetof(st, member), \
+      0, schema }
+// `schema` is NULL unless `elem` is JJ_FIELD_OBJ.
+#define JJ_FIELD_ARRAY(st, member, countmember, elem, schema)     \
+    { #member, sizeof(#member) - 1, JJ_FIELD_ARR, elem,           \
+      offsetof(st, member), offsetof(st, countmember), schema }
+
+// Decodes `json_str` straight into the struct `out` described by `schema`,
+// without building a tree. `out` is zeroed first, so members missing from the
+// input, or null in it, are left zero. Members not in the schema are skipped,
+// and a later duplicated member replaces the earlier one. Returns false if the
+// input is invalid or a value does not fit its field, with `out` freed and
+// zeroed, and tells why in `err` if not NULL.
+bool jj_decode(const jj_schema* schema, const char* json_str, size_t length,
+               void* out, jj_error* err);
+// Writes the struct `in` described by `schema` as json, with the members in
+// the order of the schema, and strings that are NULL as null. Returns a newly
+// allocated string, or NULL if failed.
+char* jj_encode(const jj_schema* schema, const void* in,
+                jj_tostr_config* config);
+// frees the strings and arrays that `jj_decode` allocated for `v`, and zeroes
+// them.
+void jj_schema_free(const jj_schema* schema, void* v);
+
+// Defines the schema `name` of the struct `st` from its `JJ_FIELD*`, with
+// `name##_decode`, `name##_encode` and `name##_free` typed for `st`:
+//     typedef struct point { jj_jsontype_int x, y; char* label; } point;
+//     JJ_SCHEMA(point_schema, point,
+//               JJ_FIELD(point, x, JJ_FIELD_INT),
+//               JJ_FIELD(point, y, JJ_FIELD_INT),
+//               JJ_FIELD(point, label, JJ_FIELD_STR))
+// A schema may refer to itself, for nested structs held through arrays. It is
+// declared ahead of its fields by a tentative definition, which is C only,
+// as is the rest of this header.
+#define JJ_SCHEMA(name, st, ...)                                            \
+    static const jj_schema name;                                            \
+    static const jj_field name##_fields[] = {__VA_ARGS__};                  \
+    static const jj_schema name = {                                         \
+        name##_fields, sizeof(name##_fields) / sizeof(jj_field), sizeof(st)}; \
+    UJJ_MAYBE_UNUSED static inline bool name##_decode(                      \
+        const char* json_str, size_t length, st* out, jj_error* err) {      \
+        return jj_decode(&name, json_str, length, out, err);                \
+    }                                                                       \
+    UJJ_MAYBE_UNUSED static inline char* name##_encode(                     \
+        const st* in, jj_tostr_config* config) {                            \
+        return jj_encode(&name, in, config);                                \
+    }                                                                       \
+    UJJ_MAYBE_UNUSED static inline void name##_free(st* v) {                \
+        jj_schema_free(&name, v);                                           \
+    }
+
 #endif  // JJ_H
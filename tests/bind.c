@@ -0,0 +1,219 @@
+// Checks that `jj_decode` and `jj_encode` bind json to structs through a
+// `JJ_SCHEMA`: values, type errors, duplicated members and large arrays.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "jj.h"
+
+typedef struct tag {
+    char* k;
+    jj_jsontype_int v;
+} tag;
+JJ_SCHEMA(tag_schema, tag,
+          JJ_FIELD(tag, k, JJ_FIELD_STR),
+          JJ_FIELD(tag, v, JJ_FIELD_INT))
+
+typedef struct geo {
+    jj_jsontype_float lat, lon;
+} geo;
+JJ_SCHEMA(geo_schema, geo,
+          JJ_FIELD(geo, lat, JJ_FIELD_FLOAT),
+          JJ_FIELD(geo, lon, JJ_FIELD_FLOAT))
+
+typedef struct node {
+    char* name;
+    struct node* kids;
+    size_t nkids;
+} node;
+JJ_SCHEMA(node_schema, node,
+          JJ_FIELD(node, name, JJ_FIELD_STR),
+          JJ_FIELD_ARRAY(node, kids, nkids, JJ_FIELD_OBJ, &node_schema))
+
+typedef struct user {
+    jj_jsontype_int id;
+    char* name;
+    jj_jsontype_bool admin;
+    geo at;
+    tag* tags;
+    size_t ntags;
+    jj_jsontype_int* scores;
+    size_t nscores;
+    char** emails;
+    size_t nemails;
+    node tree;
+} user;
+JJ_SCHEMA(user_schema, user,
+          JJ_FIELD(user, id, JJ_FIELD_INT),
+          JJ_FIELD(user, name, JJ_FIELD_STR),
+          JJ_FIELD_AS(user, admin, "is_admin", JJ_FIELD_BOOL),
+          JJ_FIELD_STRUCT(user, at, &geo_schema),
+          JJ_FIELD_ARRAY(user, tags, ntags, JJ_FIELD_OBJ, &tag_schema),
+          JJ_FIELD_ARRAY(user, scores, nscores, JJ_FIELD_INT, NULL),
+          JJ_FIELD_ARRAY(user, emails, nemails, JJ_FIELD_STR, NULL),
+          JJ_FIELD_STRUCT(user, tree, &node_schema))
+
+static bool decode(const char* json, user* u, jj_error* err) {
+    return user_schema_decode(json, strlen(json), u, err);
+}
+
+static void test_decode(void) {
+    const char* json =
+        "{\"id\":7,\"name\":\"a\\u00e9\",\"is_admin\":true,"
+        "\"at\":{\"lat\":1.5,\"lon\":-2},"
+        "\"junk\":{\"x\":[1,{\"y\":[]}]},"
+        "\"tags\":[{\"k\":\"x\",\"v\":1},{\"v\":2,\"k\":\"y\",\"q\":[3]}],"
+        "\"scores\":[1,2,3],\"emails\":[\"e1\",null],"
+        "\"tree\":{\"name\":\"r\",\"kids\":[{\"name\":\"c\",\"kids\":[]}]}}";
+    user u;
+    jj_error err;
+    CHECK(decode(json, &u, &err));
+    CHECK(err.code == JJ_ERR_NONE);
+    CHECK(u.id == 7);
+    CHECK(u.name && strcmp(u.name, "a\xc3\xa9") == 0);
+    CHECK(u.admin);
+    CHECK(u.at.lat == 1.5 && u.at.lon == -2);
+    CHECK(u.ntags == 2);
+    if (u.ntags == 2) {
+        CHECK(strcmp(u.tags[0].k, "x") == 0 && u.tags[0].v == 1);
+        CHECK(strcmp(u.tags[1].k, "y") == 0 && u.tags[1].v == 2);
+    }
+    CHECK(u.nscores == 3 && u.scores[0] == 1 && u.scores[2] == 3);
+    CHECK(u.nemails == 2 && strcmp(u.emails[0], "e1") == 0 &&
+          u.emails[1] == NULL);
+    CHECK(u.tree.name && strcmp(u.tree.name, "r") == 0);
+    CHECK(u.tree.nkids == 1 && strcmp(u.tree.kids[0].name, "c") == 0 &&
+          u.tree.kids[0].nkids == 0);
+    user_schema_free(&u);
+    CHECK(u.name == NULL && u.tags == NULL && u.ntags == 0);
+
+    // missing and null members are left zero
+    CHECK(decode("{\"id\":null,\"name\":null}", &u, NULL));
+    CHECK(u.id == 0 && u.name == NULL && u.nscores == 0);
+    user_schema_free(&u);
+}
+
+static void test_errors(void) {
+    static const struct {
+        const char* json;
+        int code;
+    } cases[] = {
+        {"{\"id\":1.5}", JJ_ERR_TYPE},
+        {"{\"name\":1}", JJ_ERR_TYPE},
+        {"{\"is_admin\":0}", JJ_ERR_TYPE},
+        {"{\"at\":[1]}", JJ_ERR_TYPE},
+        {"{\"scores\":{}}", JJ_ERR_TYPE},
+        {"{\"scores\":[1,2,\"x\"]}", JJ_ERR_TYPE},
+        {"{\"tags\":[{\"k\":\"a\"},{\"k\":3}]}", JJ_ERR_TYPE},
+        {"[1]", JJ_ERR_TYPE},
+        {"{\"id\" 1}", JJ_ERR_SYNTAX},
+        {"{\"id\":1", JJ_ERR_EOF},
+        {"{\"id\":1} x", JJ_ERR_TRAILING},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        user u;
+        jj_error err;
+        bool ok = decode(cases[i].json, &u, &err);
+        CHECK(!ok);
+        if (err.code != cases[i].code) {
+            fprintf(stderr, "%s: code %d, expected %d\n", cases[i].json,
+                    err.code, cases[i].code);
+            failures++;
+        }
+        // freed and zeroed, even if failed after some members were set
+        CHECK(u.tags == NULL && u.scores == NULL && u.name == NULL);
+    }
+}
+
+// a later duplicated member replaces the earlier one, freeing what it held
+static void test_duplicates(void) {
+    user u;
+    CHECK(decode("{\"name\":\"a\",\"scores\":[1,2,3],\"name\":\"b\","
+                 "\"tags\":[{\"k\":\"x\",\"k\":\"y\"}],\"scores\":[4]}",
+                 &u, NULL));
+    CHECK(u.name && strcmp(u.name, "b") == 0);
+    CHECK(u.nscores == 1 && u.scores[0] == 4);
+    CHECK(u.ntags == 1 && strcmp(u.tags[0].k, "y") == 0);
+    user_schema_free(&u);
+
+    // a struct too, rather than being merged into
+    CHECK(decode("{\"at\":{\"lat\":1},\"at\":{\"lon\":2},"
+                 "\"tree\":{\"name\":\"a\",\"kids\":[{}]},"
+                 "\"tree\":{\"kids\":[]}}",
+                 &u, NULL));
+    CHECK(u.at.lat == 0 && u.at.lon == 2);
+    CHECK(u.tree.name == NULL && u.tree.kids == NULL && u.tree.nkids == 0);
+    user_schema_free(&u);
+}
+
+static void test_encode(void) {
+    jj_tostr_config config = {0};
+    user u;
+    memset(&u, 0, sizeof(u));
+    u.id = 3;
+    u.name = "n\"q";
+    tag tags[2] = {{"x", 1}, {NULL, 2}};
+    u.tags = tags;
+    u.ntags = 2;
+    char* s = user_schema_encode(&u, &config);
+    CHECK(s != NULL);
+    if (!s) return;
+    const char* want =
+        "{\"id\":3,\"name\":\"n\\\"q\",\"is_admin\":false,"
+        "\"at\":{\"lat\":0,\"lon\":0},"
+        "\"tags\":[{\"k\":\"x\",\"v\":1},{\"k\":null,\"v\":2}],"
+        "\"scores\":[],\"emails\":[],\"tree\":{\"name\":null,\"kids\":[]}}";
+    if (strcmp(s, want) != 0) {
+        fprintf(stderr, "encoded %s\n", s);
+        failures++;
+    }
+
+    // what is encoded decodes back to the same
+    user back;
+    CHECK(decode(s, &back, NULL));
+    CHECK(back.id == 3 && strcmp(back.name, u.name) == 0);
+    CHECK(back.ntags == 2 && back.tags[1].k == NULL && back.tags[1].v == 2);
+    user_schema_free(&back);
+    free(s);
+}
+
+// arrays longer than the step reserved at once from the pre-scan
+static void test_large(void) {
+    size_t n = 3 * LJJ_HINT_STEP + 5;
+    char* json = malloc(16 + n * 8);
+    size_t len = (size_t)sprintf(json, "{\"scores\":[");
+    for (size_t i = 0; i < n; i++) {
+        len += (size_t)sprintf(json + len, "%s%zu", i ? "," : "", i);
+    }
+    strcpy(json + len, "]}");
+    user u;
+    CHECK(decode(json, &u, NULL));
+    CHECK(u.nscores == n);
+    bool same = true;
+    for (size_t i = 0; i < u.nscores; i++) {
+        same = same && u.scores[i] == (jj_jsontype_int)i;
+    }
+    CHECK(same);
+    user_schema_free(&u);
+    free(json);
+
+    // commas with no values between them
+    len = 16 + n;
+    json = malloc(len + 1);
+    memset(json, ',', len);
+    memcpy(json, "{\"scores\":[", 11);
+    json[len] = 0;
+    jj_error err;
+    CHECK(!decode(json, &u, &err) && err.code == JJ_ERR_SYNTAX);
+    free(json);
+}
+
+int main(void) {
+    test_decode();
+    test_errors();
+    test_duplicates();
+    test_encode();
+    test_large();
+    return check_report();
+}
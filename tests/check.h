@@ -0,0 +1,27 @@
+// What the tests share: CHECK counts the conditions that do not hold, and
+// `check_report` ends `main` with their count.
+#ifndef JJ_TESTS_CHECK_H
+#define JJ_TESTS_CHECK_H
+
+#include <stdio.h>
+
+static int failures = 0;
+
+#define CHECK(cond)                                                    \
+    do {                                                               \
+        if (!(cond)) {                                                 \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                \
+        }                                                              \
+    } while (0)
+
+// returns the exit status of a test, 1 if any check failed.
+static inline int check_report(void) {
+    if (failures) {
+        fprintf(stderr, "%d failures\n", failures);
+        return 1;
+    }
+    return 0;
+}
+
+#endif  // JJ_TESTS_CHECK_H
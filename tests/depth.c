@@ -0,0 +1,160 @@
+// Checks that containers nest up to the depth allowed and no deeper, failing
+// with JJ_ERR_DEPTH at the container that goes past it, and that trees far
+// deeper than the call stack could hold are written and freed.
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "jj.h"
+
+// `depth` containers nested in one another, arrays and objects in turn, with
+// a value at the bottom. Sets `*at` to the offset of the last one opened.
+static char* nest(size_t depth, size_t* len, size_t* at) {
+    char* buf = malloc(depth * 6 + 2);
+    char* p = buf;
+    for (size_t i = 0; i < depth; i++) {
+        *at = (size_t)(p - buf);
+        p += i % 2 ? sprintf(p, "{\"k\":") : sprintf(p, "[");
+    }
+    *p++ = '1';
+    for (size_t i = depth; i-- > 0;) *p++ = i % 2 ? '}' : ']';
+    *p = 0;
+    *len = (size_t)(p - buf);
+    return buf;
+}
+
+static char* tostr(jj_jsonobj* root) {
+    jj_tostr_config config = {0};
+    return jj_tostr(root, &config);
+}
+
+// parses `depth` levels with `jj_parse_err`, the SAX parser and the tape,
+// which must fail at the last level if past `JJ_MAX_DEPTH`.
+static void test_limit(size_t depth) {
+    size_t len, at;
+    char* json = nest(depth, &len, &at);
+    bool over = depth > JJ_MAX_DEPTH;
+    jj_error err;
+    jj_jsonobj* root = jj_parse_err(json, len, &err);
+    if (over) {
+        CHECK(root == NULL && err.code == JJ_ERR_DEPTH && err.offset == at);
+    } else {
+        CHECK(root != NULL && err.code == JJ_ERR_NONE);
+        char* s = root ? tostr(root) : NULL;
+        CHECK(s && strcmp(s, json) == 0);
+        free(s);
+        // formatted too, one level per line
+        jj_tostr_config config = {false, true, false, 1};
+        s = root ? jj_tostr(root, &config) : NULL;
+        CHECK(s != NULL);
+        free(s);
+        if (root) jj_free(root);
+    }
+
+    jj_sax_callbacks cb = {0};
+    CHECK(jj_sax_parse(json, len, &cb, NULL, &err) == (over ? JJ_SAX_ERR : 0));
+    CHECK(err.code == (over ? JJ_ERR_DEPTH : JJ_ERR_NONE));
+    jj_tape* tape = jj_parse_tape(json, len);
+    CHECK(over ? tape == NULL : tape != NULL);
+    jj_tape_free(tape);
+    free(json);
+}
+
+// a document that only opens containers fails as soon as it goes too deep,
+// not at its end
+static void test_fail_fast(void) {
+    size_t len = 1 << 20;
+    char* json = malloc(len);
+    memset(json, '[', len);
+    jj_error err;
+    CHECK(jj_parse_err(json, len, &err) == NULL);
+    CHECK(err.code == JJ_ERR_DEPTH && err.offset == JJ_MAX_DEPTH);
+    free(json);
+}
+
+// a `jj_parser` set to its own depth, whole or fed in chunks
+static void test_parser(void) {
+    jj_parser* p = jj_parser_new();
+    CHECK(p != NULL);
+    if (!p) return;
+    p->max_depth = 10;
+    for (size_t depth = 9; depth <= 11; depth++) {
+        size_t len, at;
+        char* json = nest(depth, &len, &at);
+        bool over = depth > p->max_depth;
+        jj_jsonobj* root = jj_parser_parse(p, json, len);
+        CHECK(over ? root == NULL : root != NULL);
+        CHECK(over ? p->err.code == JJ_ERR_DEPTH && p->err.offset == at
+                   : p->err.code == JJ_ERR_NONE);
+        if (root) jj_free(root);
+        size_t i = 0;
+        while (i < len && jj_parser_feed(p, json + i, 1)) i++;
+        root = jj_parser_finish(p);
+        CHECK(over ? root == NULL : root != NULL);
+        CHECK(over ? p->err.code == JJ_ERR_DEPTH && p->err.offset == at
+                   : p->err.code == JJ_ERR_NONE);
+        if (root) jj_free(root);
+        free(json);
+    }
+
+    // with no limit, as deep as memory allows
+    size_t len, at;
+    char* json = nest(200000, &len, &at);
+    p->max_depth = SIZE_MAX;
+    jj_jsonobj* root = jj_parser_parse(p, json, len);
+    CHECK(root != NULL);
+    char* s = root ? tostr(root) : NULL;
+    CHECK(s && strcmp(s, json) == 0);
+    free(s);
+    if (root) jj_free(root);
+    free(json);
+    jj_parser_free(p);
+}
+
+// trees built through the API have no depth limit, and are written and
+// freed without recursion
+static void test_built(void) {
+    size_t depth = 1000000;
+    jj_jsonobj* root = jj_new_jsonarr();
+    jj_jsonobj* obj = root;
+    for (size_t i = 1; obj && i < depth; i++) {
+        obj = i % 2 ? jj_aappend_obj(obj) : jj_oput_arr(obj, "k");
+    }
+    CHECK(obj != NULL);
+    char* s = tostr(root);
+    CHECK(s != NULL);
+    if (s) {
+        // "[" and "{\"k\":" in turn, the last object empty, then closed
+        size_t len = strlen(s);
+        CHECK(len == depth * 4 - 4);
+        CHECK(strncmp(s, "[{\"k\":[{\"k\":[", 13) == 0);
+        CHECK(strcmp(s + len - 4, "}]}]") == 0);
+        // past the default limit when parsed back
+        jj_error err;
+        CHECK(jj_parse_err(s, len, &err) == NULL && err.code == JJ_ERR_DEPTH);
+    }
+    free(s);
+    jj_free(root);
+
+    // objects alone
+    root = jj_new_jsonobj();
+    obj = root;
+    for (size_t i = 1; obj && i < depth; i++) obj = jj_oput_obj(obj, "");
+    CHECK(obj != NULL);
+    s = tostr(root);
+    CHECK(s && strlen(s) == depth * 5 - 3);
+    free(s);
+    jj_free(root);
+}
+
+int main(void) {
+    test_limit(1);
+    test_limit(JJ_MAX_DEPTH - 1);
+    test_limit(JJ_MAX_DEPTH);
+    test_limit(JJ_MAX_DEPTH + 1);
+    test_fail_fast();
+    test_parser();
+    test_built();
+    return check_report();
+}
@@ -0,0 +1,68 @@
+// Checks that every classify kernel builds the same structural index as the
+// scalar one. Includes jj.c to reach the kernels.
+#include "jj.c"
+
+#include "check.h"
+
+// bytes that drive the indexer: quotes, runs of backslashes, structurals,
+// whitespace, scalars and UTF-8.
+static const char alphabet[] = "\"\\\\\\{}[]:,  \t\r\nab1-.e\xc3\xa9\x01";
+
+static void fill(char* buf, size_t len, unsigned seed) {
+    srand(seed);
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+    }
+}
+
+static size_t build(ljj_classify_func f, const char* buf, size_t len,
+                    uint32_t** out) {
+    ljj_lexstate* state = ljj_new_lexstate(buf, len);
+    ljj_classify = f;
+    ljj_lexstate_buildindex(state);
+    size_t n = state->index_len;
+    *out = malloc(sizeof(uint32_t) * (n + 1));
+    memcpy(*out, state->index, sizeof(uint32_t) * n);
+    ljj_free_lexstate(state);
+    return n;
+}
+
+static void compare(const char* name, ljj_classify_func f) {
+    char buf[1024];
+    for (unsigned seed = 0; seed < 2000; seed++) {
+        size_t len = seed % sizeof(buf);
+        fill(buf, len, seed);
+        ljj_blockmasks want, got;
+        if (len >= 64) {
+            ljj_classify_scalar((const uint8_t*)buf, &want);
+            f((const uint8_t*)buf, &got);
+            CHECK(memcmp(&want, &got, sizeof(want)) == 0);
+        }
+        uint32_t *wantidx, *gotidx;
+        size_t wantn = build(ljj_classify_scalar, buf, len, &wantidx);
+        size_t gotn = build(f, buf, len, &gotidx);
+        if (wantn != gotn ||
+            memcmp(wantidx, gotidx, sizeof(uint32_t) * wantn) != 0) {
+            fprintf(stderr, "%s: index differs for seed %u\n", name, seed);
+            failures++;
+        }
+        free(wantidx);
+        free(gotidx);
+    }
+}
+
+int main(void) {
+    ljj_simd_init();
+    ljj_classify_func picked = ljj_classify;
+#ifdef LJJ_HAVE_SSE2
+    compare("sse2", ljj_classify_sse2);
+#endif
+#ifdef LJJ_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        compare("avx2", ljj_classify_avx2);
+    }
+#endif
+    compare("picked", picked);
+    ljj_classify = picked;
+    return check_report();
+}
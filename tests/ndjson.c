@@ -0,0 +1,193 @@
+// Checks that `jj_parse_ndjson` delivers every record once, in order when
+// asked, with its line number and the error of an invalid one, on any number
+// of threads, and however slow the callback.
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "check.h"
+#include "jj.h"
+
+#define NLINES 60000
+
+// what a line of the input holds
+typedef enum { LINE_BLANK, LINE_VALID, LINE_INVALID } line_kind;
+
+typedef struct input {
+    char* buf;
+    size_t len;
+    line_kind kinds[NLINES + 1];  // of each line, from 1
+    size_t badoff[NLINES + 1];    // offset of the token at fault in `buf`
+    size_t badcol[NLINES + 1];
+    size_t nrecs;
+    size_t ninvalid;
+} input;
+
+// Lines past the first batches, so that workers run ahead of delivery up to
+// their window. Some are blank or only whitespace, some end with "\r\n", and
+// the last has no newline. Strings hold brackets and escaped quotes.
+static void build(input* in) {
+    in->buf = malloc((size_t)NLINES * 64);
+    in->len = 0;
+    in->nrecs = in->ninvalid = 0;
+    for (size_t i = 1; i <= NLINES; i++) {
+        char* line = in->buf + in->len;
+        int n;
+        if (i % 7 == 0) {
+            in->kinds[i] = LINE_BLANK;
+            n = sprintf(line, "%s", i % 2 ? "" : " \t");
+        } else if (i % 11 == 0) {
+            in->kinds[i] = LINE_INVALID;
+            n = sprintf(line, "  {\"i\":%zu x}", i);
+            in->badcol[i] = (size_t)(strchr(line, 'x') - line) + 1;
+            in->badoff[i] = in->len + in->badcol[i] - 1;
+            in->ninvalid++;
+        } else {
+            in->kinds[i] = LINE_VALID;
+            n = sprintf(line, "{\"i\":%zu,\"s\":\"a\\\"]}\\\\\",\"n\":[1,{}]}",
+                        i);
+        }
+        in->len += (size_t)n;
+        in->nrecs += in->kinds[i] != LINE_BLANK;
+        if (i < NLINES) {
+            if (i % 5 == 0) in->buf[in->len++] = '\r';
+            in->buf[in->len++] = '\n';
+        }
+    }
+}
+
+typedef struct seen {
+    const input* in;
+    size_t* lines;  // in the order delivered
+    size_t count;
+    size_t pause;  // sleeps every `pause` records if not 0
+    bool ordered;
+} seen;
+
+static void on_record(void* udata, size_t lineno, jj_jsonobj* root,
+                      const jj_error* err) {
+    seen* s = udata;
+    const input* in = s->in;
+    if (s->count == in->nrecs || lineno == 0 || lineno > NLINES) {
+        failures++;
+        if (root) jj_free(root);
+        return;
+    }
+    s->lines[s->count++] = lineno;
+    if (s->ordered && s->count > 1) {
+        CHECK(lineno > s->lines[s->count - 2]);
+    }
+    if (in->kinds[lineno] == LINE_VALID) {
+        jj_jsontype_int i = 0;
+        CHECK(root && err == NULL);
+        CHECK(root && jj_ogetint(root, "i", &i) && (size_t)i == lineno);
+    } else {
+        CHECK(in->kinds[lineno] == LINE_INVALID);
+        CHECK(root == NULL && err != NULL);
+        if (err) {
+            CHECK(err->code == JJ_ERR_SYNTAX);
+            CHECK(err->line == lineno);
+            CHECK(err->col == in->badcol[lineno]);
+            CHECK(err->offset == in->badoff[lineno]);
+        }
+    }
+    if (root) jj_free(root);
+    if (s->pause && s->count % s->pause == 0) {
+        struct timespec ts = {0, 200 * 1000};
+        nanosleep(&ts, NULL);
+    }
+}
+
+static int cmp_size(const void* a, const void* b) {
+    size_t x = *(const size_t*)a, y = *(const size_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void run(const input* in, int nthreads, bool ordered, size_t pause) {
+    seen s = {in, malloc(sizeof(size_t) * in->nrecs), 0, pause, ordered};
+    jj_ndjson_config config = {nthreads, ordered};
+    long invalid = jj_parse_ndjson(in->buf, in->len, &config, on_record, &s);
+    if (invalid != (long)in->ninvalid || s.count != in->nrecs) {
+        fprintf(stderr, "%d threads, %s: %ld invalid of %zu records\n",
+                nthreads, ordered ? "ordered" : "unordered", invalid,
+                s.count);
+        failures++;
+    }
+    // each record once, whatever the order
+    qsort(s.lines, s.count, sizeof(size_t), cmp_size);
+    size_t k = 0;
+    for (size_t i = 1; i <= NLINES && k < s.count; i++) {
+        if (in->kinds[i] == LINE_BLANK) continue;
+        if (s.lines[k++] != i) {
+            fprintf(stderr, "%d threads: line %zu not delivered\n", nthreads,
+                    i);
+            failures++;
+            break;
+        }
+    }
+    free(s.lines);
+}
+
+static void test_all(const input* in) {
+    size_t count = 0;
+    jj_error* errs = NULL;
+    jj_jsonobj** roots =
+        jj_parse_ndjson_all(in->buf, in->len, 3, &count, &errs);
+    CHECK(roots && errs && count == in->nrecs);
+    size_t k = 0;
+    for (size_t i = 1; roots && i <= NLINES && k < count; i++) {
+        if (in->kinds[i] == LINE_BLANK) continue;
+        if (in->kinds[i] == LINE_VALID) {
+            CHECK(roots[k] && errs[k].code == JJ_ERR_NONE);
+        } else {
+            CHECK(!roots[k] && errs[k].code == JJ_ERR_SYNTAX &&
+                  errs[k].line == i);
+        }
+        if (roots[k]) jj_free(roots[k]);
+        k++;
+    }
+    free(roots);
+    free(errs);
+
+    // no records, and errors not asked for
+    roots = jj_parse_ndjson_all("\n \n\r\n", 5, 0, &count, NULL);
+    CHECK(roots && count == 0);
+    free(roots);
+}
+
+// a last line cut short, with no newline
+static void test_truncated(void) {
+    const char* buf = "[1]\n\n{\"a\":";
+    size_t count = 0;
+    jj_error* errs = NULL;
+    jj_jsonobj** roots =
+        jj_parse_ndjson_all(buf, strlen(buf), 1, &count, &errs);
+    CHECK(roots && count == 2);
+    if (roots && count == 2) {
+        CHECK(roots[0] && !roots[1]);
+        CHECK(errs[1].code == JJ_ERR_EOF && errs[1].line == 3 &&
+              errs[1].offset == strlen(buf));
+        jj_free(roots[0]);
+    }
+    free(roots);
+    free(errs);
+}
+
+int main(void) {
+    static input in;
+    build(&in);
+    static const int nthreads[] = {1, 2, 4, 8};
+    for (size_t i = 0; i < sizeof(nthreads) / sizeof(nthreads[0]); i++) {
+        run(&in, nthreads[i], true, 0);
+        run(&in, nthreads[i], false, 0);
+    }
+    // a slow callback, which the workers must wait for
+    run(&in, 4, true, 2000);
+    run(&in, 4, false, 2000);
+    test_all(&in);
+    test_truncated();
+    free(in.buf);
+    return check_report();
+}
@@ -0,0 +1,260 @@
+// Checks that a `jj_ondemand_doc` finds the same values as `jj_parse`, looked
+// up in any order and again, with brackets and quotes inside strings and keys
+// that skipping by bracket matching must not take for structure.
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "jj.h"
+
+// strings that hold brackets, escaped quotes and runs of backslashes before
+// the closing quote
+static const char* const strs[] = {
+    "\"]\"",     "\"}\"",          "\"[{\"",     "\"\\\"]}\"",
+    "\"\\\\\"",  "\"a\\\\\\\"}\"", "\"\\u005d\"", "\"\"",
+    "\"{\\\"x\\\":[1]}\"",
+};
+#define NSTRS (sizeof(strs) / sizeof(strs[0]))
+
+// keys as written, each made unique by a number after it
+static const char* const keys[] = {
+    "k", "a\\\"b", "}]", "\\u0041x", "[{", "c\\\\",
+};
+#define NKEYS (sizeof(keys) / sizeof(keys[0]))
+
+static char* ws(char* p) {
+    switch (rand() % 4) {
+        case 0:
+            *p++ = ' ';
+            break;
+        case 1:
+            *p++ = '\n';
+            *p++ = '\t';
+            break;
+        default:
+            break;
+    }
+    return p;
+}
+
+// appends a random value, of containers up to `depth` deep.
+static char* gen(char* p, int depth, int width) {
+    static int nkey = 0;
+    int kind = rand() % (depth > 0 ? 9 : 7);
+    switch (kind) {
+        case 0:
+            return p + sprintf(p, "%d", rand() % 2000 - 1000);
+        case 1:
+            return p + sprintf(p, "%d.25e-1", rand() % 100);
+        case 2:
+            return p + sprintf(p, "%s", rand() % 2 ? "true" : "false");
+        case 3:
+            return p + sprintf(p, "null");
+        case 7:
+        case 8: {
+            bool isobj = kind == 7;
+            int n = rand() % (width + 1);
+            *p++ = isobj ? '{' : '[';
+            for (int i = 0; i < n; i++) {
+                if (i) *p++ = ',';
+                p = ws(p);
+                if (isobj) {
+                    p += sprintf(p, "\"%s%d\"", keys[rand() % NKEYS], nkey++);
+                    p = ws(p);
+                    *p++ = ':';
+                    p = ws(p);
+                }
+                p = gen(p, depth - 1, width);
+                p = ws(p);
+            }
+            *p++ = isobj ? '}' : ']';
+            return p;
+        }
+        default:
+            return p + sprintf(p, "%s", strs[rand() % NSTRS]);
+    }
+}
+
+static char* tostr(jj_jsonobj* root) {
+    jj_tostr_config config = {0};
+    return root ? jj_tostr(root, &config) : NULL;
+}
+
+// checks that `v` holds what `node` does, through the accessor of its type
+// and as a whole.
+static void same(jj_ondemand_val v, jj_jsonobj* node, const char* where) {
+    jj_valtype type = jj_ondemand_type(v);
+    bool ok = type == node->type;
+    jj_jsontype_int i;
+    jj_jsontype_float f;
+    jj_jsontype_bool b;
+    size_t len;
+    const char* s;
+    switch (ok ? type : 0) {
+        case JJ_VALTYPE_INT:
+            ok = jj_ondemand_getint(v, &i) && i == node->data.intval;
+            break;
+        case JJ_VALTYPE_FLOAT:
+            ok = jj_ondemand_getfloat(v, &f) && f == node->data.floatval;
+            break;
+        case JJ_VALTYPE_BOOL:
+            ok = jj_ondemand_getbool(v, &b) && b == node->data.boolval;
+            break;
+        case JJ_VALTYPE_STR:
+            s = jj_ondemand_getstrref(v, &len);
+            ok = s && len == strlen(node->data.strval) &&
+                 memcmp(s, node->data.strval, len) == 0;
+            break;
+        default:
+            break;
+    }
+    jj_jsonobj* parsed = jj_ondemand_tojson(v);
+    char* got = tostr(parsed);
+    char* want = tostr(node);
+    ok = ok && got && want && strcmp(got, want) == 0;
+    if (!ok) {
+        fprintf(stderr, "%s: got %s, expected %s\n", where,
+                got ? got : "none", want ? want : "none");
+        failures++;
+    }
+    free(got);
+    free(want);
+    if (parsed) jj_free(parsed);
+}
+
+static void shuffle(size_t* order, size_t n) {
+    for (size_t i = n; i > 1; i--) {
+        size_t j = (size_t)rand() % i;
+        size_t t = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = t;
+    }
+}
+
+// the orders `n` members or elements are looked up in: in the document's,
+// backwards, each twice in a row, and shuffled, which is the last.
+#define NORDERS 4
+static void order_of(size_t* order, size_t n, int how) {
+    for (size_t i = 0; i < n; i++) {
+        switch (how) {
+            case 1:
+                order[i] = n - 1 - i;
+                break;
+            case 2:
+                order[i] = i / 2;
+                break;
+            default:
+                order[i] = i;
+                break;
+        }
+    }
+    if (how == NORDERS - 1) shuffle(order, n);
+}
+
+// looks up every member or element of `v` in each order, and goes down into
+// each in the last, so that the lookups of a container are interleaved with
+// those of its children.
+static void walk(jj_ondemand_val v, jj_jsonobj* node) {
+    same(v, node, "value");
+    bool isobj = node->type == JJ_VALTYPE_OBJ;
+    if (!isobj && node->type != JJ_VALTYPE_ARR) return;
+    size_t n = isobj ? jj_olen(node) : node->data.arrval->length;
+    const char** names = malloc(sizeof(char*) * (n + 1));
+    jj_jsonobj** kids = malloc(sizeof(jj_jsonobj*) * (n + 1));
+    size_t* order = malloc(sizeof(size_t) * (n + 1));
+    if (isobj) {
+        size_t i = 0, k = 0;
+        while (jj_oiter(node, &i, &names[k], &kids[k])) k++;
+    } else {
+        for (size_t i = 0; i < n; i++) kids[i] = jj_aget(node, i);
+    }
+    for (int how = 0; how < NORDERS; how++) {
+        order_of(order, n, how);
+        for (size_t k = 0; k < n; k++) {
+            size_t i = order[k];
+            jj_ondemand_val kid = isobj ? jj_ondemand_oget(v, names[i])
+                                        : jj_ondemand_aget(v, i);
+            if (!kid.doc) {
+                fprintf(stderr, "%s %zu not found\n",
+                        isobj ? names[i] : "element", i);
+                failures++;
+            } else if (how == NORDERS - 1) {
+                walk(kid, kids[i]);
+            } else {
+                same(kid, kids[i], isobj ? names[i] : "element");
+            }
+        }
+        // what is not there, from wherever the cursor is
+        jj_ondemand_val none = isobj ? jj_ondemand_oget(v, "k")
+                                     : jj_ondemand_aget(v, n);
+        CHECK(none.doc == NULL && jj_ondemand_type(none) == 0);
+    }
+    free(names);
+    free(kids);
+    free(order);
+}
+
+static void check(const char* json, size_t len) {
+    jj_jsonobj* root = jj_parse(json, len);
+    jj_ondemand_doc* doc = jj_ondemand_new(json, len);
+    CHECK(root && doc);
+    if (root && doc) walk(jj_ondemand_root(doc), root);
+    if (root) jj_free(root);
+    jj_ondemand_free(doc);
+}
+
+// values skipped past strings that close what they are in
+static void test_strings(void) {
+    const char* json =
+        "{\"a\":[\"]\",\"}\",{\"x\":\"]}\"}],\"b\":{\"c\":\"\\\"}\",\"]\":2},"
+        "\"}\" : \"[\",\"d\":1}";
+    jj_ondemand_doc* doc = jj_ondemand_new(json, strlen(json));
+    CHECK(doc != NULL);
+    if (!doc) return;
+    jj_ondemand_val root = jj_ondemand_root(doc);
+    jj_jsontype_int i = 0;
+    CHECK(jj_ondemand_ogetint(root, "d", &i) && i == 1);
+    jj_ondemand_val b = jj_ondemand_oget(root, "b");
+    CHECK(jj_ondemand_ogetint(b, "]", &i) && i == 2);
+    const char* s = jj_ondemand_getstrref(jj_ondemand_oget(b, "c"), NULL);
+    CHECK(s && strcmp(s, "\"}") == 0);
+    s = jj_ondemand_getstrref(jj_ondemand_oget(root, "}"), NULL);
+    CHECK(s && strcmp(s, "[") == 0);
+    jj_ondemand_val a = jj_ondemand_oget(root, "a");
+    s = jj_ondemand_getstrref(
+        jj_ondemand_oget(jj_ondemand_aget(a, 2), "x"), NULL);
+    CHECK(s && strcmp(s, "]}") == 0);
+    s = jj_ondemand_getstrref(jj_ondemand_aget(a, 1), NULL);
+    CHECK(s && strcmp(s, "}") == 0);
+    CHECK(jj_ondemand_aget(a, 3).doc == NULL);
+    CHECK(jj_ondemand_oget(root, "x").doc == NULL);
+    jj_ondemand_free(doc);
+}
+
+int main(void) {
+    test_strings();
+    char* buf = malloc(1 << 22);
+    for (unsigned seed = 0; seed < 200; seed++) {
+        srand(seed);
+        char* p = buf;
+        // objects and arrays at the root, wide enough to skip much
+        bool isobj = seed % 2;
+        p += sprintf(p, isobj ? "{\"y\":" : "[");
+        p = gen(ws(p), 4, 8);
+        p += sprintf(p, isobj ? ",\"x\":" : ",");
+        p = gen(p, 4, 8);
+        *p++ = isobj ? '}' : ']';
+        check(buf, (size_t)(p - buf));
+    }
+    srand(1);
+    char* p = buf;
+    *p++ = '{';
+    for (int i = 0; i < 300; i++) {
+        p += sprintf(p, "%s\"m%d\":", i ? "," : "", i);
+        p = gen(p, 3, 6);
+    }
+    *p++ = '}';
+    check(buf, (size_t)(p - buf));
+    free(buf);
+    return check_report();
+}
@@ -0,0 +1,144 @@
+// Checks that `jj_parse_parallel` builds the same tree as `jj_parse` from
+// documents split across threads, with strings that look like separators and
+// brackets wherever a split may fall, and that it reports the error of an
+// invalid one from the split parse rather than by parsing it again.
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "jj.h"
+
+// strings that hold what the split looks for, escaped quotes and runs of
+// backslashes before the closing quote
+static const char* const strs[] = {
+    "\"a,b\"",          "\"]\"",       "\"},{\"",      "\"\\\"],[\\\"\"",
+    "\"\\\\\"",         "\"\\\\\\\"\"", "\"[{\\\"x\\\":1}]\"",
+    "\"\\\\\\\\\"",     "\"\\u005d,\"", "\"\"",
+};
+#define NSTRS (sizeof(strs) / sizeof(strs[0]))
+
+// appends the element `i` of the split container, about 60 bytes.
+static char* elem(char* p, size_t i) {
+    const char* s = strs[i % NSTRS];
+    switch (i % 4) {
+        case 0:
+            return p + sprintf(p, "%s", s);
+        case 1:
+            return p + sprintf(p, "{\"s\":%s,\"n\":[%zu,{\"b\":%s}]}", s, i,
+                               strs[(i + 3) % NSTRS]);
+        case 2:
+            return p + sprintf(p, "[%s,%zu.5,null,[]]", s, i);
+        default:
+            return p + sprintf(p, "{\"k\\\"%zu\":%s}", i, s);
+    }
+}
+
+// a document of `n` elements in an array, or in an object if `isobj`, nested
+// in the root if `nested`. Returns its length.
+static size_t build(char* buf, size_t n, bool isobj, bool nested) {
+    char* p = buf;
+    if (nested) p += sprintf(p, "{\"head\":[1,\"]\"],\"data\":");
+    *p++ = isobj ? '{' : '[';
+    for (size_t i = 0; i < n; i++) {
+        if (i) *p++ = ',';
+        if (i % 3 == 0) *p++ = '\n';
+        if (isobj) {
+            // "dup" again at the end replaces the first, keeping its place
+            if (i == 0 || i == n - 1) {
+                p += sprintf(p, "\"dup\":");
+            } else {
+                p += sprintf(p, "\"m%zu\\\\\":", i);
+            }
+        }
+        p = elem(p, i);
+    }
+    *p++ = isobj ? '}' : ']';
+    if (nested) p += sprintf(p, ",\"tail\":\"}\"}");
+    *p = 0;
+    return (size_t)(p - buf);
+}
+
+static char* tostr(jj_jsonobj* root) {
+    jj_tostr_config config = {0};
+    return root ? jj_tostr(root, &config) : NULL;
+}
+
+static void compare(const char* buf, size_t len, int nthreads) {
+    jj_jsonobj* want = jj_parse(buf, len);
+    int nused = 0;
+    jj_error err;
+    jj_jsonobj* got = jj_parse_parallel(buf, len, nthreads, &err, &nused);
+    CHECK(want && got && err.code == JJ_ERR_NONE);
+    CHECK(nused > 1 && nused <= nthreads);
+    char* w = tostr(want);
+    char* g = tostr(got);
+    if (!w || !g || strcmp(w, g) != 0) {
+        fprintf(stderr, "%zu bytes on %d threads: trees differ\n", len,
+                nthreads);
+        failures++;
+    }
+    free(w);
+    free(g);
+    if (want) jj_free(want);
+    if (got) jj_free(got);
+}
+
+// breaks the document at `at` with `bad` and checks the error against
+// `jj_parse_err`, and that it is found by the workers if `split`.
+static void compare_err(char* buf, size_t len, size_t at, const char* bad,
+                        bool split) {
+    char saved[8];
+    size_t n = strlen(bad);
+    memcpy(saved, buf + at, n);
+    memcpy(buf + at, bad, n);
+    jj_error want, got;
+    CHECK(jj_parse_err(buf, len, &want) == NULL);
+    int nused = 0;
+    CHECK(jj_parse_parallel(buf, len, 4, &got, &nused) == NULL);
+    // found by the workers, not by parsing the whole input again
+    CHECK(split ? nused > 1 : nused == 1);
+    if (got.code != want.code || got.offset != want.offset ||
+        got.line != want.line || got.col != want.col) {
+        fprintf(stderr, "%s at %zu: got %d at %zu, expected %d at %zu\n", bad,
+                at, got.code, got.offset, want.code, want.offset);
+        failures++;
+    }
+    memcpy(buf + at, saved, n);
+}
+
+int main(void) {
+    // past the size parsed on one thread
+    size_t n = 60000;
+    char* buf = malloc(n * 80 + 64);
+    static const int nthreads[] = {2, 5};
+    for (int shape = 0; shape < 4; shape++) {
+        bool isobj = shape & 1, nested = shape & 2;
+        size_t len = build(buf, n, isobj, nested);
+        for (size_t t = 0; t < sizeof(nthreads) / sizeof(nthreads[0]); t++) {
+            compare(buf, len, nthreads[t]);
+        }
+    }
+
+    size_t len = build(buf, n, false, true);
+    // an element made invalid early, in the middle and at the end
+    for (size_t k = 1; k < 4; k++) {
+        char* p = strstr(buf + len / 4 * k, "null");
+        CHECK(p != NULL);
+        if (p) compare_err(buf, len, (size_t)(p - buf), "nul ", true);
+        // a comma before a newline is a separator, as strings have none
+        p = strstr(buf + len / 4 * k, ",\n");
+        if (p) compare_err(buf, len, (size_t)(p - buf), ":", true);
+    }
+    // a string left open turns the brackets after it inside out, so that no
+    // split is found and the document is parsed whole on this thread
+    char* p = strstr(buf + len - len / 8, "\"s\"");
+    if (p) compare_err(buf, len, (size_t)(p - buf), "\"s\\", false);
+
+    // a document too small to split is parsed on the calling thread
+    int nused = 0;
+    jj_jsonobj* small = jj_parse_parallel("[1,2]", 5, 4, NULL, &nused);
+    CHECK(small && nused == 1);
+    if (small) jj_free(small);
+    free(buf);
+    return check_report();
+}
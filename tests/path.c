@@ -0,0 +1,188 @@
+// Checks that JSON Pointers compiled by `jj_path_compile` resolve as RFC 6901
+// says, and that a `jj_pathset` resolves each of its paths as the path alone
+// does.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "jj.h"
+
+// checks that `pointer` resolves to what writes as `want` from `root`, or
+// does not compile if `want` is NULL.
+static void expect(jj_jsonobj* root, const char* pointer, const char* want) {
+    jj_path* path = jj_path_compile(pointer);
+    if (!want) {
+        if (path) {
+            fprintf(stderr, "%s: compiled\n", pointer);
+            failures++;
+        }
+        jj_path_free(path);
+        return;
+    }
+    if (!path) {
+        fprintf(stderr, "%s: not compiled\n", pointer);
+        failures++;
+        return;
+    }
+    jj_jsonobj* val = jj_path_get(root, path);
+    jj_tostr_config config = {0};
+    char* got = val ? jj_tostr(val, &config) : NULL;
+    if (strcmp(got ? got : "none", want) != 0) {
+        fprintf(stderr, "%s: got %s, expected %s\n", pointer,
+                got ? got : "none", want);
+        failures++;
+    }
+    free(got);
+    jj_path_free(path);
+}
+
+// checks that each path of a set of `pointers` resolves to the same value as
+// when it is compiled alone.
+static void compare(jj_jsonobj* root, const char* const* pointers, size_t n) {
+    jj_pathset* set = jj_pathset_compile(pointers, n);
+    CHECK(set != NULL);
+    if (!set) return;
+    jj_jsonobj** results = malloc(sizeof(jj_jsonobj*) * (n + 1));
+    CHECK(jj_pathset_get(root, set, results));
+    for (size_t i = 0; i < n; i++) {
+        jj_path* path = jj_path_compile(pointers[i]);
+        if (results[i] != jj_path_get(root, path)) {
+            fprintf(stderr, "%s: differs in the set\n", pointers[i]);
+            failures++;
+        }
+        jj_path_free(path);
+    }
+    free(results);
+    jj_pathset_free(set);
+}
+
+static void test_pointers(void) {
+    const char* json =
+        "{\"a\":{\"b\":[10,20,{\"c\":true}]},\"m~n\":1,\"x/y\":2,\"\":3,"
+        "\"01\":4,\"-\":5,\"~1\":6,\"arr\":[[1,2],[3]]}";
+    jj_jsonobj* root = jj_parse(json, strlen(json));
+    CHECK(root != NULL);
+    if (!root) return;
+    expect(root, "/a/b/1", "20");
+    expect(root, "/a/b/2/c", "true");
+    expect(root, "/arr/1/0", "3");
+    expect(root, "/nope", "none");
+    expect(root, "/a/b/3", "none");
+    expect(root, "/a/b/0/z", "none");
+    // escapes: "~0" is '~' and "~1" is '/', unescaped once
+    expect(root, "/m~0n", "1");
+    expect(root, "/x~1y", "2");
+    expect(root, "/~01", "6");
+    expect(root, "/a~2", NULL);
+    expect(root, "/a~", NULL);
+    // "" is the root, "/" the member named ""
+    expect(root, "/", "3");
+    // "-" is past the end of an array, and a name in an object
+    expect(root, "/a/b/-", "none");
+    expect(root, "/-", "5");
+    // indices have no leading 0, but names may
+    expect(root, "/a/b/01", "none");
+    expect(root, "/a/b/00", "none");
+    expect(root, "/a/b/0", "10");
+    expect(root, "/01", "4");
+    expect(root, "/a/b/99999999999999999999999", "none");
+    expect(root, "a", NULL);
+
+    jj_path* path = jj_path_compile("");
+    CHECK(path && jj_path_get(root, path) == root);
+    jj_path_free(path);
+
+    const char* pointers[] = {"/a/b/2/c", "/a/b/0", "/arr/1/0", "/a/b/0", "",
+                              "/nope/x",  "/a",     "/m~0n",    "/a/b/2/c",
+                              "/arr/0/1", "/a/b/-", "/-",       "/a/b/01"};
+    compare(root, pointers, sizeof(pointers) / sizeof(pointers[0]));
+    const char* bad[] = {"/a", "x"};
+    CHECK(jj_pathset_compile(bad, 2) == NULL);
+    jj_free(root);
+}
+
+// NULL arguments fail rather than crash
+static void test_null(void) {
+    CHECK(jj_path_compile(NULL) == NULL);
+    jj_path* path = jj_path_compile("/a");
+    CHECK(jj_path_get(NULL, path) == NULL);
+    jj_jsonobj* root = jj_parse("{\"a\":1}", 7);
+    CHECK(jj_path_get(root, NULL) == NULL);
+    jj_path_free(path);
+
+    const char* pointers[] = {"/a", ""};
+    jj_pathset* set = jj_pathset_compile(pointers, 2);
+    jj_jsonobj* results[2] = {root, root};
+    CHECK(jj_pathset_get(NULL, set, results));
+    CHECK(results[0] == NULL && results[1] == NULL);
+    CHECK(!jj_pathset_get(root, NULL, results));
+    CHECK(jj_pathset_compile(NULL, 1) == NULL);
+    jj_pathset_free(set);
+    jj_pathset_free(NULL);
+    jj_free(root);
+}
+
+// objects large enough to be indexed, and paths deeper than the stack kept
+// on the call stack by `jj_pathset_get`
+static void test_large(void) {
+    char* json = malloc(1 << 16);
+    char* e = json + sprintf(json, "{");
+    for (int i = 0; i < 200; i++) {
+        e += sprintf(e, "%s\"k%d\":{\"v\":[%d,{\"w\":%d}],\"k%d\":%d}",
+                     i ? "," : "", i, i, i * 2, i % 7, i);
+    }
+    e += sprintf(e, ",\"deep\":");
+    for (int i = 0; i < 50; i++) e += sprintf(e, "{\"d\":");
+    e += sprintf(e, "7");
+    for (int i = 0; i < 50; i++) *e++ = '}';
+    e += sprintf(e, "}");
+    jj_jsonobj* root = jj_parse(json, (size_t)(e - json));
+    CHECK(root != NULL);
+    free(json);
+    if (!root) return;
+    char deep[256] = "/deep";
+    for (int i = 0; i < 50; i++) strcat(deep, "/d");
+    expect(root, deep, "7");
+    expect(root, "/k150/v/1/w", "300");
+    expect(root, "/k150/k3", "150");
+
+    for (unsigned seed = 0; seed < 300; seed++) {
+        srand(seed);
+        size_t n = (size_t)(rand() % 40);
+        char names[40][32];
+        const char* pointers[41];
+        for (size_t i = 0; i < n; i++) {
+            int k = rand() % 210;
+            switch (rand() % 5) {
+                case 0:
+                    sprintf(names[i], "/k%d", k);
+                    break;
+                case 1:
+                    sprintf(names[i], "/k%d/v/%d", k, rand() % 3);
+                    break;
+                case 2:
+                    sprintf(names[i], "/k%d/v/1/w", k);
+                    break;
+                case 3:
+                    sprintf(names[i], "/k%d/k%d", k, rand() % 8);
+                    break;
+                default:
+                    strcpy(names[i], rand() % 2 ? "" : "/deep/d/d");
+                    break;
+            }
+            pointers[i] = names[i];
+        }
+        compare(root, pointers, n);
+    }
+    const char* pointers[] = {deep, "/deep/d/d/d"};
+    compare(root, pointers, 2);
+    jj_free(root);
+}
+
+int main(void) {
+    test_pointers();
+    test_null();
+    test_large();
+    return check_report();
+}
@@ -0,0 +1,119 @@
+// Checks that a document fed to `jj_parser_feed` in chunks, split at every
+// offset or byte by byte, parses to the same tree as with `jj_parse`, or
+// fails with the same error, wherever the split falls in a token.
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "jj.h"
+
+static const char* const docs[] = {
+    // strings split inside escapes, surrogate pairs and UTF-8 sequences
+    "[\"a\\\"b\\\\\",\"\\u00e9\\u4e2d\",\"\\ud83d\\ude00\","
+    "\"\\/\\b\\f\\n\\r\\t\"]",
+    "{\"caf\xc3\xa9\":\"\xe4\xb8\xad\xf0\x9f\x98\x80\",\"\":\"\"}",
+    // numbers and literals
+    "[0,-0,12345678901234,-12.5e+3,1E-7,0.000123,9223372036854775807,1e400]",
+    "[true,false,null,{\"t\":true,\"f\":false,\"n\":null}]",
+    "  {\"a\" : [ 1 , { \"b\" : [ ] } , \"x\" ] , \"c\" : { } }  ",
+    "-1.5",
+    "\"only a string\"",
+    "null",
+    "[1,2,]",
+    // invalid
+    "",
+    "   ",
+    "tru",
+    "[trux]",
+    "[1 2]",
+    "{\"a\" 1}",
+    "{\"a\":1",
+    "\"open",
+    "[\"\\x\"]",
+    "[\"\\u12G4\"]",
+    "[\"\\ud83d\"]",
+    "[\"\xc3\"]",
+    "[\"\xc3\xa9\xff\"]",
+    "[01]",
+    "[-]",
+    "[1.]",
+    "[1e]",
+    "[1] x",
+    "{\"a\":1}}",
+};
+#define NDOCS (sizeof(docs) / sizeof(docs[0]))
+
+static char* tostr(jj_jsonobj* root) {
+    jj_tostr_config config = {0};
+    return jj_tostr(root, &config);
+}
+
+// feeds `doc` cut at the offsets `cuts`, ascending, then finishes it.
+static jj_jsonobj* feed(jj_parser* p, const char* doc, size_t len,
+                        const size_t* cuts, size_t ncuts) {
+    size_t start = 0;
+    for (size_t i = 0; i <= ncuts; i++) {
+        size_t end = i < ncuts ? cuts[i] : len;
+        if (!jj_parser_feed(p, doc + start, end - start)) {
+            break;
+        }
+        start = end;
+    }
+    return jj_parser_finish(p);
+}
+
+// checks the result of feeding `doc` against `jj_parse_err`.
+static void expect(jj_parser* p, const char* doc, size_t len,
+                   const size_t* cuts, size_t ncuts, const char* how) {
+    jj_error want;
+    jj_jsonobj* ref = jj_parse_err(doc, len, &want);
+    jj_jsonobj* got = feed(p, doc, len, cuts, ncuts);
+    bool same;
+    if (ref && got) {
+        char* r = tostr(ref);
+        char* g = tostr(got);
+        same = r && g && strcmp(r, g) == 0;
+        free(r);
+        free(g);
+    } else {
+        same = !ref && !got && p->err.code == want.code &&
+               p->err.offset == want.offset;
+    }
+    if (!same) {
+        fprintf(stderr,
+                "%s split %s: got %s %d at %zu, expected %s %d at %zu\n", doc,
+                how, got ? "tree" : "error", got ? 0 : p->err.code,
+                p->err.offset, ref ? "tree" : "error", want.code, want.offset);
+        failures++;
+    }
+    if (ref) jj_free(ref);
+    if (got) jj_free(got);
+}
+
+int main(void) {
+    jj_parser* p = jj_parser_new();
+    CHECK(p != NULL);
+    if (!p) return check_report();
+    for (size_t d = 0; d < NDOCS; d++) {
+        const char* doc = docs[d];
+        size_t len = strlen(doc);
+        expect(p, doc, len, NULL, 0, "nowhere");
+        // at every offset, and at every two
+        for (size_t i = 0; i <= len; i++) {
+            expect(p, doc, len, &i, 1, "once");
+            for (size_t j = i; j <= len; j++) {
+                size_t cuts[2] = {i, j};
+                expect(p, doc, len, cuts, 2, "twice");
+            }
+        }
+        // byte by byte, with empty chunks between
+        size_t* cuts = malloc(sizeof(size_t) * (2 * len + 1));
+        for (size_t i = 0; i < 2 * len; i++) {
+            cuts[i] = (i + 1) / 2;
+        }
+        expect(p, doc, len, cuts, 2 * len, "bytewise");
+        free(cuts);
+    }
+    jj_parser_free(p);
+    return check_report();
+}